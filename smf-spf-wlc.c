@@ -0,0 +1,73 @@
+/*
+ * smf-spf-wlc.c - Whitelist database compiler for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Reads the Whitelist directives of a configuration file, with their
+ * File forms, exactly as smf-spf would and writes the resulting indexes
+ * as a database for the WhitelistDB directive. Other directives are
+ * parsed and ignored, so the source may be smf-spf.conf itself or a
+ * file holding whitelists only. Whitelist*Regex and DomainPolicy
+ * entries have no place in the database; they are reported, as
+ * smf-spf only applies them from its own configuration.
+ *
+ * The database is replaced atomically; a running smf-spf notices the
+ * new file within WHITELIST_DB_CHECK_INTERVAL seconds and maps it.
+ */
+
+#include <stdio.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "config/config.h"
+#include "config/defaults.h"
+
+int main(int argc, char **argv) {
+    struct timespec start, end;
+    long size;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: smf-spf-wlc <source file> <database file>\n");
+        return 2;
+    }
+    /* Configuration errors go to stderr */
+    openlog("smf-spf-wlc", LOG_PERROR, LOG_USER);
+    setlogmask(LOG_UPTO(LOG_ERR));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (config_init() || !config_load(argv[1])) {
+        fprintf(stderr, "smf-spf-wlc: cannot read %s\n", argv[1]);
+        return 1;
+    }
+    if ((size = config_whitelist_save(argv[2])) < 0) {
+        perror("smf-spf-wlc: writing database failed");
+        config_free();
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    /* The set is only allocated once a pattern was added */
+    if (conf.whitelist_re)
+        fprintf(stderr, "smf-spf-wlc: warning: Whitelist*Regex entries are not stored in %s, "
+                "keep them in smf-spf.conf\n", argv[2]);
+    if (conf.domain_policies && conf.domain_policies->count)
+        fprintf(stderr, "smf-spf-wlc: warning: %lu DomainPolicy entries are not stored in %s, "
+                "keep them in smf-spf.conf\n", (unsigned long)conf.domain_policies->count, argv[2]);
+
+    printf("%s: %lu IPv4 and %lu IPv6 ranges, %ld bytes, compiled in %.1f ms\n", argv[2],
+           (unsigned long)conf.ip_whitelist.count, (unsigned long)conf.ip_whitelist.count6, size,
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    config_free();
+    return 0;
+}
@@ -44,6 +44,9 @@
 #include <stdbool.h>
 #include "spf2/spf.h"
 #include "config/config.h"
+#include "cache/cache.h"
+#include "control/control.h"
+#include "utils/spf_record.h"
 
 #define CONFIG_FILE		"/etc/mail/smfs/smf-spf.conf"
 #define WORK_SPACE		"/var/run/smfs"
@@ -77,15 +80,11 @@
 #define MAX_HEADER_SIZE		2048
 #define MAXLINE			258
 #define MAXLOCALPART	64
-#define HASH_POWER		16
 #define FACILITIES_AMOUNT	10
 #define IPV4_DOT_DECIMAL	"^[0-9]{1,3}[.][0-9]{1,3}[.][0-9]{1,3}[.][0-9]{1,3}$"
 
 #define SAFE_FREE(x)		if (x) { free(x); x = NULL; }
 
-#define hash_size(x)		((unsigned long) 1 << x)
-#define hash_mask(x)		(hash_size(x) - 1)
-
 #ifdef __sun__
 int daemon(int nochdir, int noclose) {
     pid_t pid;
@@ -120,14 +119,6 @@ int daemon(int nochdir, int noclose) {
 }
 #endif
 
-typedef struct cache_item {
-    char *item;
-    unsigned long hash;
-    SPF_result_t status;
-    time_t exptime;
-    struct cache_item *next;
-} cache_item;
-
 /* Struct definitions now provided by config module */
 
 struct context {
@@ -141,21 +132,30 @@ struct context {
     char rcpt[MAXLINE];
     char recipient[MAXLINE];
     char key[MAXLINE];
+    char prefix_key[MAXLINE];
+    int prefix_bits;
     char *subject;
+    /* POLICY_* bits of any recipient so far, for the message wide actions */
+    unsigned int policy;
     int is_best_guess;
     STR *rcpts;
     SPF_result_t status;
+    SPF_reason_t reason;
 };
 
 /* IPv4 regex and facilities moved to config module */
-static cache_item **cache = NULL;
+static int cache_ready = 0;
 static const char *config_file = CONFIG_FILE;
 static int foreground = 0;
 /* conf is now extern from config module */
 static char *daemon_name;
 static char hostname[HOST_NAME_MAX+1];
 static pid_t mypid = 0;
-static pthread_mutex_t cache_mutex;
+static pthread_t cache_thread;
+static pthread_mutex_t cache_thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cache_thread_cond = PTHREAD_COND_INITIALIZER;
+static int cache_thread_stop = 0;
+static int cache_thread_running = 0;
 static char *authserv_id = NULL;
 
 static sfsistat smf_connect(SMFICTX *, char *, _SOCK_ADDR *);
@@ -211,90 +211,6 @@ static void strtolower(register char *str) {
 
 /* translate() function moved to config module as config_translate_time() */
 
-static unsigned long hash_code(register const unsigned char *key) {
-    register unsigned long hash = 0;
-    register size_t i, len = strlen((char *)key);
-
-    for (i = 0; i < len; i++) {
-	hash += key[i];
-	hash += (hash << 10);
-	hash ^= (hash >> 6);
-    }
-    hash += (hash << 3);
-    hash ^= (hash >> 11);
-    hash += (hash << 15);
-    return hash;
-}
-
-static int cache_init(void) {
-
-    if (!(cache = calloc(1, hash_size(HASH_POWER) * sizeof(void *)))) return 0;
-    return 1;
-}
-
-static void cache_destroy(void) {
-    unsigned long i, size = hash_size(HASH_POWER);
-    cache_item *it, *it_next;
-
-    for (i = 0; i < size; i++) {
-	it = cache[i];
-	while (it) {
-	    it_next = it->next;
-	    SAFE_FREE(it->item);
-	    SAFE_FREE(it);
-	    it = it_next;
-	}
-    }
-    SAFE_FREE(cache);
-}
-
-static SPF_result_t cache_get(const char *key) {
-    unsigned long hash = hash_code((unsigned char*) key);
-    cache_item *it = cache[hash & hash_mask(HASH_POWER)];
-    time_t curtime = time(NULL);
-
-    while (it) {
-	if (it->hash == hash && it->exptime > curtime && it->item && !strcmp(key, it->item)) return it->status;
-	it = it->next;
-    }
-    return SPF_RESULT_INVALID;
-}
-
-static void cache_put(const char *key, unsigned long ttl, SPF_result_t status) {
-    unsigned long hash = hash_code((unsigned char*) key);
-    time_t curtime = time(NULL);
-    cache_item *it, *parent = NULL;
-
-    it = cache[hash & hash_mask(HASH_POWER)];
-    while (it) {
-	if (it->hash == hash && it->exptime > curtime && it->item && !strcmp(key, it->item)) return;
-	it = it->next;
-    }
-    it = cache[hash & hash_mask(HASH_POWER)];
-    while (it) {
-	if (it->exptime < curtime) {
-	    SAFE_FREE(it->item);
-	    it->item = strdup(key);
-	    it->hash = hash;
-	    it->status = status;
-	    it->exptime = curtime + ttl;
-	    return;
-	}
-	parent = it;
-	it = it->next;
-    }
-    if ((it = (cache_item *) calloc(1, sizeof(cache_item)))) {
-	it->item = strdup(key);
-	it->hash = hash;
-	it->status = status;
-	it->exptime = curtime + ttl;
-	if (parent)
-	    parent->next = it;
-	else
-	    cache[hash & hash_mask(HASH_POWER)] = it;
-    }
-}
-
 /* Configuration functions are now provided by src/config/config.c */
 
 static char * trim_space(char *str) {
@@ -330,6 +246,177 @@ static void mutex_unlock(pthread_mutex_t *mutex) {
     if (pthread_mutex_unlock(mutex)) die("pthread_mutex_unlock");
 }
 
+static void cache_snapshot(void) {
+    long count;
+
+    if ((count = cache_save(conf.cache_file)) < 0)
+	log_message(LOG_ERR, "[ERROR] cache snapshot to %s failed: %s", conf.cache_file, strerror(errno));
+    else
+	log_message(LOG_INFO, "cache snapshot: %ld entries written to %s", count, conf.cache_file);
+}
+
+static void cache_restore(void) {
+    struct timespec start, stop;
+    long count;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    count = cache_load(conf.cache_file);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    if (count < 0) {
+	if (errno != ENOENT) log_message(LOG_WARNING, "cache file %s not loaded: %s", conf.cache_file, strerror(errno));
+	return;
+    }
+    log_message(LOG_INFO, "cache file %s: %ld entries loaded in %ld ms", conf.cache_file, count,
+	(long) ((stop.tv_sec - start.tv_sec) * 1000 + (stop.tv_nsec - start.tv_nsec) / 1000000));
+}
+
+static const SPF_result_t cache_classes[] = {
+    SPF_RESULT_PASS, SPF_RESULT_FAIL, SPF_RESULT_SOFTFAIL, SPF_RESULT_NEUTRAL, SPF_RESULT_NONE
+};
+
+static unsigned long cache_ttl(SPF_result_t status) {
+
+    switch (status) {
+	case SPF_RESULT_PASS: return config_class_ttl(conf.ttl_pass);
+	case SPF_RESULT_FAIL: return config_class_ttl(conf.ttl_fail);
+	case SPF_RESULT_SOFTFAIL: return config_class_ttl(conf.ttl_softfail);
+	case SPF_RESULT_NEUTRAL: return config_class_ttl(conf.ttl_neutral);
+	case SPF_RESULT_NONE: return config_class_ttl(conf.ttl_none);
+	default: return 0;
+    }
+}
+
+static int cache_enabled(void) {
+    size_t i;
+
+    for (i = 0; i < sizeof(cache_classes) / sizeof(cache_classes[0]); i++)
+	if (cache_ttl(cache_classes[i])) return 1;
+    return 0;
+}
+
+/* Key of the client's network, when prefix aggregation is configured */
+static void cache_prefix_key(struct context *context, const char *domain) {
+    unsigned char buf[sizeof(struct in6_addr)];
+    char net[INET6_ADDRSTRLEN];
+    int family = strchr(context->addr, ':') ? AF_INET6 : AF_INET;
+    int bits = family == AF_INET6 ? conf.cache_prefix6 : conf.cache_prefix4;
+    int i, len = family == AF_INET6 ? 128 : 32;
+
+    context->prefix_key[0] = '\0';
+    if (!bits || inet_pton(family, context->addr, buf) != 1) return;
+    for (i = bits; i < len; i++) buf[i / 8] &= ~(0x80 >> (i % 8));
+    if (!inet_ntop(family, buf, net, sizeof(net))) return;
+    snprintf(context->prefix_key, sizeof(context->prefix_key), "%s/%d|%s", net, bits, domain);
+    context->prefix_bits = bits;
+}
+
+/*
+ * Whether every address of the client's prefix provably gets the same
+ * result: the sender's top-level record may only hold ip4/ip6
+ * mechanisms at least as wide as the prefix, and all. Anything that
+ * depends on DNS data about the address (a, mx, ptr, exists, include),
+ * any modifier (redirect, exp), a best guess or a local policy result
+ * is never shared. The record is fetched again and read as text, since
+ * the compiled record of the response may be a redirect target and
+ * stores host mechanisms with no length at all.
+ */
+static int spf_prefix_uniform(const struct context *context, SPF_server_t *spf_server) {
+    SPF_dns_rr_t *rr;
+    const char *record = NULL;
+    int i, records = 0;
+
+    if (!context->prefix_key[0] || context->is_best_guess) return 0;
+    if (context->reason != SPF_REASON_MECH && context->reason != SPF_REASON_DEFAULT) return 0;
+    if (!(rr = SPF_dns_lookup(spf_server->resolver, strchr(context->sender, '@') + 1, ns_t_txt, 1))) return 0;
+    if (rr->herrno == NETDB_SUCCESS)
+	for (i = 0; i < rr->num_rr; i++)
+	    if (spf_record_is_spf1(rr->rr[i]->txt)) {
+		record = rr->rr[i]->txt;
+		records++;
+	    }
+    i = records == 1 && spf_record_prefix_uniform(record, strchr(context->addr, ':') != NULL, context->prefix_bits);
+    SPF_dns_rr_free(rr);
+    return i;
+}
+
+/*
+ * Policy tag of a cached result. Only results of the no-record
+ * fallback depend on the configuration (SPFBestGuess): ClientIPNAT and
+ * FixedClientIP change the evaluated address, which is the key. After
+ * a restart with another fallback, just those results of the cache
+ * file are dropped and the rest stays warm.
+ */
+static unsigned int cache_fallback_tag = 0;
+
+static unsigned int cache_policy_tag(int record) {
+    if (CACHE_RESULT_STATUS(record) != SPF_RESULT_NONE && !(CACHE_RESULT_FLAGS(record) & CACHE_RESULT_BEST_GUESS))
+	return 0;
+    return cache_fallback_tag;
+}
+
+/* Tag of the fallback in force: off, or a digest of the guess record */
+static void cache_policy_init(void) {
+    const char *p;
+    unsigned int hash = 5381;
+
+    for (p = SPF_GUESS_RECORD; *p; p++) hash = hash * 33 + (unsigned char) *p;
+    cache_fallback_tag = conf.best_guess ? 2 + hash % 254 : 1;
+    cache_policy(cache_policy_tag);
+}
+
+static void cache_store(const struct context *context, SPF_result_t status, int uniform) {
+    unsigned long ttl;
+    int record;
+
+    if (!cache_ready || !(ttl = cache_ttl(status))) return;
+    record = CACHE_RESULT_PACK(status, context->is_best_guess ? CACHE_RESULT_BEST_GUESS : 0, context->reason);
+    record = CACHE_RESULT_TAG(record, cache_policy_tag(record));
+    cache_put(context->key, ttl, record);
+    if (uniform && context->prefix_key[0]) cache_put(context->prefix_key, ttl, record);
+}
+
+static void cache_log_stats(void) {
+    cache_stats stats;
+    char buf[1024];
+    size_t i;
+    int len;
+
+    cache_stats_get(&stats, 1);
+    len = cache_stats_format(&stats, buf, sizeof(buf));
+    for (i = 0; i < sizeof(cache_classes) / sizeof(cache_classes[0]) && len >= 0 && (size_t)len < sizeof(buf); i++)
+	len += snprintf(buf + len, sizeof(buf) - len, " %s=%lu/%lu", SPF_strresult(cache_classes[i]),
+	    stats.class_hits[cache_classes[i]], stats.class_stores[cache_classes[i]]);
+    log_message(LOG_INFO, "cache stats: %s", buf);
+}
+
+static void *cache_maintenance(void *arg) {
+    struct timespec deadline;
+    time_t next_snapshot = time(NULL) + conf.cache_file_interval;
+    time_t next_stats = time(NULL) + conf.cache_stats_interval;
+
+    (void)arg;
+    mutex_lock(&cache_thread_mutex);
+    while (!cache_thread_stop) {
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += CACHE_SWEEP_INTERVAL;
+	while (!cache_thread_stop && pthread_cond_timedwait(&cache_thread_cond, &cache_thread_mutex, &deadline) != ETIMEDOUT) continue;
+	if (cache_thread_stop) break;
+	mutex_unlock(&cache_thread_mutex);
+	cache_expire();
+	if (conf.cache_file && conf.cache_file_interval && time(NULL) >= next_snapshot) {
+	    cache_snapshot();
+	    next_snapshot = time(NULL) + conf.cache_file_interval;
+	}
+	if (conf.cache_stats_interval && time(NULL) >= next_stats) {
+	    cache_log_stats();
+	    next_stats = time(NULL) + conf.cache_stats_interval;
+	}
+	mutex_lock(&cache_thread_mutex);
+    }
+    mutex_unlock(&cache_thread_mutex);
+    return NULL;
+}
+
 static int address_preparation(register char *dst, register const char *src) {
     register const char *start = NULL, *stop = NULL, *local = NULL;
     int tail;
@@ -363,7 +450,8 @@ static void add_rcpt(struct context *context) {
 static sfsistat smf_connect(SMFICTX *ctx, char *name, _SOCK_ADDR *sa) {
     struct context *context = NULL;
     char host[64];
-	unsigned long int d_ip;
+    unsigned char addr[16], nat[16];
+    int whitelisted = 0, known = 0;
 
     if (authserv_id == NULL) {
         char* p = NULL;
@@ -382,32 +470,44 @@ static sfsistat smf_connect(SMFICTX *ctx, char *name, _SOCK_ADDR *sa) {
         return SMFIS_ACCEPT;
     }
 
+    config_whitelist_db_refresh(0);
     strscpy(host, "undefined", sizeof(host) - 1);
     switch (sa->sa_family) {
 	case AF_INET: {
 	    struct sockaddr_in *sin = (struct sockaddr_in *)sa;
 
 	    inet_ntop(AF_INET, &sin->sin_addr.s_addr, host, sizeof(host));
+	    whitelisted = config_ip_check(sin->sin_addr.s_addr);
+	    /* NAT rules see IPv4 mapped into IPv6 */
+	    memset(addr, 0, 10);
+	    addr[10] = addr[11] = 0xff;
+	    memcpy(addr + 12, &sin->sin_addr.s_addr, 4);
+	    known = 1;
 	    break;
 	}
 	case AF_INET6: {
 	    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)sa;
 
 	    inet_ntop(AF_INET6, &sin6->sin6_addr, host, sizeof(host));
+	    whitelisted = config_ip6_check(sin6->sin6_addr.s6_addr);
+	    memcpy(addr, sin6->sin6_addr.s6_addr, 16);
+	    known = 1;
 	    break;
 	}
     }
-    if (conf.cidrs && config_ip_check(inet_addr(host))) return SMFIS_ACCEPT;
-    if (conf.ptrs && config_ptr_check(name)) return SMFIS_ACCEPT;
+    if (whitelisted) return SMFIS_ACCEPT;
+    if (config_ptr_check(name)) return SMFIS_ACCEPT;
     if (!(context = calloc(1, sizeof(*context)))) {
 			log_message(LOG_ERR, "[ERROR] %s", strerror(errno)); // LCOV_EXCL_LINE
 			return SMFIS_ACCEPT; // LCOV_EXCL_LINE
     }
     smfi_setpriv(ctx, context);
-    if (conf.ipnats && (d_ip = config_natip_check(inet_addr(host)))) {
-		snprintf(context->addr, sizeof(context->addr), "%li.%li.%li.%li",
-			d_ip & 0xff, d_ip >> 8 & 0xff, d_ip >> 16 & 0xff, d_ip >> 24 & 0xff);
-        log_message(LOG_INFO, "Found  NAT IP address. Original: %s . Final %li (%s)", host, d_ip,context->addr);
+    if (known && conf.ipnats && config_natip6_check(addr, nat)) {
+		if (IN6_IS_ADDR_V4MAPPED((struct in6_addr *)nat))
+		    inet_ntop(AF_INET, nat + 12, context->addr, sizeof(context->addr));
+		else
+		    inet_ntop(AF_INET6, nat, context->addr, sizeof(context->addr));
+        log_message(LOG_INFO, "Found  NAT IP address. Original: %s . Final %s", host, context->addr);
 	} else if (conf.fixed_ip) 
             strscpy(context->addr, conf.fixed_ip, sizeof(context->addr) - 1);
     else
@@ -459,23 +559,31 @@ static sfsistat smf_envfrom(SMFICTX *ctx, char **args) {
 	}
     if (!strstr(context->from, "<>")) {
 	strtolower(context->sender);
-	if (conf.froms && config_from_check(context->sender)) return SMFIS_ACCEPT;
+	if (config_has_from_whitelist() && config_from_check(context->sender)) return SMFIS_ACCEPT;
     }
     SAFE_FREE(context->rcpts);
     SAFE_FREE(context->subject);
+    context->policy = 0;
     context->status = SPF_RESULT_NONE;
+    context->reason = SPF_REASON_NONE;
+    context->is_best_guess = 0;
     if ((site = smfi_getsymval(ctx, "j")))
 	strscpy(context->site, site, sizeof(context->site) - 1);
     else
 	strscpy(context->site, "localhost", sizeof(context->site) - 1);
     snprintf(context->key, sizeof(context->key), "%s|%s", context->addr, strchr(context->sender, '@') + 1);
-    if (cache && conf.spf_ttl) {
-	mutex_lock(&cache_mutex);
-	status = cache_get(context->key);
-	mutex_unlock(&cache_mutex);
-	if (status != SPF_RESULT_INVALID) {
+    cache_prefix_key(context, strchr(context->sender, '@') + 1);
+    if (cache_ready) {
+	int record = cache_get(context->key);
+
+	if (record == CACHE_MISS && context->prefix_key[0]) record = cache_get(context->prefix_key);
+
+	if (record != CACHE_MISS) {
+	    status = CACHE_RESULT_STATUS(record);
+	    context->is_best_guess = CACHE_RESULT_FLAGS(record) & CACHE_RESULT_BEST_GUESS;
+	    context->reason = CACHE_RESULT_REASON(record);
 	    log_message(LOG_INFO, "SPF %s (cached): ip=%s, fqdn=%s, helo=%s, from=%s", SPF_strresult(status), context->addr, context->fqdn, context->helo, context->from);
-	    if (status == SPF_RESULT_FAIL && conf.refuse_fail && !conf.tos) {
+	    if (status == SPF_RESULT_FAIL && conf.refuse_fail && !config_has_to_whitelist() && !config_has_domain_policy()) {
 		char reject[2 * MAXLINE];
 
 		snprintf(reject, sizeof(reject), conf.reject_reason, context->sender, context->addr, context->site);
@@ -510,6 +618,7 @@ static sfsistat smf_envfrom(SMFICTX *ctx, char **args) {
                     context->is_best_guess = 1;
                     status = SPF_response_result(spf_response);
             }
+            context->reason = SPF_response_reason(spf_response);
             if ((status == SPF_RESULT_NONE) || (status == SPF_RESULT_INVALID)) {
                     log_message(LOG_INFO, "SPF none: ip=%s, fqdn=%s, helo=%s, from=%s", context->addr, context->fqdn, context->helo, context->from);
                     if (conf.refuse_none && !strstr(context->from, "<>")) {
@@ -531,15 +640,13 @@ static sfsistat smf_envfrom(SMFICTX *ctx, char **args) {
                             return SMFIS_REJECT;
                     }
             }
-            if (cache && conf.spf_ttl) {
-                    mutex_lock(&cache_mutex);
-                    cache_put(context->key, conf.spf_ttl, SPF_RESULT_NONE);
-                    mutex_unlock(&cache_mutex);
-            }
+            /* No record at all is the same for the whole prefix */
+            cache_store(context, SPF_RESULT_NONE, status == SPF_RESULT_NONE && !context->is_best_guess);
             goto done;
     }
     if (!spf_response) goto done;
     status = SPF_response_result(spf_response);
+    context->reason = SPF_response_reason(spf_response);
     log_message(LOG_NOTICE, "SPF %s: ip=%s, fqdn=%s, helo=%s, from=%s", SPF_strresult(status), context->addr, context->fqdn, context->helo, context->from);
     switch (status) {
 	case SPF_RESULT_PASS:
@@ -547,11 +654,7 @@ static sfsistat smf_envfrom(SMFICTX *ctx, char **args) {
 	case SPF_RESULT_SOFTFAIL:
 	case SPF_RESULT_NEUTRAL:
 	    context->status = status;
-	    if (cache && conf.spf_ttl) {
-		mutex_lock(&cache_mutex);
-		cache_put(context->key, conf.spf_ttl, context->status);
-		mutex_unlock(&cache_mutex);
-	    }
+	    cache_store(context, context->status, spf_prefix_uniform(context, spf_server));
 	    break;
 	default:
 	    break;
@@ -569,7 +672,7 @@ static sfsistat smf_envfrom(SMFICTX *ctx, char **args) {
 		smfi_setreply(ctx, "451" , "4.4.3", reject);
 		return SMFIS_TEMPFAIL;
 	}
-    if (status == SPF_RESULT_FAIL && conf.refuse_fail && !conf.tos) {
+    if (status == SPF_RESULT_FAIL && conf.refuse_fail && !config_has_to_whitelist() && !config_has_domain_policy()) {
 	char reject[2 * MAXLINE];
 
 	snprintf(reject, sizeof(reject), conf.reject_reason, context->sender, context->addr, context->site);
@@ -593,6 +696,7 @@ done:
 
 static sfsistat smf_envrcpt(SMFICTX *ctx, char **args) {
     struct context *context = (struct context *)smfi_getpriv(ctx);
+    unsigned int policy;
 
     if (*args) strscpy(context->rcpt, *args, sizeof(context->rcpt) - 1);
     if (!address_preparation(context->recipient, context->rcpt)) {
@@ -604,14 +708,15 @@ static sfsistat smf_envrcpt(SMFICTX *ctx, char **args) {
             return SMFIS_REJECT;
     }
     }
-    if (conf.tos) {
-	strtolower(context->recipient);
-	if (config_to_check(context->recipient)) return SMFIS_ACCEPT;
-	if (context->status == SPF_RESULT_FAIL && conf.refuse_fail) {
-	    char reject[2 * MAXLINE];
+    strtolower(context->recipient);
+    if (config_has_to_whitelist() && config_to_check(context->recipient)) return SMFIS_ACCEPT;
+    /* Without a WhitelistTo or DomainPolicy, smf_envfrom() already refused */
+    policy = config_rcpt_policy(context->recipient);
+    if (context->status == SPF_RESULT_FAIL && (policy & POLICY_REFUSE_FAIL)) {
+	char reject[2 * MAXLINE];
 
-	    snprintf(reject, sizeof(reject), conf.reject_reason, context->sender, context->addr, context->site);
-        if (conf.soft_fail) {
+	snprintf(reject, sizeof(reject), conf.reject_reason, context->sender, context->addr, context->site);
+        if (policy & POLICY_SOFT_FAIL) {
                 smfi_setreply(ctx, "450", "4.1.1", reject);
                 return SMFIS_TEMPFAIL;
         } else {
@@ -619,22 +724,22 @@ static sfsistat smf_envrcpt(SMFICTX *ctx, char **args) {
                 return SMFIS_REJECT;
         }
     }
-    }
-    if (conf.quarantine && (context->status == SPF_RESULT_FAIL || context->status == SPF_RESULT_SOFTFAIL)) add_rcpt(context);
+    if ((policy & POLICY_QUARANTINE) && (context->status == SPF_RESULT_FAIL || context->status == SPF_RESULT_SOFTFAIL)) add_rcpt(context);
+    context->policy |= policy;
     return SMFIS_CONTINUE;
 }
 
 static sfsistat smf_header(SMFICTX *ctx, char *name, char *value) {
     struct context *context = (struct context *)smfi_getpriv(ctx);
 
-    if (!strcasecmp(name, "Subject") && (context->status == SPF_RESULT_FAIL || context->status == SPF_RESULT_SOFTFAIL) && conf.tag_subject && !context->subject) context->subject = strdup(value);
+    if (!strcasecmp(name, "Subject") && (context->status == SPF_RESULT_FAIL || context->status == SPF_RESULT_SOFTFAIL) && (context->policy & POLICY_TAG_SUBJECT) && !context->subject) context->subject = strdup(value);
     return SMFIS_CONTINUE;
 }
 
 static sfsistat smf_eom(SMFICTX *ctx) {
     struct context *context = (struct context *)smfi_getpriv(ctx);
 
-    if ((context->status == SPF_RESULT_FAIL || context->status == SPF_RESULT_SOFTFAIL) && conf.tag_subject) {
+    if ((context->status == SPF_RESULT_FAIL || context->status == SPF_RESULT_SOFTFAIL) && (context->policy & POLICY_TAG_SUBJECT)) {
 	char *subj = NULL;
 
 	if (context->subject) {
@@ -655,7 +760,7 @@ static sfsistat smf_eom(SMFICTX *ctx) {
 	    free(subj);
 	}
     }
-    if (conf.add_header) {
+    if (context->policy & POLICY_ADD_HEADER) {
 	char *spf_hdr = NULL;
 
 	if ((spf_hdr = calloc(1, MAX_HEADER_SIZE))) {
@@ -688,7 +793,7 @@ static sfsistat smf_eom(SMFICTX *ctx) {
     }
 
 
-    if (conf.add_recv_spf_header) {
+    if (context->policy & POLICY_ADD_RECV_HEADER) {
 	char *spf_hdr = NULL;
 
 	// Make Received-SPF compatible with OpenDMARC 1.4.1
@@ -852,19 +957,45 @@ int main(int argc, char **argv) {
     if (!foreground && conf.daemonize && daemon(0, 0)) {
 	fprintf(stderr, "daemonize failed: %s\n", strerror(errno)); 
 	goto done;
-    }
-    if (pthread_mutex_init(&cache_mutex, 0)) {
-	fprintf(stderr, "pthread_mutex_init failed\n");
-	goto done;
     }
 	// LCOV_EXCL_END
     umask(0177);
-    if (conf.spf_ttl && !cache_init()) log_message(LOG_ERR, "[ERROR] cache engine init failed");
+    if (cache_enabled()) {
+	cache_hugepages(conf.cache_hugepages);
+	cache_adaptive_ttl(conf.ttl_max);
+	cache_policy_init();
+	if (conf.cache_memcached && !(cache_ready = cache_init_memcached(conf.cache_memcached,
+		conf.cache_memcached_pool, conf.cache_memcached_timeout, conf.cache_buckets)))
+	    log_message(LOG_ERR, "[ERROR] memcached servers %s unusable, using a local cache", conf.cache_memcached);
+	if (!cache_ready && conf.cache_shm_name && !(cache_ready = cache_init_shared(conf.cache_shm_name, conf.cache_shm_slots)))
+	    log_message(LOG_ERR, "[ERROR] shared cache %s attach failed: %s, using a private cache", conf.cache_shm_name, strerror(errno));
+	if (!cache_ready && !(cache_ready = cache_init(conf.cache_buckets))) log_message(LOG_ERR, "[ERROR] cache engine init failed");
+	else {
+	    if (conf.cache_file) cache_restore();
+	    if (pthread_create(&cache_thread, NULL, cache_maintenance, NULL))
+		log_message(LOG_ERR, "[ERROR] cache maintenance thread init failed");
+	    else
+		cache_thread_running = 1;
+	    if (conf.control_socket && !control_start(conf.control_socket))
+		log_message(LOG_ERR, "[ERROR] control socket %s unusable: %s", conf.control_socket, strerror(errno));
+	}
+    }
     ret = smfi_main();
     if (ret != MI_SUCCESS) log_message(LOG_ERR, "[ERROR] terminated due to a fatal error");
     else log_message(LOG_NOTICE, "stopping %s %s listening on %s", daemon_name, VERSION, conf.sendmail_socket);
-    if (cache) cache_destroy();
-    pthread_mutex_destroy(&cache_mutex);
+    if (cache_ready) {
+	control_stop();
+	if (cache_thread_running) {
+	    mutex_lock(&cache_thread_mutex);
+	    cache_thread_stop = 1;
+	    pthread_cond_signal(&cache_thread_cond);
+	    mutex_unlock(&cache_thread_mutex);
+	    pthread_join(cache_thread, NULL);
+	}
+	if (conf.cache_stats_interval) cache_log_stats();
+	if (conf.cache_file && ret == MI_SUCCESS) cache_snapshot();
+	cache_destroy();
+    }
 done:
     config_free();
     closelog();
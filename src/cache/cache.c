@@ -0,0 +1,829 @@
+/*  Copyright (C) 2005, 2006 by Eugene Kurmanin <me@kurmanin.info>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "cache_local.h"
+#include "cache_memcached.h"
+#include "cache_shm.h"
+#include "utils/intern.h"
+
+#define SAFE_FREE(x)		if (x) { free(x); x = NULL; }
+
+/* Buckets serialized per lock hold while writing a snapshot */
+#define CACHE_SAVE_CHUNK	1024
+#define CACHE_FILE_BYTEORDER	0x01020304
+/* Longest line of a cache_dump() */
+#define CACHE_DUMP_LINE		1100
+/* Counter blocks, threads are spread over them on first use */
+#define CACHE_STATS_STRIPES	64
+/* Result history slots for adaptive TTLs (a power of two), 8 bytes each */
+#define CACHE_HISTORY_SLOTS	(1UL << 20)
+/* Longest run of unchanged results counted */
+#define CACHE_STREAK_MAX	16
+/* Per-thread result slots (a power of two) and the longest key they keep */
+#define CACHE_THREAD_SLOTS	1024
+#define CACHE_THREAD_KEYLEN	96
+
+/*
+ * Snapshot file layout (native byte order, the byteorder field
+ * rejects files written on a different architecture):
+ *
+ *   header, then count records of
+ *   int64 exptime | int32 status | uint16 keylen | key bytes
+ */
+typedef struct cache_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+    uint64_t count;
+    int64_t created;
+} cache_file_header;
+
+#define CACHE_RECORD_SIZE	(sizeof(int64_t) + sizeof(int32_t) + sizeof(uint16_t))
+
+typedef struct cache_save_buffer {
+    char *data;
+    size_t len;
+    size_t size;
+    uint64_t count;
+    int fail;
+} cache_save_buffer;
+
+/*
+ * The table results are stored in. A remote backend is fronted by a
+ * private table, so repeated lookups stay in process and snapshots
+ * have something to walk.
+ */
+static const cache_backend *backend = NULL;
+static const cache_backend *l1 = NULL;
+
+enum {
+    COUNT_HIT,
+    COUNT_MISS,
+    COUNT_INSERT,
+    COUNT_OVERWRITE,
+    COUNT_EVICT,
+    COUNT_EXPIRE,
+    COUNT_THREAD_HIT,
+    COUNT_EXTEND,
+    COUNT_CLASS_HIT,
+    COUNT_CLASS_STORE = COUNT_CLASS_HIT + CACHE_STATUS_MAX,
+    COUNT_MAX = COUNT_CLASS_STORE + CACHE_STATUS_MAX
+};
+
+/*
+ * Statistics counters. Each thread updates the block it was given,
+ * so busy threads do not fight over one cache line; readers add the
+ * blocks up.
+ */
+typedef struct cache_counters {
+    unsigned long n[COUNT_MAX];
+} __attribute__((aligned(64))) cache_counters;
+
+static cache_counters counters[CACHE_STATS_STRIPES];
+static unsigned int counters_next = 0;
+static __thread cache_counters *thread_counters = NULL;
+
+static const int put_counter[] = { -1, COUNT_INSERT, COUNT_OVERWRITE, COUNT_EVICT };
+
+/*
+ * Direct-mapped result cache private to each thread, consulted before
+ * the shared table: a repeated lookup is served without taking a lock
+ * or touching a shared cache line. Slots are filled on shared hits and
+ * dropped as a whole when the generation moves, e.g. on cache_destroy().
+ * With the shared-memory table the generation lives in the segment, so
+ * a flush by one instance also drops the slots of the others.
+ */
+typedef struct cache_thread_slot {
+    unsigned long hash;
+    uint64_t generation;
+    time_t exptime;
+    int status;
+    char key[CACHE_THREAD_KEYLEN];
+} cache_thread_slot;
+
+/*
+ * Result history for adaptive TTLs: per key hash, the last result
+ * stored and how many evaluations in a row gave it, packed as
+ * hash tag (top 40 bits) | status and flags (16) | streak (8). Lossy:
+ * a slot taken over by another key just restarts that key's count.
+ */
+static uint64_t *history = NULL;
+static unsigned long ttl_max = 0;
+
+static cache_policy_fn policy = NULL;
+static uint64_t local_generation = 1;
+static uint64_t *cache_generation = &local_generation;
+static pthread_key_t thread_slots_key;
+static pthread_once_t thread_slots_once = PTHREAD_ONCE_INIT;
+static __thread cache_thread_slot *thread_slots = NULL;
+
+
+/**
+ * hash_code - One-at-a-time hash of a cache key
+ */
+static unsigned long hash_code(const unsigned char *key) {
+    unsigned long hash = 0;
+    size_t i, len = strlen((const char *)key);
+
+    for (i = 0; i < len; i++) {
+        hash += key[i];
+        hash += (hash << 10);
+        hash ^= (hash >> 6);
+    }
+    hash += (hash << 3);
+    hash ^= (hash >> 11);
+    hash += (hash << 15);
+    return hash;
+}
+
+
+static void cache_count(int counter, unsigned long n) {
+    if (!thread_counters)
+        thread_counters = &counters[__atomic_fetch_add(&counters_next, 1, __ATOMIC_RELAXED) % CACHE_STATS_STRIPES];
+    __atomic_fetch_add(&thread_counters->n[counter], n, __ATOMIC_RELAXED);
+}
+
+static void cache_count_class(int base, int status) {
+    if (status >= 0 && status < CACHE_STATUS_MAX)
+        cache_count(base + status, 1);
+}
+
+
+static int history_init(void) {
+    if (!ttl_max || history)
+        return 1;
+    return (history = (uint64_t *)calloc(CACHE_HISTORY_SLOTS, sizeof(uint64_t))) != NULL;
+}
+
+/**
+ * history_ttl - TTL of a result, extended by the key's stable streak
+ * @entry: Set to the history slot value to record once stored
+ *
+ * Each evaluation in a row giving the same result doubles the TTL, up
+ * to ttl_max; a different result starts over from the base TTL.
+ */
+static unsigned long history_ttl(unsigned long hash, int status, unsigned long ttl, uint64_t *entry) {
+    uint64_t tag = (uint64_t)hash & ~(uint64_t)0xffffff, old;
+    unsigned int streak = 0;
+    unsigned long extended = ttl;
+
+    old = __atomic_load_n(&history[hash & (CACHE_HISTORY_SLOTS - 1)], __ATOMIC_RELAXED);
+    if ((old & ~(uint64_t)0xffffff) == tag && ((old >> 8) & 0xffff) == ((unsigned int)status & 0xffff))
+        streak = (old & 0xff) < CACHE_STREAK_MAX ? (old & 0xff) + 1 : CACHE_STREAK_MAX;
+    *entry = tag | (uint64_t)((unsigned int)status & 0xffff) << 8 | streak;
+    while (streak-- && extended < ttl_max)
+        extended <<= 1;
+    if (extended > ttl_max)
+        extended = ttl_max;
+    return extended > ttl ? extended : ttl;
+}
+
+
+/* Whether a lookup found a record of the running policy */
+static int record_current(int record) {
+    return record != CACHE_MISS && (!policy || CACHE_RESULT_POLICY(record) == policy(record));
+}
+
+
+static void thread_slots_init(void) {
+    /* The slots of a thread are freed when it exits */
+    pthread_key_create(&thread_slots_key, free);
+}
+
+/* Drop every result held by the threads */
+static void thread_slots_invalidate(void) {
+    __atomic_add_fetch(cache_generation, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Count generations in the segment, never going back to a value the
+ * slots may already be stamped with
+ */
+static void thread_slots_share(uint64_t *generation) {
+    uint64_t g = __atomic_load_n(generation, __ATOMIC_ACQUIRE);
+
+    while (g <= local_generation &&
+           !__atomic_compare_exchange_n(generation, &g, local_generation + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        continue;
+    cache_generation = generation;
+}
+
+/* Back to a private count, past the shared one so every slot is stale */
+static void thread_slots_unshare(void) {
+    uint64_t g = __atomic_load_n(cache_generation, __ATOMIC_ACQUIRE);
+
+    if (g < local_generation)
+        g = local_generation;
+    __atomic_store_n(&local_generation, g + 1, __ATOMIC_RELEASE);
+    cache_generation = &local_generation;
+}
+
+static int thread_get(const char *key, unsigned long hash, time_t curtime) {
+    cache_thread_slot *slot;
+
+    if (!thread_slots)
+        return CACHE_MISS;
+    slot = &thread_slots[hash & (CACHE_THREAD_SLOTS - 1)];
+    if (slot->generation == __atomic_load_n(cache_generation, __ATOMIC_ACQUIRE) &&
+        slot->hash == hash && slot->exptime > curtime && !strcmp(key, slot->key))
+        return slot->status;
+    return CACHE_MISS;
+}
+
+/* generation is read before the record was looked up, so a flush in
+ * between leaves the slot already stale */
+static void thread_put(const char *key, unsigned long hash, int status, time_t exptime, uint64_t generation) {
+    cache_thread_slot *slot;
+    size_t len = strlen(key);
+
+    if (len >= CACHE_THREAD_KEYLEN || !exptime)
+        return;
+    if (!thread_slots) {
+        pthread_once(&thread_slots_once, thread_slots_init);
+        if (!(thread_slots = (cache_thread_slot *)calloc(CACHE_THREAD_SLOTS, sizeof(cache_thread_slot))))
+            return;
+        pthread_setspecific(thread_slots_key, thread_slots);
+    }
+    slot = &thread_slots[hash & (CACHE_THREAD_SLOTS - 1)];
+    slot->generation = generation;
+    slot->hash = hash;
+    slot->exptime = exptime;
+    slot->status = status;
+    memcpy(slot->key, key, len + 1);
+}
+
+
+/**
+ * cache_init - Allocate the in-process result table
+ * @buckets: Initial size, zero for 2^HASH_POWER; the table grows by
+ *           itself as it fills up
+ *
+ * Returns: 1 on success, 0 on failure
+ */
+int cache_init(unsigned long buckets) {
+    if (!history_init())
+        return 0;
+    if (!cache_local_init(buckets ? buckets : 1UL << HASH_POWER))
+        return 0;
+    memset(counters, 0, sizeof(counters));
+    backend = &cache_local_backend;
+    l1 = NULL;
+    return 1;
+}
+
+
+/**
+ * cache_init_shared - Use a host-wide shared-memory table instead
+ * @name: POSIX shared-memory object name
+ * @slots: Table size if this instance creates the segment
+ *
+ * Every instance configured with the same name shares its results.
+ *
+ * Returns: 1 on success, 0 on failure (errno is set)
+ */
+int cache_init_shared(const char *name, unsigned long slots) {
+    if (!history_init())
+        return 0;
+    if (!cache_shm_attach(name, slots))
+        return 0;
+    thread_slots_share(cache_shm_generation());
+    memset(counters, 0, sizeof(counters));
+    backend = &cache_shm_backend;
+    l1 = NULL;
+    return 1;
+}
+
+
+/**
+ * cache_init_memcached - Share results across hosts through memcached
+ * @servers: Comma separated host:port list
+ * @pool: Connections kept per server
+ * @timeout_ms: Connect and I/O timeout per request
+ * @buckets: Initial size of the private table, as cache_init()
+ *
+ * Results are also kept in a private table in front of the servers.
+ *
+ * Returns: 1 on success, 0 on failure
+ */
+int cache_init_memcached(const char *servers, unsigned int pool, unsigned long timeout_ms, unsigned long buckets) {
+    if (!history_init())
+        return 0;
+    if (!cache_local_init(buckets ? buckets : 1UL << HASH_POWER))
+        return 0;
+    if (!cache_memcached_init(servers, pool, timeout_ms)) {
+        cache_local_backend.destroy();
+        return 0;
+    }
+    memset(counters, 0, sizeof(counters));
+    backend = &cache_memcached_backend;
+    l1 = &cache_local_backend;
+    return 1;
+}
+
+
+/**
+ * cache_destroy - Release the result table and any backend resources
+ */
+void cache_destroy(void) {
+    /* The other instances keep their slots */
+    thread_slots_unshare();
+    if (l1)
+        l1->destroy();
+    if (backend)
+        backend->destroy();
+    backend = l1 = NULL;
+    SAFE_FREE(history);
+}
+
+
+/**
+ * cache_hugepages - Back large tables with hugepages when possible
+ * @enable: Nonzero to ask for hugepages
+ *
+ * Takes effect for tables set up by the following cache_init*()
+ * calls. Hugepages are used only when the system provides them.
+ */
+void cache_hugepages(int enable) {
+    cache_local_hugepages(enable);
+    cache_shm_hugepages(enable);
+}
+
+
+/**
+ * cache_adaptive_ttl - Extend the TTL of results that keep repeating
+ * @max: Longest TTL given, zero to store every result for its base TTL
+ *
+ * Takes effect for tables set up by the following cache_init*()
+ * calls. Each re-evaluation of a key that gives the same result as
+ * the previous one doubles its TTL, up to max.
+ */
+void cache_adaptive_ttl(unsigned long max) {
+    ttl_max = max;
+}
+
+
+/**
+ * cache_get - Look up a cached SPF result
+ * @key: "ip|domain" cache key
+ *
+ * Returns: cached result record, or CACHE_MISS if absent or expired
+ */
+int cache_get(const char *key) {
+    unsigned long hash = hash_code((const unsigned char *)key);
+    uint64_t generation = __atomic_load_n(cache_generation, __ATOMIC_ACQUIRE);
+    time_t curtime = time(NULL), exptime = 0;
+    int status;
+
+    if (record_current(status = thread_get(key, hash, curtime))) {
+        cache_count(COUNT_THREAD_HIT, 1);
+    } else {
+        status = l1 ? l1->get(key, hash, curtime, &exptime) : CACHE_MISS;
+        if (!record_current(status)) {
+            status = backend->get(key, hash, curtime, &exptime);
+            /* Keep a remote hit until it expires on the server */
+            if (l1 && record_current(status))
+                l1->put(key, hash, status, exptime, curtime);
+        }
+        if (!record_current(status)) {
+            cache_count(COUNT_MISS, 1);
+            return CACHE_MISS;
+        }
+        thread_put(key, hash, status, exptime, generation);
+    }
+    cache_count(COUNT_HIT, 1);
+    cache_count_class(COUNT_CLASS_HIT, CACHE_RESULT_STATUS(status));
+    return status;
+}
+
+
+/**
+ * cache_put - Store an SPF result for ttl seconds
+ * @key: "ip|domain" cache key
+ * @ttl: Lifetime in seconds, possibly extended, see cache_adaptive_ttl()
+ * @status: Result record, see CACHE_RESULT_PACK()
+ */
+void cache_put(const char *key, unsigned long ttl, int status) {
+    unsigned long hash = hash_code((const unsigned char *)key);
+    time_t curtime = time(NULL);
+    uint64_t entry = 0;
+    unsigned long base = ttl;
+    int counter;
+
+    if (history)
+        ttl = history_ttl(hash, status, ttl, &entry);
+    if (l1)
+        l1->put(key, hash, status, curtime + ttl, curtime);
+    if ((counter = put_counter[backend->put(key, hash, status, curtime + ttl, curtime)]) >= 0) {
+        cache_count(counter, 1);
+        cache_count_class(COUNT_CLASS_STORE, CACHE_RESULT_STATUS(status));
+        /* Only an evaluation that got stored extends the streak */
+        if (history) {
+            __atomic_store_n(&history[hash & (CACHE_HISTORY_SLOTS - 1)], entry, __ATOMIC_RELAXED);
+            if (ttl > base)
+                cache_count(COUNT_EXTEND, 1);
+        }
+    }
+}
+
+
+/**
+ * cache_policy - Set how records evaluated under another policy are told
+ * @fn: Policy tag expected for a record, NULL to accept any record
+ *
+ * A record whose CACHE_RESULT_POLICY() tag differs from what fn
+ * returns for it is a miss, is skipped by cache_load() and gets
+ * replaced by the next cache_put() of its key. Only the records fn
+ * maps to a changed tag are affected.
+ */
+void cache_policy(cache_policy_fn fn) {
+    policy = fn;
+    thread_slots_invalidate();
+}
+
+
+/**
+ * cache_expire - Free results that have expired
+ *
+ * Called periodically by the maintenance thread. The cost is
+ * proportional to the number of expired results, not the table size.
+ *
+ * Returns: number of results freed
+ */
+unsigned long cache_expire(void) {
+    time_t curtime = time(NULL);
+    unsigned long freed = 0;
+
+    if (l1)
+        freed += l1->expire(curtime);
+    if (backend && backend->expire)
+        freed += backend->expire(curtime);
+    if (freed)
+        cache_count(COUNT_EXPIRE, freed);
+    return freed;
+}
+
+
+/**
+ * cache_flush - Drop the results whose key matches
+ * @match: Selects the keys, NULL for every result
+ * @arg: Passed to match
+ *
+ * @kept: Set to 1 when a remote table kept results, may be NULL
+ *
+ * The tables are visited CACHE_SAVE_CHUNK buckets per lock hold, so
+ * lookups go on meanwhile. memcached servers cannot be searched: they
+ * are emptied as a whole when every result is flushed, and otherwise
+ * keep theirs until they expire.
+ *
+ * Returns: number of results dropped from the tables that could be
+ *          searched
+ */
+unsigned long cache_flush(cache_matcher match, void *arg, int *kept) {
+    const cache_backend *tables[] = { l1, backend };
+    time_t curtime = time(NULL);
+    unsigned long i, size, n = 0;
+    size_t t;
+    int remote_kept = 0;
+
+    for (t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) {
+        if (!tables[t])
+            continue;
+        if (!tables[t]->flush) {
+            if (match || !tables[t]->clear || !tables[t]->clear(curtime))
+                remote_kept = 1;
+            continue;
+        }
+        size = tables[t]->buckets();
+        for (i = 0; i < size; i += CACHE_SAVE_CHUNK)
+            n += tables[t]->flush(i, CACHE_SAVE_CHUNK, curtime, match, arg);
+    }
+    /* Threads may hold copies of anything that was dropped */
+    thread_slots_invalidate();
+    if (kept)
+        *kept = remote_kept;
+    return n;
+}
+
+
+/**
+ * cache_stats_get - Collect the cache statistics
+ * @stats: Filled in
+ * @histogram: Also count entries and chain lengths with a full pass
+ *
+ * The pass takes each lock for CACHE_SAVE_CHUNK buckets at most. With
+ * a remote backend it covers the results held in process.
+ */
+void cache_stats_get(cache_stats *stats, int histogram) {
+    const cache_backend *table = backend && backend->chains ? backend : l1;
+    time_t curtime = time(NULL);
+    unsigned long i, size;
+    int s, c;
+
+    memset(stats, 0, sizeof(*stats));
+    for (s = 0; s < CACHE_STATS_STRIPES; s++) {
+        unsigned long n[COUNT_MAX];
+
+        for (c = 0; c < COUNT_MAX; c++)
+            n[c] = __atomic_load_n(&counters[s].n[c], __ATOMIC_RELAXED);
+        stats->hits += n[COUNT_HIT];
+        stats->misses += n[COUNT_MISS];
+        stats->insertions += n[COUNT_INSERT];
+        stats->overwrites += n[COUNT_OVERWRITE];
+        stats->evictions += n[COUNT_EVICT];
+        stats->expirations += n[COUNT_EXPIRE];
+        stats->thread_hits += n[COUNT_THREAD_HIT];
+        stats->extended += n[COUNT_EXTEND];
+        for (c = 0; c < CACHE_STATUS_MAX; c++) {
+            stats->class_hits[c] += n[COUNT_CLASS_HIT + c];
+            stats->class_stores[c] += n[COUNT_CLASS_STORE + c];
+        }
+    }
+    if (!histogram || !table)
+        return;
+    size = table->buckets();
+    for (i = 0; i < size; i += CACHE_SAVE_CHUNK)
+        stats->entries += table->chains(i, CACHE_SAVE_CHUNK, curtime, stats->chains);
+    stats->buckets = size;
+    stats->domains = intern_count();
+}
+
+
+/**
+ * cache_stats_format - Render statistics as a single log line
+ *
+ * Returns: length of the line, as snprintf()
+ */
+int cache_stats_format(const cache_stats *stats, char *buf, size_t size) {
+    unsigned long lookups = stats->hits + stats->misses;
+    int len, i;
+
+    len = snprintf(buf, size, "hits=%lu thread_hits=%lu misses=%lu hit_rate=%.1f%% insertions=%lu overwrites=%lu evictions=%lu expirations=%lu extended=%lu",
+        stats->hits, stats->thread_hits, stats->misses, lookups ? 100.0 * stats->hits / lookups : 0.0,
+        stats->insertions, stats->overwrites, stats->evictions, stats->expirations, stats->extended);
+    if (!stats->buckets || len < 0 || (size_t)len >= size)
+        return len;
+    len += snprintf(buf + len, size - len, " entries=%lu buckets=%lu load=%.2f domains=%lu chains=",
+        stats->entries, stats->buckets, (double)stats->entries / stats->buckets, stats->domains);
+    for (i = 0; i < CACHE_CHAIN_HIST && (size_t)len < size; i++)
+        len += snprintf(buf + len, size - len, "%s%d%s:%lu", i ? "," : "", i,
+            i == CACHE_CHAIN_HIST - 1 ? "+" : "", stats->chains[i]);
+    return len;
+}
+
+
+/**
+ * cache_save_record - Append one snapshot record to the write buffer
+ */
+static void cache_save_record(const char *key, int status, time_t exptime, void *arg) {
+    cache_save_buffer *buf = (cache_save_buffer *)arg;
+    int64_t exp64 = (int64_t)exptime;
+    int32_t status32 = (int32_t)status;
+    size_t len = strlen(key);
+    uint16_t keylen;
+
+    if (buf->fail || len > UINT16_MAX)
+        return;
+    keylen = (uint16_t)len;
+    if (buf->len + CACHE_RECORD_SIZE + len > buf->size) {
+        size_t new_size = (buf->size ? buf->size * 2 : 4096) + len;
+        char *new_data = realloc(buf->data, new_size);
+
+        if (!new_data) {
+            buf->fail = 1;
+            return;
+        }
+        buf->data = new_data;
+        buf->size = new_size;
+    }
+    memcpy(buf->data + buf->len, &exp64, sizeof(exp64));
+    buf->len += sizeof(exp64);
+    memcpy(buf->data + buf->len, &status32, sizeof(status32));
+    buf->len += sizeof(status32);
+    memcpy(buf->data + buf->len, &keylen, sizeof(keylen));
+    buf->len += sizeof(keylen);
+    memcpy(buf->data + buf->len, key, len);
+    buf->len += len;
+    buf->count++;
+}
+
+
+/**
+ * cache_dump_record - Append one dump line to the buffer
+ */
+static void cache_dump_record(const char *key, int status, time_t exptime, void *arg) {
+    cache_save_buffer *buf = (cache_save_buffer *)arg;
+    char line[CACHE_DUMP_LINE];
+    int len;
+
+    len = snprintf(line, sizeof(line), "%s %d %d %d %u %ld\n", key, CACHE_RESULT_STATUS(status),
+        CACHE_RESULT_FLAGS(status), CACHE_RESULT_REASON(status), CACHE_RESULT_POLICY(status), (long)exptime);
+    if (buf->fail || len < 0 || (size_t)len >= sizeof(line))
+        return;
+    if (buf->len + len > buf->size) {
+        size_t new_size = (buf->size ? buf->size * 2 : 4096) + len;
+        char *new_data = realloc(buf->data, new_size);
+
+        if (!new_data) {
+            buf->fail = 1;
+            return;
+        }
+        buf->data = new_data;
+        buf->size = new_size;
+    }
+    memcpy(buf->data + buf->len, line, len);
+    buf->len += len;
+    buf->count++;
+}
+
+
+/**
+ * cache_dump - Stream the live results as text
+ * @writer: Receives the lines, a chunk of buckets at a time
+ * @arg: Passed to writer
+ *
+ * One line per result: key, status, flags, reason, policy tag and
+ * absolute expiry time, separated by spaces. The lines of a chunk are
+ * formatted under the lock and handed to writer after it is released,
+ * so a slow reader never holds up lookups.
+ *
+ * Returns: number of results written, or -1 on error
+ */
+long cache_dump(cache_writer writer, void *arg) {
+    const cache_backend *table = backend && backend->walk ? backend : l1;
+    cache_save_buffer buf;
+    time_t curtime = time(NULL);
+    unsigned long i, size;
+    int fail = 0;
+
+    if (!table)
+        return -1;
+    memset(&buf, 0, sizeof(buf));
+    size = table->buckets();
+    for (i = 0; i < size && !fail; i += CACHE_SAVE_CHUNK) {
+        buf.len = 0;
+        table->walk(i, CACHE_SAVE_CHUNK, curtime, cache_dump_record, &buf);
+        if (buf.fail || (buf.len && !writer(buf.data, buf.len, arg)))
+            fail = 1;
+    }
+    SAFE_FREE(buf.data);
+    return fail ? -1 : (long)buf.count;
+}
+
+
+/**
+ * cache_save - Write all live entries to a snapshot file
+ * @filepath: Destination file, replaced atomically
+ *
+ * The table is walked CACHE_SAVE_CHUNK buckets at a time so lookups
+ * are never blocked for the whole dump. With a remote backend only
+ * the results held in process are written.
+ *
+ * Returns: number of entries written, or -1 on error
+ */
+long cache_save(const char *filepath) {
+    cache_file_header hdr;
+    cache_save_buffer buf;
+    char tmppath[PATH_MAX];
+    const cache_backend *table = backend && backend->walk ? backend : l1;
+    unsigned long i, size;
+    time_t curtime = time(NULL);
+    FILE *fp;
+    int fail = 0;
+
+    if (!table || !filepath)
+        return -1;
+
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", filepath);
+    if (!(fp = fopen(tmppath, "w")))
+        return -1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC));
+    hdr.version = CACHE_FILE_VERSION;
+    hdr.byteorder = CACHE_FILE_BYTEORDER;
+    hdr.created = (int64_t)curtime;
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+        fail = 1;
+
+    memset(&buf, 0, sizeof(buf));
+    size = table->buckets();
+    for (i = 0; i < size && !fail; i += CACHE_SAVE_CHUNK) {
+        buf.len = 0;
+        table->walk(i, CACHE_SAVE_CHUNK, curtime, cache_save_record, &buf);
+        if (buf.fail || (buf.len && fwrite(buf.data, buf.len, 1, fp) != 1))
+            fail = 1;
+    }
+    SAFE_FREE(buf.data);
+
+    hdr.count = buf.count;
+    if (!fail && (fseek(fp, 0, SEEK_SET) || fwrite(&hdr, sizeof(hdr), 1, fp) != 1))
+        fail = 1;
+    if (!fail && (fflush(fp) || fsync(fileno(fp))))
+        fail = 1;
+    if (fclose(fp))
+        fail = 1;
+    if (fail || rename(tmppath, filepath)) {
+        unlink(tmppath);
+        return -1;
+    }
+    return (long)buf.count;
+}
+
+
+/**
+ * cache_load - Populate the cache from a snapshot file
+ * @filepath: File written by cache_save()
+ *
+ * The file is mapped read-only and expired records are skipped.
+ * A truncated file loads every complete record before the damage.
+ *
+ * Returns: number of entries loaded, or -1 if the file is missing,
+ *          unreadable or not a snapshot of this version
+ */
+long cache_load(const char *filepath) {
+    const cache_file_header *hdr;
+    const unsigned char *map, *p, *map_end;
+    time_t curtime = time(NULL);
+    struct stat st;
+    const cache_backend *table = l1 ? l1 : backend;
+    uint64_t n;
+    long loaded = 0;
+    int fd;
+
+    if (!table || !filepath)
+        return -1;
+    if ((fd = open(filepath, O_RDONLY)) < 0)
+        return -1;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(cache_file_header)) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    hdr = (const cache_file_header *)map;
+    if (memcmp(hdr->magic, CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC)) ||
+        hdr->version != CACHE_FILE_VERSION || hdr->byteorder != CACHE_FILE_BYTEORDER) {
+        munmap((void *)map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    map_end = map + st.st_size;
+    p = map + sizeof(cache_file_header);
+    for (n = 0; n < hdr->count && (size_t)(map_end - p) >= CACHE_RECORD_SIZE; n++) {
+        char key[UINT16_MAX + 1];
+        int64_t exptime;
+        int32_t status;
+        uint16_t keylen;
+
+        memcpy(&exptime, p, sizeof(exptime));
+        p += sizeof(exptime);
+        memcpy(&status, p, sizeof(status));
+        p += sizeof(status);
+        memcpy(&keylen, p, sizeof(keylen));
+        p += sizeof(keylen);
+        if ((size_t)(map_end - p) < keylen)
+            break;
+        memcpy(key, p, keylen);
+        key[keylen] = '\0';
+        p += keylen;
+        if ((time_t)exptime <= curtime || !keylen || !record_current(status))
+            continue;
+        table->put(key, hash_code((unsigned char *)key), status, (time_t)exptime, curtime);
+        loaded++;
+    }
+
+    munmap((void *)map, st.st_size);
+    return loaded;
+}
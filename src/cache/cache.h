@@ -0,0 +1,114 @@
+/*  Copyright (C) 2005, 2006 by Eugene Kurmanin <me@kurmanin.info>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+/* Default size of the in-process table is 2^HASH_POWER buckets */
+#define HASH_POWER		16
+
+/* Returned by cache_get() on a miss, same value as SPF_RESULT_INVALID */
+#define CACHE_MISS		0
+
+/* Seconds between two runs of cache_expire() */
+#define CACHE_SWEEP_INTERVAL	1
+
+/*
+ * Cached values are compact result records packed in an int: the
+ * SPF_result_t in the low byte, CACHE_RESULT_* flags in the next one,
+ * the SPF_reason_t above them and the policy tag in the top byte. A
+ * bare status is a valid record.
+ */
+#define CACHE_RESULT_PACK(status, flags, reason)	((int)(status) | (int)(flags) << 8 | (int)(reason) << 16)
+#define CACHE_RESULT_TAG(v, policy)	((int)(((unsigned int)(v) & 0xffffff) | ((unsigned int)(policy) & 0xff) << 24))
+#define CACHE_RESULT_STATUS(v)		((v) & 0xff)
+#define CACHE_RESULT_FLAGS(v)		(((v) >> 8) & 0xff)
+#define CACHE_RESULT_REASON(v)		(((v) >> 16) & 0xff)
+#define CACHE_RESULT_POLICY(v)		(((unsigned int)(v) >> 24) & 0xff)
+#define CACHE_RESULT_BEST_GUESS		0x01
+
+/*
+ * Returns the policy tag a record must carry to still be valid under
+ * the running configuration, see cache_policy()
+ */
+typedef unsigned int (*cache_policy_fn)(int record);
+
+/* Selects keys for cache_flush(), returns nonzero to drop the entry */
+typedef int (*cache_matcher)(const char *key, void *arg);
+
+/* Receives cache_dump() output in pieces of whole lines, returns 0 to stop */
+typedef int (*cache_writer)(const char *buf, size_t len, void *arg);
+
+/* Chain length histogram: buckets with 0 .. CACHE_CHAIN_HIST-2 live
+ * entries, then CACHE_CHAIN_HIST-1 or more */
+#define CACHE_CHAIN_HIST	8
+/* Statuses counted per class, SPF_result_t values are below this */
+#define CACHE_STATUS_MAX	8
+
+typedef struct cache_stats {
+    unsigned long hits;
+    /* Part of the hits served by the per-thread slots */
+    unsigned long thread_hits;
+    unsigned long misses;
+    unsigned long insertions;
+    unsigned long overwrites;
+    unsigned long evictions;
+    unsigned long expirations;
+    /* Stores given a longer TTL for a stable result */
+    unsigned long extended;
+    unsigned long class_hits[CACHE_STATUS_MAX];
+    unsigned long class_stores[CACHE_STATUS_MAX];
+    /* Filled by a full table pass only */
+    unsigned long entries;
+    unsigned long buckets;
+    unsigned long domains;
+    unsigned long chains[CACHE_CHAIN_HIST];
+} cache_stats;
+
+/* Snapshot file format */
+#define CACHE_FILE_MAGIC	"SMFSPFC"
+#define CACHE_FILE_VERSION	1
+
+/* Initialization and Cleanup */
+int cache_init(unsigned long buckets);
+int cache_init_shared(const char *name, unsigned long slots);
+int cache_init_memcached(const char *servers, unsigned int pool, unsigned long timeout_ms, unsigned long buckets);
+void cache_destroy(void);
+void cache_hugepages(int enable);
+void cache_adaptive_ttl(unsigned long max);
+
+/* Lookups (thread safe, status is a CACHE_RESULT_PACK() record) */
+int cache_get(const char *key);
+void cache_put(const char *key, unsigned long ttl, int status);
+void cache_policy(cache_policy_fn fn);
+
+/* Maintenance */
+unsigned long cache_expire(void);
+unsigned long cache_flush(cache_matcher match, void *arg, int *kept);
+long cache_dump(cache_writer writer, void *arg);
+
+/* Statistics */
+void cache_stats_get(cache_stats *stats, int histogram);
+int cache_stats_format(const cache_stats *stats, char *buf, size_t size);
+
+/* Persistence */
+long cache_save(const char *filepath);
+long cache_load(const char *filepath);
+
+#endif /* CACHE_H */
@@ -0,0 +1,59 @@
+/*  Copyright (C) 2005, 2006 by Eugene Kurmanin <me@kurmanin.info>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef CACHE_BACKEND_H
+#define CACHE_BACKEND_H
+
+#include <time.h>
+
+#include "cache.h"
+
+typedef void (*cache_walker)(const char *key, int status, time_t exptime, void *arg);
+
+/* What a put did, for the statistics */
+#define CACHE_PUT_NONE		0	/* live entry kept, or nothing stored */
+#define CACHE_PUT_INSERT	1	/* new entry */
+#define CACHE_PUT_OVERWRITE	2	/* expired entry replaced */
+#define CACHE_PUT_EVICT		3	/* live entry pushed out */
+
+/*
+ * Storage behind cache_get()/cache_put(). Keys arrive with their hash
+ * already computed; exptime is absolute and get() reports it on a hit
+ * when asked to, put() returns a CACHE_PUT_* outcome. Backends that
+ * reclaim space on their own leave expire NULL. Backends that cannot
+ * be enumerated (remote ones) leave buckets, walk, chains and flush
+ * NULL and are never snapshotted. chains() adds the number of live
+ * entries of each bucket of a range to a CACHE_CHAIN_HIST histogram
+ * and returns their total; flush() drops the entries of a range whose
+ * key matches and returns how many it dropped. clear() empties a
+ * backend that cannot be searched and returns 1 once all of it was
+ * emptied, backends that cannot do that either leave it NULL.
+ */
+typedef struct cache_backend {
+    const char *name;
+    int (*get)(const char *key, unsigned long hash, time_t curtime, time_t *exptime);
+    int (*put)(const char *key, unsigned long hash, int status, time_t exptime, time_t curtime);
+    unsigned long (*expire)(time_t curtime);
+    unsigned long (*buckets)(void);
+    void (*walk)(unsigned long first, unsigned long count, time_t curtime, cache_walker walker, void *arg);
+    unsigned long (*chains)(unsigned long first, unsigned long count, time_t curtime, unsigned long *hist);
+    unsigned long (*flush)(unsigned long first, unsigned long count, time_t curtime, cache_matcher match, void *arg);
+    int (*clear)(time_t curtime);
+    void (*destroy)(void);
+} cache_backend;
+
+#endif /* CACHE_BACKEND_H */
@@ -0,0 +1,604 @@
+/*  Copyright (C) 2005, 2006 by Eugene Kurmanin <me@kurmanin.info>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Private result table: a chained hash table plus a timer wheel.
+ *
+ * The table starts at the configured size and doubles when the
+ * average chain exceeds CACHE_LOAD_MAX. Resizing is incremental: the
+ * old bucket array stays in use while each operation moves a few of
+ * its buckets over, so no single lookup pays for the whole rehash.
+ *
+ * Keys are "address|domain": an item keeps the address inline and
+ * refers to the domain by its interned ID, so the few thousand
+ * domains that make up most traffic are stored once, and a probe
+ * compares an integer before touching any string.
+ *
+ * Every item is also linked into the wheel slot of its expiry second,
+ * so the sweeper frees expired items by visiting only the slots whose
+ * second has passed instead of scanning the hash table. An item due
+ * more than CACHE_WHEEL_SLOTS seconds ahead shares its slot with
+ * nearer ones and simply survives the sweeps of earlier laps.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "cache.h"
+#include "cache_local.h"
+#include "utils/intern.h"
+
+#define SAFE_FREE(x)		if (x) { free(x); x = NULL; }
+
+#define wheel_slot(t)		((unsigned long)(t) & (CACHE_WHEEL_SLOTS - 1))
+
+/* Longest key rebuilt for walks */
+#define CACHE_KEY_MAX		1024
+
+typedef struct cache_item {
+    unsigned long hash;
+    int status;
+    time_t exptime;
+    struct cache_item *next;
+    struct cache_item **pprev;
+    struct cache_item *wnext;
+    struct cache_item **wpprev;
+    intern_id domain;
+    unsigned short keysize;
+    char key[];
+} cache_item;
+
+typedef struct cache_table {
+    cache_item **buckets;
+    unsigned long mask;
+    /* Length of the mapping, 0 when the array came from calloc() */
+    size_t mapped;
+} cache_table;
+
+/* old is only set while a resize drains it, from rehash_pos upwards */
+static cache_table table = { NULL, 0, 0 };
+static cache_table old = { NULL, 0, 0 };
+static int hugepages = 0;
+static unsigned long rehash_pos = 0;
+static unsigned long items = 0;
+static cache_item **wheel = NULL;
+static time_t wheel_time = 0;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Items due in an already swept second go to the next slot swept */
+static void wheel_link(cache_item *it) {
+    cache_item **slot = &wheel[wheel_slot(it->exptime > wheel_time ? it->exptime : wheel_time + 1)];
+
+    if ((it->wnext = *slot))
+        it->wnext->wpprev = &it->wnext;
+    it->wpprev = slot;
+    *slot = it;
+}
+
+static void wheel_unlink(cache_item *it) {
+    if (it->wnext)
+        it->wnext->wpprev = it->wpprev;
+    *it->wpprev = it->wnext;
+}
+
+/**
+ * bucket_alloc - Allocate a zeroed array of size buckets
+ * @mapped: Set to the length of the mapping, or 0 for calloc()
+ *
+ * With hugepages enabled, an array of at least a hugepage is mapped
+ * from the reserved hugepage pool when there is one, else from
+ * ordinary pages aligned and advised for transparent hugepages, so
+ * probes spread over a large table do not each miss the TLB.
+ */
+static cache_item **bucket_alloc(unsigned long size, size_t *mapped) {
+    size_t len = size * sizeof(void *);
+    char *p, *aligned;
+
+    *mapped = 0;
+    if (!hugepages || len < CACHE_HUGEPAGE_SIZE)
+        return calloc(size, sizeof(void *));
+    len = (len + CACHE_HUGEPAGE_SIZE - 1) & ~(CACHE_HUGEPAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        *mapped = len;
+        return (cache_item **)p;
+    }
+#endif
+    /* Over-map by a hugepage and trim to an aligned range */
+    p = mmap(NULL, len + CACHE_HUGEPAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return calloc(size, sizeof(void *));
+    aligned = (char *)(((uintptr_t)p + CACHE_HUGEPAGE_SIZE - 1) & ~(uintptr_t)(CACHE_HUGEPAGE_SIZE - 1));
+    if (aligned > p)
+        munmap(p, aligned - p);
+    munmap(aligned + len, p + CACHE_HUGEPAGE_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+    *mapped = len;
+    return (cache_item **)aligned;
+}
+
+static void bucket_free(cache_table *t) {
+    if (t->mapped)
+        munmap(t->buckets, t->mapped);
+    else
+        free(t->buckets);
+    t->buckets = NULL;
+    t->mapped = 0;
+}
+
+
+/* The domain part of a key, and the length of what precedes it */
+static const char *key_domain(const char *key, size_t *len) {
+    const char *bar = strchr(key, '|');
+
+    *len = bar ? (size_t)(bar - key) : strlen(key);
+    return bar ? bar + 1 : NULL;
+}
+
+static int item_match(const cache_item *it, unsigned long hash, intern_id domain, const char *key, size_t len) {
+    return it->hash == hash && it->domain == domain && !strncmp(it->key, key, len) && !it->key[len];
+}
+
+/* Rebuild the full key of an item, returns 0 if it does not fit */
+static int item_key(const cache_item *it, char *buf, size_t size) {
+    int len;
+
+    if (it->domain)
+        len = snprintf(buf, size, "%s|%s", it->key, intern_str(it->domain));
+    else
+        len = snprintf(buf, size, "%s", it->key);
+    return len > 0 && (size_t)len < size;
+}
+
+static void item_free(cache_item *it) {
+    intern_release(it->domain);
+    free(it);
+}
+
+static void chain_link(cache_item **bucket, cache_item *it) {
+    if ((it->next = *bucket))
+        it->next->pprev = &it->next;
+    it->pprev = bucket;
+    *bucket = it;
+}
+
+static void chain_unlink(cache_item *it) {
+    if (it->next)
+        it->next->pprev = it->pprev;
+    *it->pprev = it->next;
+}
+
+
+/**
+ * bucket_of - Chain holding a key, in whichever array it lives now
+ *
+ * Caller must hold cache_mutex.
+ */
+static cache_item **bucket_of(unsigned long hash) {
+    if (old.buckets && (hash & old.mask) >= rehash_pos)
+        return &old.buckets[hash & old.mask];
+    return &table.buckets[hash & table.mask];
+}
+
+
+/**
+ * bucket_at - Bucket by position across both arrays, for walks
+ *
+ * Positions past the current array address the one being drained.
+ * Caller must hold cache_mutex.
+ */
+static cache_item *bucket_at(unsigned long pos) {
+    if (pos <= table.mask)
+        return table.buckets[pos];
+    pos -= table.mask + 1;
+    if (old.buckets && pos <= old.mask)
+        return old.buckets[pos];
+    return NULL;
+}
+
+
+/**
+ * rehash_step - Move up to count buckets of a resize in progress
+ *
+ * Caller must hold cache_mutex.
+ */
+static void rehash_step(unsigned long count) {
+    cache_item *it, *it_next;
+
+    while (old.buckets && count--) {
+        for (it = old.buckets[rehash_pos]; it; it = it_next) {
+            it_next = it->next;
+            chain_link(&table.buckets[it->hash & table.mask], it);
+        }
+        old.buckets[rehash_pos] = NULL;
+        if (++rehash_pos > old.mask) {
+            bucket_free(&old);
+            old.mask = 0;
+            rehash_pos = 0;
+        }
+    }
+}
+
+static int need_grow(void) {
+    return !old.buckets && table.mask < CACHE_LOCAL_MAX_BUCKETS - 1 &&
+        items > (table.mask + 1) * CACHE_LOAD_MAX;
+}
+
+
+/**
+ * cache_local_grow - Start doubling the table
+ *
+ * The new array is allocated without the lock held; the items move
+ * over later, a few buckets per operation.
+ */
+static void cache_local_grow(void) {
+    cache_item **buckets;
+    unsigned long size;
+    size_t mapped;
+
+    pthread_mutex_lock(&cache_mutex);
+    size = (table.mask + 1) << 1;
+    if (!need_grow()) {
+        pthread_mutex_unlock(&cache_mutex);
+        return;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (!(buckets = bucket_alloc(size, &mapped)))
+        return;
+
+    pthread_mutex_lock(&cache_mutex);
+    if (!need_grow() || table.mask + 1 != size >> 1) {
+        cache_table unused = { buckets, size - 1, mapped };
+
+        pthread_mutex_unlock(&cache_mutex);
+        bucket_free(&unused);
+        return;
+    }
+    old = table;
+    table.buckets = buckets;
+    table.mask = size - 1;
+    table.mapped = mapped;
+    rehash_pos = 0;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+
+/**
+ * cache_local_init - Allocate the hash table and the expiry wheel
+ * @buckets: Initial number of buckets, rounded up to a power of two
+ *
+ * Returns: 1 on success, 0 on failure
+ */
+int cache_local_init(unsigned long buckets) {
+    unsigned long size = CACHE_LOCAL_MIN_BUCKETS;
+
+    while (size < buckets && size < CACHE_LOCAL_MAX_BUCKETS)
+        size <<= 1;
+    if (!(table.buckets = bucket_alloc(size, &table.mapped)))
+        return 0;
+    if (!(wheel = calloc(CACHE_WHEEL_SLOTS, sizeof(void *)))) {
+        bucket_free(&table);
+        return 0;
+    }
+    table.mask = size - 1;
+    old.buckets = NULL;
+    old.mask = 0;
+    old.mapped = 0;
+    rehash_pos = 0;
+    items = 0;
+    wheel_time = time(NULL);
+    return 1;
+}
+
+
+/**
+ * cache_local_hugepages - Back large bucket arrays with hugepages
+ *
+ * Applies to arrays allocated afterwards, call before cache_local_init().
+ */
+void cache_local_hugepages(int enable) {
+    hugepages = enable;
+}
+
+
+static void free_chains(cache_table *t) {
+    unsigned long i;
+    cache_item *it, *it_next;
+
+    if (!t->buckets)
+        return;
+    for (i = 0; i <= t->mask; i++) {
+        for (it = t->buckets[i]; it; it = it_next) {
+            it_next = it->next;
+            item_free(it);
+        }
+    }
+    bucket_free(t);
+    t->mask = 0;
+}
+
+
+/**
+ * cache_local_destroy - Free every cached item and the tables
+ */
+static void cache_local_destroy(void) {
+    free_chains(&table);
+    free_chains(&old);
+    SAFE_FREE(wheel);
+    items = 0;
+}
+
+
+static int cache_local_get(const char *key, unsigned long hash, time_t curtime, time_t *exptime) {
+    const char *name;
+    cache_item *it;
+    intern_id domain = 0;
+    size_t len;
+    int status = CACHE_MISS;
+
+    name = key_domain(key, &len);
+    pthread_mutex_lock(&cache_mutex);
+    rehash_step(CACHE_REHASH_STEP);
+    /* Looked up under the lock, so no item can release the ID meanwhile */
+    if (name && !(domain = intern_find(name))) {
+        pthread_mutex_unlock(&cache_mutex);
+        return CACHE_MISS;
+    }
+    for (it = *bucket_of(hash); it; it = it->next) {
+        if (it->exptime > curtime && item_match(it, hash, domain, key, len)) {
+            status = it->status;
+            if (exptime)
+                *exptime = it->exptime;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return status;
+}
+
+
+/**
+ * cache_local_put - Store a result with an absolute expiry time
+ *
+ * A live entry for the key is kept. Otherwise an expired item of the
+ * bucket is reused when possible.
+ */
+static int cache_local_put(const char *key, unsigned long hash, int status, time_t exptime, time_t curtime) {
+    cache_item **bucket, *it;
+    const char *name;
+    intern_id domain = 0;
+    size_t len;
+    int ret = CACHE_PUT_NONE, grow = 0;
+
+    name = key_domain(key, &len);
+    if (len >= USHRT_MAX || (name && !(domain = intern_get(name))))
+        return CACHE_PUT_NONE;
+
+    pthread_mutex_lock(&cache_mutex);
+    rehash_step(CACHE_REHASH_STEP);
+    bucket = bucket_of(hash);
+    for (it = *bucket; it; it = it->next) {
+        if (it->exptime > curtime && item_match(it, hash, domain, key, len)) {
+            /* Kept, unless it was evaluated under another policy */
+            if (CACHE_RESULT_POLICY(it->status) != CACHE_RESULT_POLICY(status)) {
+                it->status = status;
+                it->exptime = exptime;
+                wheel_unlink(it);
+                wheel_link(it);
+                ret = CACHE_PUT_OVERWRITE;
+            }
+            goto done;
+        }
+    }
+    for (it = *bucket; it; it = it->next) {
+        if (it->exptime < curtime && len < it->keysize) {
+            intern_release(it->domain);
+            it->domain = domain;
+            domain = 0;
+            memcpy(it->key, key, len);
+            it->key[len] = '\0';
+            it->hash = hash;
+            it->status = status;
+            it->exptime = exptime;
+            wheel_unlink(it);
+            wheel_link(it);
+            ret = CACHE_PUT_OVERWRITE;
+            goto done;
+        }
+    }
+    if ((it = (cache_item *)calloc(1, sizeof(cache_item) + len + 1))) {
+        it->domain = domain;
+        domain = 0;
+        it->keysize = len + 1;
+        memcpy(it->key, key, len);
+        it->hash = hash;
+        it->status = status;
+        it->exptime = exptime;
+        chain_link(bucket, it);
+        wheel_link(it);
+        items++;
+        grow = need_grow();
+        ret = CACHE_PUT_INSERT;
+    }
+done:
+    pthread_mutex_unlock(&cache_mutex);
+    /* Not handed to an item */
+    intern_release(domain);
+    if (grow)
+        cache_local_grow();
+    return ret;
+}
+
+
+/**
+ * cache_local_expire - Free the items whose expiry second has passed
+ *
+ * Visits the wheel slots of the seconds elapsed since the last call,
+ * taking the lock for at most CACHE_SWEEP_BATCH items at a time, and
+ * moves a batch of buckets of any resize in progress.
+ * wheel_time only changes under the lock, puts read it to pick a slot.
+ *
+ * Returns: number of items freed
+ */
+static unsigned long cache_local_expire(time_t curtime) {
+    unsigned long freed = 0, steps;
+    time_t t;
+
+    for (t = wheel_time + 1, steps = 0; t <= curtime && steps < CACHE_WHEEL_SLOTS; t++, steps++) {
+        cache_item **slot = &wheel[wheel_slot(t)];
+        int more;
+
+        do {
+            cache_item *it, *it_next;
+            int batch = 0;
+
+            more = 0;
+            pthread_mutex_lock(&cache_mutex);
+            for (it = *slot; it; it = it_next) {
+                it_next = it->wnext;
+                if (it->exptime > curtime)
+                    continue;
+                if (batch == CACHE_SWEEP_BATCH) {
+                    more = 1;
+                    break;
+                }
+                wheel_unlink(it);
+                chain_unlink(it);
+                item_free(it);
+                batch++;
+            }
+            items -= batch;
+            if (!more)
+                wheel_time = t;
+            pthread_mutex_unlock(&cache_mutex);
+            freed += batch;
+        } while (more);
+    }
+    pthread_mutex_lock(&cache_mutex);
+    if (curtime > wheel_time)
+        wheel_time = curtime;
+    rehash_step(CACHE_SWEEP_BATCH);
+    pthread_mutex_unlock(&cache_mutex);
+    return freed;
+}
+
+
+/**
+ * cache_local_buckets - Number of bucket positions a walk covers
+ *
+ * During a resize this spans both arrays, so walks made while the
+ * table changes size may visit an item twice or miss one.
+ */
+static unsigned long cache_local_buckets(void) {
+    unsigned long size;
+
+    pthread_mutex_lock(&cache_mutex);
+    size = table.mask + 1 + (old.buckets ? old.mask + 1 : 0);
+    pthread_mutex_unlock(&cache_mutex);
+    return size;
+}
+
+
+/**
+ * cache_local_walk - Visit the live entries of a range of buckets
+ *
+ * The table lock is held for the whole range, callers keep it short.
+ */
+static void cache_local_walk(unsigned long first, unsigned long count, time_t curtime, cache_walker walker, void *arg) {
+    char key[CACHE_KEY_MAX];
+    unsigned long pos;
+    cache_item *it;
+
+    pthread_mutex_lock(&cache_mutex);
+    for (pos = first; pos < first + count; pos++)
+        for (it = bucket_at(pos); it; it = it->next)
+            if (it->exptime > curtime && item_key(it, key, sizeof(key)))
+                walker(key, it->status, it->exptime, arg);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+
+/**
+ * cache_local_flush - Free the matching entries of a range of buckets
+ *
+ * Expired entries are left to the sweeper.
+ */
+static unsigned long cache_local_flush(unsigned long first, unsigned long count, time_t curtime, cache_matcher match, void *arg) {
+    char key[CACHE_KEY_MAX];
+    unsigned long pos, n = 0, size;
+    cache_item *it, *it_next;
+
+    pthread_mutex_lock(&cache_mutex);
+    size = table.mask + 1 + (old.buckets ? old.mask + 1 : 0);
+    for (pos = first; pos < first + count && pos < size; pos++) {
+        for (it = bucket_at(pos); it; it = it_next) {
+            it_next = it->next;
+            if (it->exptime <= curtime || (match && (!item_key(it, key, sizeof(key)) || !match(key, arg))))
+                continue;
+            wheel_unlink(it);
+            chain_unlink(it);
+            item_free(it);
+            items--;
+            n++;
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return n;
+}
+
+
+static unsigned long cache_local_chains(unsigned long first, unsigned long count, time_t curtime, unsigned long *hist) {
+    unsigned long pos, n, total = 0, size;
+    cache_item *it;
+
+    pthread_mutex_lock(&cache_mutex);
+    size = table.mask + 1 + (old.buckets ? old.mask + 1 : 0);
+    for (pos = first; pos < first + count && pos < size; pos++) {
+        for (n = 0, it = bucket_at(pos); it; it = it->next)
+            if (it->exptime > curtime)
+                n++;
+        hist[n < CACHE_CHAIN_HIST ? n : CACHE_CHAIN_HIST - 1]++;
+        total += n;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return total;
+}
+
+
+const cache_backend cache_local_backend = {
+    "local",
+    cache_local_get,
+    cache_local_put,
+    cache_local_expire,
+    cache_local_buckets,
+    cache_local_walk,
+    cache_local_chains,
+    cache_local_flush,
+    NULL,
+    cache_local_destroy
+};
@@ -0,0 +1,44 @@
+/*  Copyright (C) 2005, 2006 by Eugene Kurmanin <me@kurmanin.info>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef CACHE_LOCAL_H
+#define CACHE_LOCAL_H
+
+#include "cache_backend.h"
+
+/* Expiry wheel of one-second slots, must be a power of two */
+#define CACHE_WHEEL_SLOTS	4096
+/* Items freed per lock hold by the sweeper */
+#define CACHE_SWEEP_BATCH	256
+
+/* Table size bounds, in buckets */
+#define CACHE_LOCAL_MIN_BUCKETS	64
+#define CACHE_LOCAL_MAX_BUCKETS	(1UL << 26)
+/* Average chain length that starts doubling the table */
+#define CACHE_LOAD_MAX		2
+/* Buckets of a resize moved by each lookup or store */
+#define CACHE_REHASH_STEP	4
+/* Bucket arrays at least this large may use hugepages */
+#define CACHE_HUGEPAGE_SIZE	(2UL << 20)
+
+/* Private, in-process chained hash table */
+extern const cache_backend cache_local_backend;
+
+int cache_local_init(unsigned long buckets);
+void cache_local_hugepages(int enable);
+
+#endif /* CACHE_LOCAL_H */
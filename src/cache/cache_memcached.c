@@ -0,0 +1,441 @@
+/*  Copyright (C) 2005, 2006 by Eugene Kurmanin <me@kurmanin.info>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Result cache backend speaking the memcached text protocol.
+ *
+ * Keys are spread over the configured servers by hash. Every server
+ * has a small pool of persistent connections; a lookup borrows one,
+ * so concurrent milter threads never share a socket. Stores are sent
+ * with "noreply" and are never waited for: they are pipelined ahead
+ * of the next request on the same connection, which is only read
+ * after its own "get". A server that fails is skipped for
+ * MEMCACHED_RETRY seconds and lookups meanwhile count as misses, so
+ * a dead memcached never delays mail by more than one timeout.
+ *
+ * Values carry the full key, so keys too long or unsafe for memcached
+ * can be replaced by their hash without risking a wrong result.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "cache_memcached.h"
+
+#define SAFE_FREE(x)		if (x) { free(x); x = NULL; }
+
+#define MEMCACHED_KEYLEN	250
+#define MEMCACHED_LINE		1024
+/* memcached reads larger expiry values as absolute unix times */
+#define MEMCACHED_MAX_TTL	(30 * 86400)
+
+typedef struct mc_conn {
+    int fd;
+    int busy;
+} mc_conn;
+
+typedef struct mc_server {
+    char host[256];
+    char port[8];
+    time_t down_until;
+    mc_conn *conns;
+    pthread_mutex_t mutex;
+} mc_server;
+
+static mc_server *servers = NULL;
+static int nservers = 0;
+static unsigned int pool = 0;
+static int timeout = 0;
+
+
+/**
+ * mc_connect - Open a TCP connection bounded by the I/O timeout
+ *
+ * Returns: socket descriptor, or -1 on failure
+ */
+static int mc_connect(const mc_server *server) {
+    struct addrinfo hints, *res, *ai;
+    struct timeval tv;
+    int fd = -1, one = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(server->host, server->port, &hints, &res))
+        return -1;
+    for (ai = res; ai; ai = ai->ai_next) {
+        struct pollfd pfd;
+        int flags, err = 0;
+        socklen_t len = sizeof(err);
+
+        if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+            continue;
+        flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) && errno != EINPROGRESS)
+            goto next;
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, timeout) != 1 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) || err)
+            goto next;
+        fcntl(fd, F_SETFL, flags);
+        break;
+next:
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0)
+        return -1;
+
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+
+/**
+ * mc_acquire - Borrow a pooled connection to a server
+ *
+ * Returns: pool index, or -1 if the server is down or every
+ *          connection is busy
+ */
+static int mc_acquire(mc_server *server, time_t curtime) {
+    unsigned int i;
+    int fd;
+
+    pthread_mutex_lock(&server->mutex);
+    if (server->down_until > curtime) {
+        pthread_mutex_unlock(&server->mutex);
+        return -1;
+    }
+    for (i = 0; i < pool; i++)
+        if (!server->conns[i].busy)
+            break;
+    if (i == pool) {
+        pthread_mutex_unlock(&server->mutex);
+        return -1;
+    }
+    server->conns[i].busy = 1;
+    pthread_mutex_unlock(&server->mutex);
+
+    if (server->conns[i].fd < 0) {
+        if ((fd = mc_connect(server)) < 0) {
+            pthread_mutex_lock(&server->mutex);
+            server->conns[i].busy = 0;
+            server->down_until = curtime + MEMCACHED_RETRY;
+            pthread_mutex_unlock(&server->mutex);
+            return -1;
+        }
+        server->conns[i].fd = fd;
+    }
+    return (int)i;
+}
+
+
+/**
+ * mc_release - Return a connection, dropping it after an error
+ */
+static void mc_release(mc_server *server, int idx, int ok, time_t curtime) {
+    pthread_mutex_lock(&server->mutex);
+    if (!ok) {
+        close(server->conns[idx].fd);
+        server->conns[idx].fd = -1;
+        server->down_until = curtime + MEMCACHED_RETRY;
+    }
+    server->conns[idx].busy = 0;
+    pthread_mutex_unlock(&server->mutex);
+}
+
+
+static int mc_send(int fd, const char *buf, size_t len) {
+    ssize_t n;
+
+    while (len) {
+        if ((n = send(fd, buf, len, MSG_NOSIGNAL)) <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return 0;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+
+/**
+ * mc_key - Build the memcached key for a cache key
+ *
+ * Keys memcached cannot carry (too long, spaces or control
+ * characters) are replaced by their hash.
+ */
+static void mc_key(char *dst, size_t size, const char *key, unsigned long hash) {
+    const unsigned char *p;
+
+    if (strlen(key) + sizeof(MEMCACHED_KEY_PREFIX) <= MEMCACHED_KEYLEN) {
+        for (p = (const unsigned char *)key; *p > 0x20 && *p < 0x7f; p++)
+            continue;
+        if (!*p) {
+            snprintf(dst, size, MEMCACHED_KEY_PREFIX "%s", key);
+            return;
+        }
+    }
+    snprintf(dst, size, MEMCACHED_KEY_PREFIX "#%016lx", hash);
+}
+
+
+/**
+ * cache_memcached_init - Parse the server list and set up the pools
+ * @list: Comma separated host:port list ([v6addr]:port for IPv6)
+ * @pool_size: Connections per server
+ * @timeout_ms: Connect and I/O timeout
+ *
+ * Connections are opened lazily by the first lookup.
+ *
+ * Returns: 1 on success, 0 on an empty or invalid list
+ */
+int cache_memcached_init(const char *list, unsigned int pool_size, unsigned long timeout_ms) {
+    char *copy, *tok, *save = NULL;
+    int i;
+
+    if (!list || !(copy = strdup(list)))
+        return 0;
+    if (!(servers = calloc(MEMCACHED_MAX_SERVERS, sizeof(mc_server)))) {
+        free(copy);
+        return 0;
+    }
+    pool = pool_size ? pool_size : 1;
+    timeout = timeout_ms ? (int)timeout_ms : 100;
+    nservers = 0;
+
+    for (tok = strtok_r(copy, ", \t", &save); tok && nservers < MEMCACHED_MAX_SERVERS;
+         tok = strtok_r(NULL, ", \t", &save)) {
+        mc_server *server = &servers[nservers];
+        char *port = NULL;
+
+        if (*tok == '[' && (port = strchr(tok, ']'))) {
+            *port++ = '\0';
+            tok++;
+            port = (*port == ':') ? port + 1 : NULL;
+        } else if ((port = strrchr(tok, ':'))) {
+            *port++ = '\0';
+        }
+        if (!*tok || strlen(tok) >= sizeof(server->host))
+            continue;
+        strcpy(server->host, tok);
+        snprintf(server->port, sizeof(server->port), "%s", port && *port ? port : "11211");
+        if (!(server->conns = calloc(pool, sizeof(mc_conn))))
+            break;
+        for (i = 0; i < (int)pool; i++)
+            server->conns[i].fd = -1;
+        pthread_mutex_init(&server->mutex, NULL);
+        nservers++;
+    }
+    free(copy);
+    if (!nservers) {
+        SAFE_FREE(servers);
+        return 0;
+    }
+    return 1;
+}
+
+
+static void cache_memcached_destroy(void) {
+    unsigned int j;
+    int i;
+
+    for (i = 0; i < nservers; i++) {
+        for (j = 0; j < pool; j++)
+            if (servers[i].conns[j].fd >= 0)
+                close(servers[i].conns[j].fd);
+        SAFE_FREE(servers[i].conns);
+        pthread_mutex_destroy(&servers[i].mutex);
+    }
+    SAFE_FREE(servers);
+    nservers = 0;
+}
+
+
+/**
+ * mc_read_reply - Read a reply up to its last line
+ * @end: Last line, "END\r\n" for a "get"
+ *
+ * The reply is taken apart line by line, skipping the data block of
+ * a VALUE line by its byte count, so nothing a value holds (it ends
+ * with the cache key, i.e. client input) can pass for a status line.
+ *
+ * Returns: reply length, or -1 on an error reply, a malformed reply
+ *          or a timeout
+ */
+static int mc_read_reply(int fd, char *buf, size_t size, const char *end) {
+    size_t len = 0, pos = 0, next, end_len = strlen(end);
+    unsigned long bytes;
+    char *eol;
+    ssize_t n;
+
+    buf[0] = '\0';
+    for (;;) {
+        while ((eol = strstr(buf + pos, "\r\n"))) {
+            next = eol + 2 - buf;
+            if (!strncmp(buf + pos, "ERROR\r\n", 7) || !strncmp(buf + pos, "CLIENT_ERROR ", 13) ||
+                !strncmp(buf + pos, "SERVER_ERROR ", 13))
+                return -1;
+            if (next - pos == end_len && !memcmp(buf + pos, end, end_len))
+                return (int)len;
+            if (strncmp(buf + pos, "VALUE ", 6) || sscanf(buf + pos, "VALUE %*s %*u %lu", &bytes) != 1 ||
+                bytes > size)
+                return -1;
+            /* The whole data block and its line end are not in yet */
+            if (len < next + bytes + 2)
+                break;
+            if (memcmp(buf + next + bytes, "\r\n", 2))
+                return -1;
+            pos = next + bytes + 2;
+        }
+        if (len == size - 1)
+            return -1;
+        if ((n = recv(fd, buf + len, size - 1 - len, 0)) <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        len += n;
+        buf[len] = '\0';
+    }
+}
+
+
+static int cache_memcached_get(const char *key, unsigned long hash, time_t curtime, time_t *exptime) {
+    mc_server *server = &servers[hash % nservers];
+    char mkey[MEMCACHED_KEYLEN + 1], buf[MEMCACHED_LINE];
+    char *data, *stored;
+    long value_exptime;
+    int idx, len, bytes, value_status, status = CACHE_MISS;
+
+    if ((idx = mc_acquire(server, curtime)) < 0)
+        return CACHE_MISS;
+    mc_key(mkey, sizeof(mkey), key, hash);
+    len = snprintf(buf, sizeof(buf), "get %s\r\n", mkey);
+    if (!mc_send(server->conns[idx].fd, buf, len) ||
+        mc_read_reply(server->conns[idx].fd, buf, sizeof(buf), "END\r\n") < 0) {
+        mc_release(server, idx, 0, curtime);
+        return CACHE_MISS;
+    }
+    mc_release(server, idx, 1, curtime);
+
+    /* VALUE <key> <flags> <bytes>\r\n<status> <exptime> <key>\r\nEND\r\n */
+    if (sscanf(buf, "VALUE %*s %*u %d", &bytes) != 1 || !(data = strstr(buf, "\r\n")))
+        return CACHE_MISS;
+    data += 2;
+    if (sscanf(data, "%d %ld", &value_status, &value_exptime) != 2)
+        return CACHE_MISS;
+    if (!(stored = strchr(data, ' ')) || !(stored = strchr(stored + 1, ' ')))
+        return CACHE_MISS;
+    stored++;
+    /* The stored key fills the rest of the data block */
+    len = strlen(key);
+    if (stored + len != data + bytes || strncmp(stored, key, len))
+        return CACHE_MISS;
+    if ((time_t)value_exptime > curtime) {
+        status = value_status;
+        if (exptime)
+            *exptime = (time_t)value_exptime;
+    }
+    return status;
+}
+
+
+static int cache_memcached_put(const char *key, unsigned long hash, int status, time_t exptime, time_t curtime) {
+    mc_server *server = &servers[hash % nservers];
+    char mkey[MEMCACHED_KEYLEN + 1], value[MEMCACHED_LINE], buf[2 * MEMCACHED_LINE];
+    long ttl = (long)(exptime - curtime);
+    int idx, vlen, len, ok;
+
+    if (ttl <= 0)
+        return CACHE_PUT_NONE;
+    if (ttl > MEMCACHED_MAX_TTL)
+        ttl = MEMCACHED_MAX_TTL;
+    vlen = snprintf(value, sizeof(value), "%d %ld %s", status, (long)exptime, key);
+    if (vlen >= (int)sizeof(value))
+        return CACHE_PUT_NONE;
+    if ((idx = mc_acquire(server, curtime)) < 0)
+        return CACHE_PUT_NONE;
+    mc_key(mkey, sizeof(mkey), key, hash);
+    len = snprintf(buf, sizeof(buf), "set %s 0 %ld %d noreply\r\n%s\r\n", mkey, ttl, vlen, value);
+    ok = mc_send(server->conns[idx].fd, buf, len);
+    mc_release(server, idx, ok, curtime);
+    return ok ? CACHE_PUT_INSERT : CACHE_PUT_NONE;
+}
+
+
+/**
+ * cache_memcached_clear - Send flush_all to every server
+ *
+ * flush_all empties the whole server, the keys of any other
+ * application sharing it included.
+ *
+ * Returns: 1 if every server confirmed, 0 otherwise
+ */
+static int cache_memcached_clear(time_t curtime) {
+    char buf[MEMCACHED_LINE];
+    int i, idx, ok, all = 1;
+
+    for (i = 0; i < nservers; i++) {
+        if ((idx = mc_acquire(&servers[i], curtime)) < 0) {
+            all = 0;
+            continue;
+        }
+        ok = mc_send(servers[i].conns[idx].fd, "flush_all\r\n", 11) &&
+             mc_read_reply(servers[i].conns[idx].fd, buf, sizeof(buf), "OK\r\n") >= 0;
+        mc_release(&servers[i], idx, ok, curtime);
+        if (!ok)
+            all = 0;
+    }
+    return all;
+}
+
+
+const cache_backend cache_memcached_backend = {
+    "memcached",
+    cache_memcached_get,
+    cache_memcached_put,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    cache_memcached_clear,
+    cache_memcached_destroy
+};
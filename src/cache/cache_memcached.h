@@ -0,0 +1,33 @@
+/*  Copyright (C) 2005, 2006 by Eugene Kurmanin <me@kurmanin.info>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef CACHE_MEMCACHED_H
+#define CACHE_MEMCACHED_H
+
+#include "cache_backend.h"
+
+#define MEMCACHED_MAX_SERVERS	16
+#define MEMCACHED_KEY_PREFIX	"smfspf:"
+/* Seconds a server is skipped after a connection or protocol error */
+#define MEMCACHED_RETRY		5
+
+/* Remote table shared by a fleet through memcached servers */
+extern const cache_backend cache_memcached_backend;
+
+int cache_memcached_init(const char *servers, unsigned int pool_size, unsigned long timeout_ms);
+
+#endif /* CACHE_MEMCACHED_H */
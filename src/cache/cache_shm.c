@@ -0,0 +1,400 @@
+/*  Copyright (C) 2005, 2006 by Eugene Kurmanin <me@kurmanin.info>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Result cache shared by every smf-spf instance of a host.
+ *
+ * The table is a fixed-size, set-associative array living in a POSIX
+ * shared-memory segment: a key hashes to one bucket of CACHE_SHM_WAYS
+ * slots and a full bucket evicts the entry closest to expiry. Buckets
+ * are guarded by a stripe of robust, process-shared mutexes so an
+ * instance dying while holding a lock does not wedge the others.
+ *
+ * The segment also holds the generation of the per-thread result
+ * slots, so a flush by any instance reaches the slots of all.
+ *
+ * The segment outlives the instances; remove /dev/shm/<name> to reset
+ * it, e.g. after changing CacheSharedSlots.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "cache_shm.h"
+
+#define CACHE_SHM_MAGIC		"SMFSPFS"
+#define CACHE_SHM_VERSION	2
+#define CACHE_SHM_MIN_BUCKETS	64
+/* How long an attaching instance waits for the creator, in 10ms steps */
+#define CACHE_SHM_ATTACH_TRIES	200
+
+typedef struct shm_slot {
+    uint64_t hash;
+    int64_t exptime;
+    int32_t status;
+    char key[CACHE_SHM_KEYLEN];
+} shm_slot;
+
+typedef struct shm_table {
+    char magic[8];
+    uint32_t version;
+    uint32_t ready;
+    uint64_t nbuckets;
+    /* Generation of every instance's thread slots */
+    uint64_t generation;
+    pthread_mutex_t locks[CACHE_SHM_LOCKS];
+    shm_slot slots[];
+} shm_table;
+
+static shm_table *table = NULL;
+static size_t table_size = 0;
+static int hugepages = 0;
+
+
+static size_t shm_table_size(unsigned long nbuckets) {
+    return sizeof(shm_table) + (size_t)nbuckets * CACHE_SHM_WAYS * sizeof(shm_slot);
+}
+
+static void shm_lock(unsigned long bucket) {
+    pthread_mutex_t *mutex = &table->locks[bucket & (CACHE_SHM_LOCKS - 1)];
+
+    /* The previous owner died, its slot writes are guarded by exptime */
+    if (pthread_mutex_lock(mutex) == EOWNERDEAD)
+        pthread_mutex_consistent(mutex);
+}
+
+static void shm_unlock(unsigned long bucket) {
+    pthread_mutex_unlock(&table->locks[bucket & (CACHE_SHM_LOCKS - 1)]);
+}
+
+
+/**
+ * shm_table_create - Initialize a freshly created segment
+ *
+ * Returns: 1 on success, 0 on failure
+ */
+static int shm_table_create(int fd, unsigned long nbuckets) {
+    pthread_mutexattr_t attr;
+    int i;
+
+    table_size = shm_table_size(nbuckets);
+    if (ftruncate(fd, table_size))
+        return 0;
+    table = mmap(NULL, table_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (table == MAP_FAILED) {
+        table = NULL;
+        return 0;
+    }
+    if (pthread_mutexattr_init(&attr))
+        return 0;
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    for (i = 0; i < CACHE_SHM_LOCKS; i++)
+        pthread_mutex_init(&table->locks[i], &attr);
+    pthread_mutexattr_destroy(&attr);
+    memcpy(table->magic, CACHE_SHM_MAGIC, sizeof(CACHE_SHM_MAGIC));
+    table->version = CACHE_SHM_VERSION;
+    table->nbuckets = nbuckets;
+    table->generation = 1;
+    __atomic_store_n(&table->ready, 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+/**
+ * shm_table_open - Map a segment created by another instance
+ *
+ * Waits for the creator to finish sizing and initializing it. The
+ * table geometry of the segment wins over the local configuration.
+ *
+ * Returns: 1 on success, 0 on failure
+ */
+static int shm_table_open(int fd) {
+    struct stat st;
+    int tries;
+
+    for (tries = 0; ; tries++) {
+        if (fstat(fd, &st))
+            return 0;
+        if ((size_t)st.st_size >= sizeof(shm_table))
+            break;
+        if (tries == CACHE_SHM_ATTACH_TRIES) {
+            errno = ETIMEDOUT;
+            return 0;
+        }
+        usleep(10000);
+    }
+    table_size = st.st_size;
+    table = mmap(NULL, table_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (table == MAP_FAILED) {
+        table = NULL;
+        return 0;
+    }
+    for (tries = 0; !__atomic_load_n(&table->ready, __ATOMIC_ACQUIRE); tries++) {
+        if (tries == CACHE_SHM_ATTACH_TRIES) {
+            errno = ETIMEDOUT;
+            return 0;
+        }
+        usleep(10000);
+    }
+    if (memcmp(table->magic, CACHE_SHM_MAGIC, sizeof(CACHE_SHM_MAGIC)) ||
+        table->version != CACHE_SHM_VERSION || !table->nbuckets ||
+        (table->nbuckets & (table->nbuckets - 1)) ||
+        shm_table_size(table->nbuckets) > table_size) {
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * cache_shm_detach - Unmap the shared table, leaving it to the others
+ */
+static void cache_shm_detach(void) {
+    if (table)
+        munmap(table, table_size);
+    table = NULL;
+    table_size = 0;
+}
+
+
+/**
+ * cache_shm_generation - Thread slot generation shared by the instances
+ *
+ * Returns: the counter in the attached segment, NULL when detached
+ */
+uint64_t *cache_shm_generation(void) {
+    return table ? &table->generation : NULL;
+}
+
+
+/**
+ * cache_shm_attach - Attach to the named shared result table
+ * @name: POSIX shared-memory object name, e.g. "/smf-spf"
+ * @slots: Table size used when this instance creates the segment
+ *
+ * Returns: 1 on success, 0 on failure (errno is set)
+ */
+int cache_shm_attach(const char *name, unsigned long slots) {
+    unsigned long nbuckets = CACHE_SHM_MIN_BUCKETS;
+    int fd, ok, saved_errno;
+
+    while (nbuckets * CACHE_SHM_WAYS < slots)
+        nbuckets <<= 1;
+
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0) {
+        if (!(ok = shm_table_create(fd, nbuckets))) {
+            saved_errno = errno;
+            shm_unlink(name);
+            errno = saved_errno;
+        }
+    } else if (errno == EEXIST && (fd = shm_open(name, O_RDWR, 0600)) >= 0) {
+        ok = shm_table_open(fd);
+    } else {
+        return 0;
+    }
+    saved_errno = errno;
+    close(fd);
+    if (!ok) {
+        cache_shm_detach();
+        errno = saved_errno;
+    }
+#ifdef MADV_HUGEPAGE
+    /* Honoured when the kernel allows hugepages for shmem */
+    if (ok && hugepages)
+        madvise(table, table_size, MADV_HUGEPAGE);
+#endif
+    return ok;
+}
+
+
+/**
+ * cache_shm_hugepages - Ask for transparent hugepages on attach
+ */
+void cache_shm_hugepages(int enable) {
+    hugepages = enable;
+}
+
+
+static unsigned long cache_shm_buckets(void) {
+    return table ? (unsigned long)table->nbuckets : 0;
+}
+
+
+/**
+ * cache_shm_get - Look up a key in the shared table
+ *
+ * Returns: cached status, or CACHE_MISS
+ */
+static int cache_shm_get(const char *key, unsigned long hash, time_t curtime, time_t *exptime) {
+    unsigned long bucket = hash & (table->nbuckets - 1);
+    shm_slot *slot = &table->slots[bucket * CACHE_SHM_WAYS];
+    int i, status = CACHE_MISS;
+
+    shm_lock(bucket);
+    for (i = 0; i < CACHE_SHM_WAYS; i++, slot++) {
+        if (slot->hash == hash && slot->exptime > curtime && !strcmp(key, slot->key)) {
+            status = slot->status;
+            if (exptime)
+                *exptime = slot->exptime;
+            break;
+        }
+    }
+    shm_unlock(bucket);
+    return status;
+}
+
+
+/**
+ * cache_shm_put - Store a result in the shared table
+ *
+ * A live entry for the key is kept, unless it was evaluated under
+ * another policy. Otherwise the result takes an expired slot of the
+ * bucket, or the one closest to expiry.
+ */
+static int cache_shm_put(const char *key, unsigned long hash, int status, time_t exptime, time_t curtime) {
+    unsigned long bucket = hash & (table->nbuckets - 1);
+    shm_slot *slot = &table->slots[bucket * CACHE_SHM_WAYS];
+    shm_slot *victim = NULL;
+    size_t len = strlen(key);
+    int i, ret;
+
+    if (len >= CACHE_SHM_KEYLEN)
+        return CACHE_PUT_NONE;
+
+    shm_lock(bucket);
+    for (i = 0; i < CACHE_SHM_WAYS; i++) {
+        if (slot[i].hash == hash && slot[i].exptime > curtime && !strcmp(key, slot[i].key)) {
+            ret = CACHE_PUT_NONE;
+            /* Only the status changes, the key stays valid throughout */
+            if (CACHE_RESULT_POLICY(slot[i].status) != CACHE_RESULT_POLICY(status)) {
+                slot[i].status = status;
+                __atomic_store_n(&slot[i].exptime, exptime, __ATOMIC_RELEASE);
+                ret = CACHE_PUT_OVERWRITE;
+            }
+            shm_unlock(bucket);
+            return ret;
+        }
+        if (!victim || slot[i].exptime < victim->exptime)
+            victim = &slot[i];
+    }
+    if (victim->exptime > curtime)
+        ret = CACHE_PUT_EVICT;
+    else
+        ret = victim->key[0] ? CACHE_PUT_OVERWRITE : CACHE_PUT_INSERT;
+    /*
+     * Invalidate first, a writer dying half way leaves an expired slot.
+     * The fences keep the compiler and the CPU from moving the key
+     * writes out from between the two exptime stores.
+     */
+    __atomic_store_n(&victim->exptime, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    victim->hash = hash;
+    victim->status = status;
+    memcpy(victim->key, key, len + 1);
+    __atomic_store_n(&victim->exptime, exptime, __ATOMIC_RELEASE);
+    shm_unlock(bucket);
+    return ret;
+}
+
+
+/**
+ * cache_shm_walk - Visit the live entries of a range of buckets
+ *
+ * Each bucket is locked only while its own slots are visited.
+ */
+static void cache_shm_walk(unsigned long first, unsigned long count, time_t curtime, cache_walker walker, void *arg) {
+    unsigned long bucket;
+    int i;
+
+    for (bucket = first; bucket < first + count && bucket < table->nbuckets; bucket++) {
+        shm_slot *slot = &table->slots[bucket * CACHE_SHM_WAYS];
+
+        shm_lock(bucket);
+        for (i = 0; i < CACHE_SHM_WAYS; i++, slot++)
+            if (slot->exptime > curtime && slot->key[0])
+                walker(slot->key, slot->status, slot->exptime, arg);
+        shm_unlock(bucket);
+    }
+}
+
+
+static unsigned long cache_shm_chains(unsigned long first, unsigned long count, time_t curtime, unsigned long *hist) {
+    unsigned long bucket, n, total = 0;
+    int i;
+
+    for (bucket = first; bucket < first + count && bucket < table->nbuckets; bucket++) {
+        shm_slot *slot = &table->slots[bucket * CACHE_SHM_WAYS];
+
+        shm_lock(bucket);
+        for (n = 0, i = 0; i < CACHE_SHM_WAYS; i++, slot++)
+            if (slot->exptime > curtime && slot->key[0])
+                n++;
+        shm_unlock(bucket);
+        hist[n < CACHE_CHAIN_HIST ? n : CACHE_CHAIN_HIST - 1]++;
+        total += n;
+    }
+    return total;
+}
+
+
+/**
+ * cache_shm_flush - Drop the matching entries of a range of buckets
+ *
+ * A dropped slot is marked expired, for every instance at once.
+ */
+static unsigned long cache_shm_flush(unsigned long first, unsigned long count, time_t curtime, cache_matcher match, void *arg) {
+    unsigned long bucket, n = 0;
+    int i;
+
+    for (bucket = first; bucket < first + count && bucket < table->nbuckets; bucket++) {
+        shm_slot *slot = &table->slots[bucket * CACHE_SHM_WAYS];
+
+        shm_lock(bucket);
+        for (i = 0; i < CACHE_SHM_WAYS; i++, slot++) {
+            if (slot->exptime > curtime && slot->key[0] && (!match || match(slot->key, arg))) {
+                slot->exptime = 0;
+                n++;
+            }
+        }
+        shm_unlock(bucket);
+    }
+    return n;
+}
+
+
+const cache_backend cache_shm_backend = {
+    "shared memory",
+    cache_shm_get,
+    cache_shm_put,
+    NULL,
+    cache_shm_buckets,
+    cache_shm_walk,
+    cache_shm_chains,
+    cache_shm_flush,
+    NULL,
+    cache_shm_detach
+};
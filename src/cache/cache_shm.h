@@ -0,0 +1,41 @@
+/*  Copyright (C) 2005, 2006 by Eugene Kurmanin <me@kurmanin.info>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef CACHE_SHM_H
+#define CACHE_SHM_H
+
+#include <stdint.h>
+
+#include "cache_backend.h"
+
+/* Longest key (including the terminating NUL) a shared slot can hold */
+#define CACHE_SHM_KEYLEN	256
+/* Slots per bucket, a lookup never probes more than this */
+#define CACHE_SHM_WAYS		8
+/* Process-shared locks, each one guards a stripe of buckets */
+#define CACHE_SHM_LOCKS		256
+
+/* Table in a POSIX shared-memory segment, shared between instances */
+extern const cache_backend cache_shm_backend;
+
+/* Attach to (creating if needed) the named shared-memory table */
+int cache_shm_attach(const char *name, unsigned long slots);
+/* Generation of the per-thread slots, kept in the segment */
+uint64_t *cache_shm_generation(void);
+void cache_shm_hugepages(int enable);
+
+#endif /* CACHE_SHM_H */
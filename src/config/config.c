@@ -15,20 +15,21 @@
  *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <arpa/inet.h>
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <syslog.h>
+#include <time.h>
 
 #include "config.h"
 #include "defaults.h"
-
-/* Forward declarations to avoid circular include with arpa/inet.h */
-extern unsigned long inet_addr(const char *cp);
-#define htonl(x) ((unsigned long)(x))
-#define ntohl(x) ((unsigned long)(x))
+#include "utils/wl_image.h"
 
 /* Global configuration instance */
 config_t conf;
@@ -52,11 +53,18 @@ static facilities_t syslog_facilities[] = {
     { "local7", LOG_LOCAL7 }
 };
 
+/* Mapped WhitelistDB, swapped under the write lock when replaced */
+static wl_image *whitelist_db = NULL;
+static pthread_rwlock_t whitelist_db_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t whitelist_db_refresh_lock = PTHREAD_MUTEX_INITIALIZER;
+static time_t whitelist_db_checked = 0;
+static struct stat whitelist_db_bad;
+
 /* Helper macros */
 #define SAFE_FREE(x) if (x) { free(x); x = NULL; }
 
 /* Forward declarations */
-static unsigned long config_ip_cidr(unsigned long ip, unsigned short int mask, unsigned long checkip);
+static int config_parse_net(char *str, unsigned char *addr, unsigned short int *mask);
 static char *config_trim_space(char *str);
 static void config_strtolower(char *str);
 
@@ -143,22 +151,44 @@ unsigned long config_translate_time(const char *str) {
 
 
 /**
- * config_ip_cidr - Check if IP is within CIDR range
- * @ip: Network IP address
- * @mask: CIDR mask (0-32)
- * @checkip: IP address to check
+ * config_class_ttl - Resolve a per-result TTL
+ * @ttl: One of conf.ttl_pass, conf.ttl_fail, ...
  *
- * Returns: 1 if checkip is in range, 0 otherwise
+ * Returns: the TTL in seconds, conf.spf_ttl if the option was not set
  */
-static unsigned long config_ip_cidr(unsigned long ip, unsigned short int mask, unsigned long checkip) {
-    unsigned long subnet, cidrip, ipaddr;
+unsigned long config_class_ttl(unsigned long ttl) {
+    return ttl == TTL_INHERIT ? conf.spf_ttl : ttl;
+}
 
-    subnet = ~0UL;
-    subnet = subnet << (32 - mask);
-    cidrip = htonl(ip) & subnet;
-    ipaddr = ntohl(checkip) & subnet;
 
-    return (cidrip == ipaddr) ? 1 : 0;
+/**
+ * config_parse_net - Parse "ip[/len]" into IPv6 form
+ * @str: Address, IPv4 or IPv6, modified in place
+ * @addr: Receives 16 bytes, IPv4 mapped into ::ffff:0:0/96
+ * @mask: Receives the prefix length counted on the IPv6 form
+ *
+ * Returns: 1 on success, 0 if str is not an address
+ */
+static int config_parse_net(char *str, unsigned char *addr, unsigned short int *mask) {
+    char *slash = strchr(str, '/');
+    int bits = -1;
+
+    if (slash) {
+        *slash++ = '\0';
+        if (!isdigit((unsigned char)*slash))
+            return 0;
+        bits = atoi(slash);
+    }
+    if (inet_pton(AF_INET6, str, addr) == 1) {
+        *mask = bits < 0 || bits > 128 ? 128 : bits;
+        return 1;
+    }
+    memset(addr, 0, 10);
+    addr[10] = addr[11] = 0xff;
+    if (inet_pton(AF_INET, str, addr + 12) != 1)
+        return 0;
+    *mask = bits < 0 || bits > 32 ? 128 : bits + 96;
+    return 1;
 }
 
 
@@ -175,6 +205,10 @@ void config_free(void) {
     SAFE_FREE(conf.sendmail_socket);
     SAFE_FREE(conf.fixed_ip);
     SAFE_FREE(conf.reject_reason);
+    SAFE_FREE(conf.cache_file);
+    SAFE_FREE(conf.cache_shm_name);
+    SAFE_FREE(conf.cache_memcached);
+    SAFE_FREE(conf.control_socket);
 
     if (conf.log_file != NULL) {
         fclose(conf.log_file);
@@ -191,6 +225,7 @@ void config_free(void) {
         }
         conf.ipnats = NULL;
     }
+    ip_nat_free(&conf.nat_table);
 
     /* Free CIDR list */
     if (conf.cidrs) {
@@ -202,6 +237,7 @@ void config_free(void) {
         }
         conf.cidrs = NULL;
     }
+    ip_index_free(&conf.ip_whitelist);
 
     /* Free PTR list */
     if (conf.ptrs) {
@@ -214,6 +250,8 @@ void config_free(void) {
         }
         conf.ptrs = NULL;
     }
+    name_trie_free(conf.ptr_trie);
+    conf.ptr_trie = NULL;
 
     /* Free From list */
     if (conf.froms) {
@@ -226,6 +264,8 @@ void config_free(void) {
         }
         conf.froms = NULL;
     }
+    ac_free(conf.from_ac);
+    conf.from_ac = NULL;
 
     /* Free To list */
     if (conf.tos) {
@@ -238,6 +278,26 @@ void config_free(void) {
         }
         conf.tos = NULL;
     }
+    ac_free(conf.to_ac);
+    conf.to_ac = NULL;
+
+    str_set_free(conf.from_addrs);
+    str_set_free(conf.from_domains);
+    str_set_free(conf.to_addrs);
+    str_set_free(conf.to_domains);
+    conf.from_addrs = conf.from_domains = NULL;
+    conf.to_addrs = conf.to_domains = NULL;
+    regex_set_free(conf.whitelist_re);
+    conf.whitelist_re = NULL;
+    str_set_free(conf.domain_policies);
+    conf.domain_policies = NULL;
+
+    SAFE_FREE(conf.whitelist_db);
+    pthread_rwlock_wrlock(&whitelist_db_lock);
+    wl_image_close(whitelist_db);
+    whitelist_db = NULL;
+    pthread_rwlock_unlock(&whitelist_db_lock);
+    whitelist_db_checked = 0;
 }
 
 
@@ -257,16 +317,31 @@ int config_init(void) {
     conf.sendmail_socket = strdup(OCONN_DEFAULT);
     conf.fixed_ip = NULL;
     conf.reject_reason = strdup(REJECT_REASON_DEFAULT);
+    conf.cache_file = NULL;
+    conf.cache_shm_name = NULL;
+    conf.cache_memcached = NULL;
+    conf.control_socket = NULL;
 
     /* Initialize lists */
     conf.ipnats = NULL;
+    memset(&conf.nat_table, 0, sizeof(conf.nat_table));
     conf.cidrs = NULL;
+    memset(&conf.ip_whitelist, 0, sizeof(conf.ip_whitelist));
     conf.ptrs = NULL;
+    conf.ptr_trie = NULL;
     conf.froms = NULL;
+    conf.from_ac = NULL;
     conf.tos = NULL;
+    conf.to_ac = NULL;
+    conf.from_addrs = conf.from_domains = NULL;
+    conf.to_addrs = conf.to_domains = NULL;
+    conf.whitelist_re = NULL;
+    conf.whitelist_db = NULL;
+    conf.domain_policies = NULL;
 
     /* Initialize boolean flags */
     conf.relaxed_localpart = RELAXED_LOCALPART_DEFAULT;
+    conf.ptr_labels = WHITELIST_PTR_LABELS_DEFAULT;
     conf.best_guess = BEST_GUESS_DEFAULT;
     conf.refuse_fail = REFUSE_FAIL_DEFAULT;
     conf.refuse_none = REFUSE_NONE_DEFAULT;
@@ -285,11 +360,325 @@ int config_init(void) {
     conf.log_file = NULL;
     conf.syslog_facility = SYSLOG_FACILITY_DEFAULT;
     conf.spf_ttl = SPF_TTL_DEFAULT;
+    conf.ttl_max = TTL_MAX_DEFAULT;
+    conf.ttl_pass = TTL_INHERIT;
+    conf.ttl_fail = TTL_INHERIT;
+    conf.ttl_softfail = TTL_INHERIT;
+    conf.ttl_neutral = TTL_INHERIT;
+    conf.ttl_none = TTL_INHERIT;
+    conf.cache_file_interval = CACHE_FILE_INTERVAL_DEFAULT;
+    conf.cache_stats_interval = CACHE_STATS_INTERVAL_DEFAULT;
+    conf.cache_shm_slots = CACHE_SHM_SLOTS_DEFAULT;
+    conf.cache_buckets = CACHE_BUCKETS_DEFAULT;
+    conf.cache_prefix4 = CACHE_PREFIX4_DEFAULT;
+    conf.cache_prefix6 = CACHE_PREFIX6_DEFAULT;
+    conf.cache_hugepages = CACHE_HUGEPAGES_DEFAULT;
+    conf.cache_memcached_pool = CACHE_MEMCACHED_POOL_DEFAULT;
+    conf.cache_memcached_timeout = CACHE_MEMCACHED_TIMEOUT_DEFAULT;
 
     return 0;
 }
 
 
+/* Directives that accept whitelist entries, inline or through <Key>File */
+static const char *whitelist_keys[] = {
+    "whitelistip", "whitelistptr", "whitelistfrom", "whitelistto",
+    "whitelistfromaddr", "whitelistfromdomain", "whitelisttoaddr", "whitelisttodomain",
+    "whitelistptrregex", "whitelistfromregex", "whitelisttoregex",
+    NULL
+};
+
+/* Tags of the subjects sharing conf.whitelist_re */
+#define WHITELIST_RE_PTR	1
+#define WHITELIST_RE_FROM	2
+#define WHITELIST_RE_TO		4
+
+/**
+ * config_whitelist_entry - Add one whitelist entry
+ * @key: Directive name
+ * @val: Entry, modified in place
+ * @listed: Also keep the entry on the conf list of its directive
+ *
+ * Every entry goes into the lookup index of its directive. Entries read
+ * from a whitelist file skip the plain lists, which nothing consults once
+ * the indexes are built, so a large file costs index memory only.
+ *
+ * Returns: 1 if key is a whitelist directive, 0 otherwise
+ */
+static int config_whitelist_entry(const char *key, char *val, int listed) {
+    /* whitelistip key: whitelist_ip[/mask], IPv4 or IPv6 */
+    if (!strcasecmp(key, "whitelistip")) {
+        char *slash = NULL;
+        int family = strchr(val, ':') ? AF_INET6 : AF_INET;
+        unsigned short int maxmask = family == AF_INET6 ? 128 : 32;
+        unsigned short int mask = maxmask;
+        unsigned long ip = 0;
+        unsigned char ip6[16];
+        int indexed;
+
+        if ((slash = strchr(val, '/'))) {
+            *slash++ = '\0';
+            /* A bad mask must not turn into /0, whitelisting everyone */
+            if (!*slash || slash[strspn(slash, "0123456789")]) {
+                syslog(LOG_ERR, "[CONFIG] Invalid whitelist mask: %s/%s", val, slash);
+                return 1;
+            }
+            mask = atoi(slash) > maxmask ? maxmask : atoi(slash);
+        }
+        if (!val[0])
+            return 1;
+
+        if (family == AF_INET6) {
+            if (inet_pton(AF_INET6, val, ip6) != 1) {
+                syslog(LOG_ERR, "[CONFIG] Invalid IPv6 whitelist entry: %s", val);
+                return 1;
+            }
+        } else if ((ip = inet_addr(val)) == 0xffffffff)
+            return 1;
+
+        if (listed) {
+            CIDR *it = (CIDR *)calloc(1, sizeof(CIDR));
+
+            if (it) {
+                it->family = family;
+                it->ip = ip;
+                if (family == AF_INET6)
+                    memcpy(it->ip6, ip6, sizeof(ip6));
+                it->mask = mask;
+                it->next = conf.cidrs;
+                conf.cidrs = it;
+            }
+        }
+        if (family == AF_INET6)
+            indexed = ip_index_add6(&conf.ip_whitelist, ip6, mask);
+        else
+            indexed = ip_index_add(&conf.ip_whitelist, ntohl(ip), mask);
+        if (!indexed)
+            syslog(LOG_ERR, "[CONFIG] Out of memory indexing CIDR %s/%u", val, mask);
+        return 1;
+    }
+
+    /* whitelistptr key */
+    if (!strcasecmp(key, "whitelistptr")) {
+        if (listed) {
+            STR *it = (STR *)calloc(1, sizeof(STR));
+
+            if (it && (it->str = strdup(val))) {
+                it->next = conf.ptrs;
+                conf.ptrs = it;
+            } else
+                free(it);
+        }
+
+        if (!conf.ptr_trie)
+            conf.ptr_trie = name_trie_new();
+        if (!conf.ptr_trie || !name_trie_add(conf.ptr_trie, val))
+            syslog(LOG_ERR, "[CONFIG] Out of memory indexing PTR entry %s", val);
+        return 1;
+    }
+
+    /* whitelistfrom and whitelistto keys */
+    if (!strcasecmp(key, "whitelistfrom") || !strcasecmp(key, "whitelistto")) {
+        int from = !strcasecmp(key, "whitelistfrom");
+        STR **list = from ? &conf.froms : &conf.tos;
+        ac_matcher **ac = from ? &conf.from_ac : &conf.to_ac;
+
+        config_strtolower(val);
+        if (listed) {
+            STR *it = (STR *)calloc(1, sizeof(STR));
+
+            if (it && (it->str = strdup(val))) {
+                it->next = *list;
+                *list = it;
+            } else
+                free(it);
+        }
+
+        if (!*ac)
+            *ac = ac_new();
+        if (!*ac || !ac_add(*ac, val))
+            syslog(LOG_ERR, "[CONFIG] Out of memory indexing %s entry %s",
+                   from ? "WhitelistFrom" : "WhitelistTo", val);
+        return 1;
+    }
+
+    /* Typed whitelists: whole addresses, or domains and their subdomains */
+    if (!strcasecmp(key, "whitelistfromaddr") || !strcasecmp(key, "whitelistfromdomain") ||
+        !strcasecmp(key, "whitelisttoaddr") || !strcasecmp(key, "whitelisttodomain")) {
+        int domain = !strcasecmp(key + strlen(key) - 6, "domain");
+        str_set **set = !strncasecmp(key, "whitelistfrom", 13) ?
+            (domain ? &conf.from_domains : &conf.from_addrs) :
+            (domain ? &conf.to_domains : &conf.to_addrs);
+        char *entry = val;
+
+        config_strtolower(val);
+        /* Tolerate "@example.com" and ".example.com" for a domain */
+        if (domain)
+            entry += strspn(entry, "@.");
+        if (!*entry) {
+            syslog(LOG_ERR, "[CONFIG] Empty %s entry", key);
+            return 1;
+        }
+        if (!*set)
+            *set = str_set_new();
+        if (!*set || !str_set_add(*set, entry))
+            syslog(LOG_ERR, "[CONFIG] Out of memory indexing %s entry %s", key, entry);
+        return 1;
+    }
+
+    /* Regular expressions, all compiled into one automaton */
+    if (!strcasecmp(key, "whitelistptrregex") || !strcasecmp(key, "whitelistfromregex") ||
+        !strcasecmp(key, "whitelisttoregex")) {
+        unsigned int tag = !strncasecmp(key, "whitelistptr", 12) ? WHITELIST_RE_PTR :
+                           !strncasecmp(key, "whitelistfrom", 13) ? WHITELIST_RE_FROM : WHITELIST_RE_TO;
+
+        if (!conf.whitelist_re)
+            conf.whitelist_re = regex_set_new();
+        if (!conf.whitelist_re || !regex_set_add(conf.whitelist_re, val, tag))
+            syslog(LOG_ERR, "[CONFIG] Invalid regular expression for %s: %s", key, val);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* DomainPolicy settings, in POLICY_* bit order */
+static const char *policy_keys[] = {
+    "refusefail", "softfail", "tagsubject", "addheader", "addreceivedheader", "quarantine",
+    NULL
+};
+
+/**
+ * config_policy_entry - Add one DomainPolicy entry
+ * @val: Domain followed by Setting=on|off pairs, modified in place
+ *
+ * The low byte of the stored value holds the settings, the high byte
+ * which of them the entry overrides; the others follow the global
+ * directives. A later entry for the same domain replaces the earlier.
+ *
+ * Returns: 1 if the entry was stored, 0 otherwise
+ */
+static int config_policy_entry(char *val) {
+    unsigned int mask = 0, value = 0;
+    char *domain, *setting, *save = NULL;
+    int i;
+
+    config_strtolower(val);
+    if (!(domain = strtok_r(val, " \t,", &save)))
+        return 0;
+    /* Tolerate "@example.com" and ".example.com" */
+    domain += strspn(domain, "@.");
+    while ((setting = strtok_r(NULL, " \t,", &save))) {
+        char *on = strchr(setting, '=');
+
+        if (on)
+            *on++ = '\0';
+        for (i = 0; policy_keys[i]; i++)
+            if (!strcmp(setting, policy_keys[i]))
+                break;
+        if (!policy_keys[i] || !on || (strcmp(on, "on") && strcmp(on, "off"))) {
+            syslog(LOG_ERR, "[CONFIG] Invalid DomainPolicy setting for %s: %s", domain, setting);
+            return 0;
+        }
+        mask |= 1u << i;
+        if (!strcmp(on, "on"))
+            value |= 1u << i;
+        else
+            value &= ~(1u << i);
+    }
+    if (!*domain || !mask) {
+        syslog(LOG_ERR, "[CONFIG] DomainPolicy entry without a domain or settings");
+        return 0;
+    }
+
+    if (!conf.domain_policies)
+        conf.domain_policies = str_set_new();
+    if (!conf.domain_policies || !str_set_put(conf.domain_policies, domain, mask << 8 | value)) {
+        syslog(LOG_ERR, "[CONFIG] Out of memory indexing DomainPolicy for %s", domain);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * config_entry_file - Load whitelist or DomainPolicy entries from a file
+ * @key: Directive the entries belong to, e.g. "WhitelistIP"
+ * @path: File with one entry per line
+ *
+ * The file is streamed a line at a time, so its size is only bounded by
+ * the memory of the indexes. Blank lines and '#' comments are skipped.
+ *
+ * Returns: number of entries read, -1 if the file cannot be used
+ */
+static long config_entry_file(const char *key, const char *path) {
+    struct timespec start, end;
+    char line[2 * MAXLINE];
+    long entries = 0;
+    int policy = !strcasecmp(key, "domainpolicy");
+    FILE *fp;
+    int i;
+
+    for (i = 0; whitelist_keys[i]; i++)
+        if (!strcasecmp(key, whitelist_keys[i]))
+            break;
+    if ((!policy && !whitelist_keys[i]) || !(fp = fopen(path, "r")))
+        return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (fgets(line, sizeof(line), fp)) {
+        char *p, *entry;
+
+        if (!strchr(line, '\n') && !feof(fp)) {
+            int c;
+
+            syslog(LOG_ERR, "[CONFIG] Overlong line in %s, skipping", path);
+            while ((c = getc(fp)) != EOF && c != '\n')
+                ;
+            continue;
+        }
+        if ((p = strchr(line, '#')))
+            *p = '\0';
+        entry = config_trim_space(line);
+        if (!*entry)
+            continue;
+        if (policy)
+            config_policy_entry(entry);
+        else
+            config_whitelist_entry(key, entry, 0);
+        entries++;
+    }
+    fclose(fp);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    syslog(LOG_INFO, "[CONFIG] Loaded %ld %s entries from %s in %.1f ms", entries, key, path,
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    return entries;
+}
+
+/* Bytes held by the compiled whitelist indexes */
+static size_t config_whitelist_memory(void) {
+    str_set *sets[] = { conf.from_addrs, conf.from_domains, conf.to_addrs, conf.to_domains };
+    ac_matcher *acs[] = { conf.from_ac, conf.to_ac };
+    size_t bytes, i;
+
+    bytes = conf.ip_whitelist.size * sizeof(ip_range) + conf.ip_whitelist.size6 * sizeof(ip_range6);
+    if (conf.ptr_trie)
+        bytes += sizeof(name_trie) + conf.ptr_trie->size * sizeof(name_trie_node);
+    for (i = 0; i < 2; i++)
+        if (acs[i])
+            bytes += sizeof(ac_matcher) + acs[i]->size * sizeof(ac_node) + acs[i]->table_size * sizeof(uint32_t) +
+                     (acs[i]->fail ? acs[i]->count * sizeof(uint32_t) : 0);
+    for (i = 0; i < 4; i++)
+        if (sets[i])
+            bytes += sizeof(str_set) + sets[i]->size * sizeof(str_set_slot) + sets[i]->pool_size;
+    if (conf.whitelist_re)
+        bytes += sizeof(regex_set) + conf.whitelist_re->size * sizeof(re_state) +
+                 conf.whitelist_re->set_size * sizeof(*conf.whitelist_re->sets) +
+                 conf.whitelist_re->dfa_count * (conf.whitelist_re->classes * sizeof(uint32_t) + 2);
+    return bytes;
+}
+
+
 /**
  * config_load - Load configuration from file
  * @filepath: Path to configuration file
@@ -302,7 +691,7 @@ int config_init(void) {
 int config_load(const char *filepath) {
     FILE *fp;
     char buf[2 * MAXLINE];
-    int cidr_count = 0;
+    int files = 0;
 
     if (!filepath)
         filepath = CONFIG_FILE_DEFAULT;
@@ -331,146 +720,80 @@ int config_load(const char *filepath) {
 
         strcpy(val, config_trim_space(value));
 
-        /* whitelistip key: whitelist_ip[/mask] */
-        if (!strcasecmp(key, "whitelistip")) {
-            char *slash = NULL;
-            unsigned short int mask = 32;
-
-            if ((slash = strchr(val, '/'))) {
-                *slash = '\0';
-                mask = atoi(++slash);
-                if (mask > 32)
-                    mask = 32;
-            }
-
-            if (val[0]) {
-                CIDR *it = NULL;
-                unsigned long ip;
-
-                if ((ip = inet_addr(val)) == 0xffffffff)
-                    continue;
-
-                /* Check resource limits */
-                if (cidr_count++ > MAX_WHITELIST_ENTRIES) {
-                    syslog(LOG_ERR, "[CONFIG] Too many CIDR entries (>%d), skipping",
-                           MAX_WHITELIST_ENTRIES);
-                    continue;
-                }
+        if (config_whitelist_entry(key, val, 1))
+            continue;
 
-                if (!conf.cidrs)
-                    conf.cidrs = (CIDR *)calloc(1, sizeof(CIDR));
-                else if ((it = (CIDR *)calloc(1, sizeof(CIDR)))) {
-                    it->next = conf.cidrs;
-                    conf.cidrs = it;
-                }
+        if (!strcasecmp(key, "domainpolicy")) {
+            config_policy_entry(val);
+            continue;
+        }
 
-                if (conf.cidrs) {
-                    conf.cidrs->ip = ip;
-                    conf.cidrs->mask = mask;
-                }
-            }
+        /* whitelist*file and domainpolicyfile keys: one entry of the base directive per line */
+        if (((!strncasecmp(key, "whitelist", 9) && strlen(key) > 13) || !strcasecmp(key, "domainpolicyfile")) &&
+            !strcasecmp(key + strlen(key) - 4, "file")) {
+            key[strlen(key) - 4] = '\0';
+            if (config_entry_file(key, val) < 0)
+                syslog(LOG_ERR, "[CONFIG] Cannot load %sFile %s", key, val);
+            else
+                files++;
             continue;
         }
 
-        /* clientipnat key: src_ip:dest_ip */
+        /* clientipnat key: src_ip[/len]:dest_ip[/len], IPv6 ones separated by blanks */
         if (!strcasecmp(key, "clientipnat")) {
+            unsigned char s_ip[16], d_ip[16];
+            unsigned short int s_mask, d_mask;
+            IPNAT *it = NULL;
             char *sep = NULL;
-            unsigned long d_ip;
+            int d_prefix;
 
-            if ((sep = strchr(val, ':'))) {
+            if ((sep = strpbrk(val, " \t"))) {
+                *sep++ = '\0';
+                sep += strspn(sep, " \t");
+            } else if ((sep = strchr(val, ':')) && !strchr(sep + 1, ':')) {
                 *sep++ = '\0';
-                if (*sep) {
-                    if ((d_ip = inet_addr(sep)) == 0xffffffff) {
-                        syslog(LOG_ERR, "[CONFIG] Invalid NAT destination IP: %s", sep);
-                        continue;
-                    }
-                } else {
-                    syslog(LOG_ERR, "[CONFIG] Invalid destination IP format: %s", sep);
-                    continue;
-                }
             } else {
                 syslog(LOG_ERR, "[CONFIG] Invalid NAT entry format: %s (must be src_ip:dest_ip)", val);
                 continue;
             }
 
-            if (val[0]) {
-                IPNAT *it = NULL;
-                unsigned long s_ip;
-
-                if ((s_ip = inet_addr(val)) == 0xffffffff) {
-                    syslog(LOG_ERR, "[CONFIG] Invalid NAT source IP: %s", val);
-                    continue;
-                }
-
-                if (!conf.ipnats)
-                    conf.ipnats = (IPNAT *)calloc(1, sizeof(IPNAT));
-                else if ((it = (IPNAT *)calloc(1, sizeof(IPNAT)))) {
-                    it->next = conf.ipnats;
-                    conf.ipnats = it;
-                }
-
-                if (conf.ipnats) {
-                    conf.ipnats->srcip = s_ip;
-                    conf.ipnats->destip = d_ip;
-                }
-            } else {
-                syslog(LOG_ERR, "[CONFIG] Invalid source IP format: %s", val);
+            if (!*sep) {
+                syslog(LOG_ERR, "[CONFIG] Invalid destination IP format: %s", sep);
+                continue;
             }
-            continue;
-        }
-
-        /* whitelistptr key */
-        if (!strcasecmp(key, "whitelistptr")) {
-            STR *it = NULL;
-
-            if (!conf.ptrs)
-                conf.ptrs = (STR *)calloc(1, sizeof(STR));
-            else if ((it = (STR *)calloc(1, sizeof(STR)))) {
-                it->next = conf.ptrs;
-                conf.ptrs = it;
+            d_prefix = strchr(sep, '/') != NULL;
+            if (!config_parse_net(sep, d_ip, &d_mask)) {
+                syslog(LOG_ERR, "[CONFIG] Invalid NAT destination IP: %s", sep);
+                continue;
             }
-
-            if (conf.ptrs && !conf.ptrs->str)
-                conf.ptrs->str = strdup(val);
-
-            continue;
-        }
-
-        /* whitelistfrom key */
-        if (!strcasecmp(key, "whitelistfrom")) {
-            STR *it = NULL;
-
-            if (!conf.froms)
-                conf.froms = (STR *)calloc(1, sizeof(STR));
-            else if ((it = (STR *)calloc(1, sizeof(STR)))) {
-                it->next = conf.froms;
-                conf.froms = it;
+            if (!val[0]) {
+                syslog(LOG_ERR, "[CONFIG] Invalid source IP format: %s", val);
+                continue;
             }
-
-            if (conf.froms && !conf.froms->str) {
-                config_strtolower(val);
-                conf.froms->str = strdup(val);
+            if (!config_parse_net(val, s_ip, &s_mask)) {
+                syslog(LOG_ERR, "[CONFIG] Invalid NAT source IP: %s", val);
+                continue;
             }
-
-            continue;
-        }
-
-        /* whitelistto key */
-        if (!strcasecmp(key, "whitelistto")) {
-            STR *it = NULL;
-
-            if (!conf.tos)
-                conf.tos = (STR *)calloc(1, sizeof(STR));
-            else if ((it = (STR *)calloc(1, sizeof(STR)))) {
-                it->next = conf.tos;
-                conf.tos = it;
+            /* A pool maps onto a pool of the same size, or as a whole onto one address */
+            if (d_prefix && d_mask != s_mask) {
+                syslog(LOG_ERR, "[CONFIG] NAT prefixes differ in size: %s %s", val, sep);
+                continue;
             }
 
-            if (conf.tos && !conf.tos->str) {
-                config_strtolower(val);
-                conf.tos->str = strdup(val);
+            if (!conf.ipnats)
+                conf.ipnats = (IPNAT *)calloc(1, sizeof(IPNAT));
+            else if ((it = (IPNAT *)calloc(1, sizeof(IPNAT)))) {
+                it->next = conf.ipnats;
+                conf.ipnats = it;
             }
 
+            if (conf.ipnats) {
+                memcpy(conf.ipnats->srcip, s_ip, sizeof(s_ip));
+                memcpy(conf.ipnats->destip, d_ip, sizeof(d_ip));
+                conf.ipnats->mask = s_mask;
+            }
+            if (!(d_prefix ? ip_nat_add : ip_nat_add_host)(&conf.nat_table, s_ip, s_mask, d_ip))
+                syslog(LOG_ERR, "[CONFIG] Out of memory indexing NAT entry %s", val);
             continue;
         }
 
@@ -491,6 +814,10 @@ int config_load(const char *filepath) {
             conf.refuse_none_helo = 1;
             continue;
         }
+        if (!strcasecmp(key, "whitelistptrlabels") && !strcasecmp(val, "on")) {
+            conf.ptr_labels = 1;
+            continue;
+        }
         if (!strcasecmp(key, "relaxedlocalpart") && !strcasecmp(val, "on")) {
             conf.relaxed_localpart = 1;
             continue;
@@ -523,6 +850,10 @@ int config_load(const char *filepath) {
             conf.skip_auth = false;
             continue;
         }
+        if (!strcasecmp(key, "cachehugepages") && !strcasecmp(val, "on")) {
+            conf.cache_hugepages = 1;
+            continue;
+        }
         if (!strcasecmp(key, "quarantine") && !strcasecmp(val, "on")) {
             conf.quarantine = 1;
             continue;
@@ -557,6 +888,36 @@ int config_load(const char *filepath) {
             conf.run_as_user = strdup(val);
             continue;
         }
+        if (!strcasecmp(key, "cachefile")) {
+            SAFE_FREE(conf.cache_file);
+            conf.cache_file = strdup(val);
+            continue;
+        }
+        if (!strcasecmp(key, "cachesharedmemory")) {
+            SAFE_FREE(conf.cache_shm_name);
+            if (val[0] == '/') {
+                conf.cache_shm_name = strdup(val);
+            } else if ((conf.cache_shm_name = calloc(1, strlen(val) + 2))) {
+                conf.cache_shm_name[0] = '/';
+                strcpy(conf.cache_shm_name + 1, val);
+            }
+            continue;
+        }
+        if (!strcasecmp(key, "cachememcached")) {
+            SAFE_FREE(conf.cache_memcached);
+            conf.cache_memcached = strdup(val);
+            continue;
+        }
+        if (!strcasecmp(key, "whitelistdb")) {
+            SAFE_FREE(conf.whitelist_db);
+            conf.whitelist_db = strdup(val);
+            continue;
+        }
+        if (!strcasecmp(key, "controlsocket")) {
+            SAFE_FREE(conf.control_socket);
+            conf.control_socket = strdup(val);
+            continue;
+        }
         if (!strcasecmp(key, "socket")) {
             SAFE_FREE(conf.sendmail_socket);
             conf.sendmail_socket = strdup(val);
@@ -588,6 +949,89 @@ int config_load(const char *filepath) {
             continue;
         }
 
+        /* Per-result TTLs, zero disables caching of that result */
+        if (!strcasecmp(key, "ttlpass")) {
+            conf.ttl_pass = config_translate_time(val);
+            continue;
+        }
+        if (!strcasecmp(key, "ttlfail")) {
+            conf.ttl_fail = config_translate_time(val);
+            continue;
+        }
+        if (!strcasecmp(key, "ttlsoftfail")) {
+            conf.ttl_softfail = config_translate_time(val);
+            continue;
+        }
+        if (!strcasecmp(key, "ttlneutral")) {
+            conf.ttl_neutral = config_translate_time(val);
+            continue;
+        }
+        if (!strcasecmp(key, "ttlnone")) {
+            conf.ttl_none = config_translate_time(val);
+            continue;
+        }
+
+        /* Cap of adaptive TTLs, zero keeps the base TTLs */
+        if (!strcasecmp(key, "ttlmax")) {
+            conf.ttl_max = config_translate_time(val);
+            continue;
+        }
+
+        /* Cache snapshot interval, zero only saves at shutdown */
+        if (!strcasecmp(key, "cachefileinterval")) {
+            conf.cache_file_interval = config_translate_time(val);
+            continue;
+        }
+
+        /* Cache statistics log interval, zero disables it */
+        if (!strcasecmp(key, "cachestatsinterval")) {
+            conf.cache_stats_interval = config_translate_time(val);
+            continue;
+        }
+
+        if (!strcasecmp(key, "cachebuckets")) {
+            conf.cache_buckets = strtoul(val, NULL, 10);
+            if (!conf.cache_buckets)
+                conf.cache_buckets = CACHE_BUCKETS_DEFAULT;
+            continue;
+        }
+
+        /* Prefix-aggregated cache keys, zero or a full length disables */
+        if (!strcasecmp(key, "cacheipv4prefix")) {
+            conf.cache_prefix4 = strtoul(val, NULL, 10);
+            if (conf.cache_prefix4 >= 32)
+                conf.cache_prefix4 = 0;
+            continue;
+        }
+        if (!strcasecmp(key, "cacheipv6prefix")) {
+            conf.cache_prefix6 = strtoul(val, NULL, 10);
+            if (conf.cache_prefix6 >= 128)
+                conf.cache_prefix6 = 0;
+            continue;
+        }
+
+        if (!strcasecmp(key, "cachesharedslots")) {
+            conf.cache_shm_slots = strtoul(val, NULL, 10);
+            if (!conf.cache_shm_slots)
+                conf.cache_shm_slots = CACHE_SHM_SLOTS_DEFAULT;
+            continue;
+        }
+
+        if (!strcasecmp(key, "cachememcachedpool")) {
+            conf.cache_memcached_pool = strtoul(val, NULL, 10);
+            if (!conf.cache_memcached_pool)
+                conf.cache_memcached_pool = CACHE_MEMCACHED_POOL_DEFAULT;
+            continue;
+        }
+
+        /* Per request memcached timeout in milliseconds */
+        if (!strcasecmp(key, "cachememcachedtimeout")) {
+            conf.cache_memcached_timeout = strtoul(val, NULL, 10);
+            if (!conf.cache_memcached_timeout)
+                conf.cache_memcached_timeout = CACHE_MEMCACHED_TIMEOUT_DEFAULT;
+            continue;
+        }
+
         /* Syslog facility */
         if (!strcasecmp(key, "syslog")) {
             int i;
@@ -608,43 +1052,175 @@ int config_load(const char *filepath) {
     }
 
     fclose(fp);
+    ip_index_build(&conf.ip_whitelist);
+    /* Entries from whitelist files live only in the automaton, there is no plain list to fall back on */
+    if ((conf.from_ac && !ac_build(conf.from_ac)) || (conf.to_ac && !ac_build(conf.to_ac))) {
+        syslog(LOG_ERR, "[CONFIG] Out of memory compiling WhitelistFrom/WhitelistTo");
+        fprintf(stderr, "Error: Out of memory compiling WhitelistFrom/WhitelistTo\n");
+        return 0;
+    }
+    if ((conf.from_ac && conf.from_ac->fail) || (conf.to_ac && conf.to_ac->fail))
+        syslog(LOG_WARNING, "[CONFIG] WhitelistFrom/WhitelistTo too large for a table, using a slower compact "
+               "automaton; the WhitelistFromAddr/Domain and WhitelistToAddr/Domain sets scale better");
+    if (conf.whitelist_re && !regex_set_build(conf.whitelist_re))
+        syslog(LOG_ERR, "[CONFIG] Out of memory compiling whitelist regular expressions");
+    if (files)
+        syslog(LOG_INFO, "[CONFIG] Whitelist indexes use %zu KB", config_whitelist_memory() / 1024);
+    if (conf.domain_policies)
+        syslog(LOG_INFO, "[CONFIG] %zu domain policies use %zu KB", conf.domain_policies->count,
+               (conf.domain_policies->size * (sizeof(str_set_slot) + sizeof(uint32_t)) + conf.domain_policies->pool_size) / 1024);
+    if (conf.whitelist_db)
+        config_whitelist_db_refresh(1);
     return 1;
 }
 
 
+/**
+ * config_whitelist_db_refresh - Map WhitelistDB again if it was replaced
+ * @force: Check now rather than at most every WHITELIST_DB_CHECK_INTERVAL
+ *
+ * Cheap enough to call per connection. A new file is mapped before the
+ * old one is released, and lookups in progress finish on the old one.
+ * A file that fails to load leaves the current one in use.
+ */
+void config_whitelist_db_refresh(int force) {
+    time_t now = time(NULL);
+    struct timespec start, end;
+    wl_image *img, *old;
+
+    if (!conf.whitelist_db)
+        return;
+    if (!force && now - __atomic_load_n(&whitelist_db_checked, __ATOMIC_RELAXED) < WHITELIST_DB_CHECK_INTERVAL)
+        return;
+    /* Somebody else is already at it */
+    if (pthread_mutex_trylock(&whitelist_db_refresh_lock))
+        return;
+    __atomic_store_n(&whitelist_db_checked, now, __ATOMIC_RELAXED);
+
+    /* Only this thread replaces whitelist_db, reading it unlocked is safe */
+    if (whitelist_db && !wl_image_changed(whitelist_db, conf.whitelist_db)) {
+        pthread_mutex_unlock(&whitelist_db_refresh_lock);
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!(img = wl_image_open(conf.whitelist_db))) {
+        struct stat st;
+        int err = errno;
+
+        /* Complain once per broken file, not at every check */
+        memset(&st, 0, sizeof(st));
+        stat(conf.whitelist_db, &st);
+        if (force || st.st_ino != whitelist_db_bad.st_ino || st.st_mtime != whitelist_db_bad.st_mtime)
+            syslog(LOG_ERR, "[CONFIG] Cannot load WhitelistDB %s: %s", conf.whitelist_db, strerror(err));
+        whitelist_db_bad = st;
+        pthread_mutex_unlock(&whitelist_db_refresh_lock);
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    pthread_rwlock_wrlock(&whitelist_db_lock);
+    old = whitelist_db;
+    whitelist_db = img;
+    pthread_rwlock_unlock(&whitelist_db_lock);
+    wl_image_close(old);
+    pthread_mutex_unlock(&whitelist_db_refresh_lock);
+
+    syslog(LOG_INFO, "[CONFIG] Mapped WhitelistDB %s (%zu KB) in %.2f ms", conf.whitelist_db, img->size / 1024,
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+}
+
+
+/**
+ * config_whitelist_save - Write the loaded whitelists as a WhitelistDB
+ * @filepath: Destination, replaced atomically
+ *
+ * Returns: size of the database in bytes, or -1 on error
+ */
+long config_whitelist_save(const char *filepath) {
+    wl_lists lists;
+
+    memset(&lists, 0, sizeof(lists));
+    lists.ips = conf.ip_whitelist;
+    lists.ptrs = conf.ptr_trie;
+    lists.from_ac = conf.from_ac;
+    lists.to_ac = conf.to_ac;
+    lists.from_addrs = conf.from_addrs;
+    lists.from_domains = conf.from_domains;
+    lists.to_addrs = conf.to_addrs;
+    lists.to_domains = conf.to_domains;
+    return wl_image_write(filepath, &lists);
+}
+
+
 /**
  * config_ip_check - Check if IP is in whitelist
- * @check_ip: IP address to check
+ * @check_ip: IP address to check (network byte order, as from inet_addr())
  *
  * Returns: 1 if IP is whitelisted, 0 otherwise
  */
 int config_ip_check(unsigned long check_ip) {
-    CIDR *it = conf.cidrs;
+    uint32_t ip = ntohl((uint32_t)check_ip);
+    int found;
 
-    while (it) {
-        if (config_ip_cidr(it->ip, it->mask, check_ip))
-            return 1;
-        it = it->next;
-    }
-    return 0;
+    if (ip_index_lookup(&conf.ip_whitelist, ip))
+        return 1;
+    if (!conf.whitelist_db)
+        return 0;
+    pthread_rwlock_rdlock(&whitelist_db_lock);
+    found = whitelist_db && ip_index_lookup(&whitelist_db->lists.ips, ip);
+    pthread_rwlock_unlock(&whitelist_db_lock);
+    return found;
+}
+
+
+/**
+ * config_ip6_check - Check if IPv6 address is in whitelist
+ * @check_ip: 16 byte address, IPv4-mapped ones match IPv4 entries
+ *
+ * Returns: 1 if IP is whitelisted, 0 otherwise
+ */
+int config_ip6_check(const unsigned char *check_ip) {
+    int found;
+
+    if (ip_index_lookup6(&conf.ip_whitelist, check_ip))
+        return 1;
+    if (!conf.whitelist_db)
+        return 0;
+    pthread_rwlock_rdlock(&whitelist_db_lock);
+    found = whitelist_db && ip_index_lookup6(&whitelist_db->lists.ips, check_ip);
+    pthread_rwlock_unlock(&whitelist_db_lock);
+    return found;
 }
 
 
 /**
  * config_natip_check - Check and translate IP via NAT rules
- * @check_ip: IP address to check
+ * @check_ip: IPv4 address to check (network byte order)
  *
- * Returns: Translated IP if match found, 0 otherwise
+ * Returns: Translated IP if it is an IPv4 one, 0 otherwise
  */
 unsigned long config_natip_check(unsigned long check_ip) {
-    IPNAT *it = conf.ipnats;
+    unsigned char addr[16] = { 0 }, nat[16];
+    uint32_t ip = (uint32_t)check_ip;
 
-    while (it) {
-        if (it->srcip == check_ip)
-            return it->destip;
-        it = it->next;
-    }
-    return 0;
+    addr[10] = addr[11] = 0xff;
+    memcpy(addr + 12, &ip, sizeof(ip));
+    if (!config_natip6_check(addr, nat) || memcmp(nat, addr, 12))
+        return 0;
+    memcpy(&ip, nat + 12, sizeof(ip));
+    return ip;
+}
+
+
+/**
+ * config_natip6_check - Check and translate IP via NAT rules
+ * @check_ip: 16 byte address, IPv4 mapped into ::ffff:0:0/96
+ * @nat_ip: Receives the translated address in the same form
+ *
+ * Returns: 1 if a rule matched, 0 otherwise
+ */
+int config_natip6_check(const unsigned char *check_ip, unsigned char *nat_ip) {
+    return ip_nat_lookup(&conf.nat_table, check_ip, nat_ip);
 }
 
 
@@ -652,38 +1228,86 @@ unsigned long config_natip_check(unsigned long check_ip) {
  * config_ptr_check - Check if PTR is in whitelist
  * @ptr: PTR record to check
  *
- * Uses substring matching (PTR must end with whitelisted string)
+ * PTR must end with a whitelisted string, on a label boundary when
+ * WhitelistPTRLabels is on, or match a WhitelistPTRRegex
  * Returns: 1 if whitelisted, 0 otherwise
  */
 int config_ptr_check(const char *ptr) {
-    STR *it = conf.ptrs;
+    int found;
+
+    if (name_trie_match(conf.ptr_trie, ptr, conf.ptr_labels) ||
+        regex_set_match(conf.whitelist_re, ptr, WHITELIST_RE_PTR))
+        return 1;
+    if (!conf.whitelist_db)
+        return 0;
+    pthread_rwlock_rdlock(&whitelist_db_lock);
+    found = whitelist_db && name_trie_match(whitelist_db->lists.ptrs, ptr, conf.ptr_labels);
+    pthread_rwlock_unlock(&whitelist_db_lock);
+    return found;
+}
+
 
-    while (it) {
-        if (it->str && strlen(it->str) <= strlen(ptr) &&
-            !strcasecmp(ptr + strlen(ptr) - strlen(it->str), it->str))
+/**
+ * config_str_check - Check a string against a substring whitelist
+ * @list: Whitelisted substrings
+ * @ac: The same compiled, plus entries from whitelist files
+ *
+ * config_load() fails when the automaton cannot be built. The list is
+ * only walked when the matcher itself could not be allocated, each file
+ * entry lost that way having been logged.
+ * @str: String to check
+ *
+ * Returns: 1 if some entry occurs in str, 0 otherwise
+ */
+static int config_str_check(const STR *list, const ac_matcher *ac, const char *str) {
+    if (ac_built(ac))
+        return ac_match(ac, str);
+    for (; list; list = list->next)
+        if (list->str && strstr(str, list->str))
             return 1;
-        it = it->next;
-    }
     return 0;
 }
 
 
+/**
+ * config_addr_check - Check an address against typed whitelists
+ * @addr: Lowercased address
+ * @addrs: Whole addresses
+ * @domains: Domains, also matching their subdomains
+ *
+ * Returns: 1 if whitelisted, 0 otherwise
+ */
+static int config_addr_check(const char *addr, const str_set *addrs, const str_set *domains) {
+    const char *at;
+
+    if (str_set_contains(addrs, addr, strlen(addr)))
+        return 1;
+    return (at = strrchr(addr, '@')) && str_set_contains_domain(domains, at + 1);
+}
+
+
 /**
  * config_from_check - Check if From is in whitelist
  * @from: From address to check
  *
- * Uses substring matching
+ * Uses exact address and domain matching, then substring and regex matching
  * Returns: 1 if whitelisted, 0 otherwise
  */
 int config_from_check(const char *from) {
-    STR *it = conf.froms;
+    int found;
 
-    while (it) {
-        if (it->str && strstr(from, it->str))
-            return 1;
-        it = it->next;
-    }
-    return 0;
+    if (config_addr_check(from, conf.from_addrs, conf.from_domains) ||
+        config_str_check(conf.froms, conf.from_ac, from) ||
+        regex_set_match(conf.whitelist_re, from, WHITELIST_RE_FROM))
+        return 1;
+    if (!conf.whitelist_db)
+        return 0;
+    pthread_rwlock_rdlock(&whitelist_db_lock);
+    found = whitelist_db &&
+            (config_addr_check(from, whitelist_db->lists.from_addrs, whitelist_db->lists.from_domains) ||
+             config_str_check(NULL, whitelist_db->lists.from_ac, from));
+    pthread_rwlock_unlock(&whitelist_db_lock);
+    return found;
 }
 
 
@@ -691,16 +1315,79 @@ int config_from_check(const char *from) {
  * config_to_check - Check if To is in whitelist
  * @to: To address to check
  *
- * Uses substring matching
+ * Uses exact address and domain matching, then substring and regex matching
  * Returns: 1 if whitelisted, 0 otherwise
  */
 int config_to_check(const char *to) {
-    STR *it = conf.tos;
+    int found;
 
-    while (it) {
-        if (it->str && strstr(to, it->str))
-            return 1;
-        it = it->next;
-    }
-    return 0;
+    if (config_addr_check(to, conf.to_addrs, conf.to_domains) ||
+        config_str_check(conf.tos, conf.to_ac, to) ||
+        regex_set_match(conf.whitelist_re, to, WHITELIST_RE_TO))
+        return 1;
+    if (!conf.whitelist_db)
+        return 0;
+    pthread_rwlock_rdlock(&whitelist_db_lock);
+    found = whitelist_db &&
+            (config_addr_check(to, whitelist_db->lists.to_addrs, whitelist_db->lists.to_domains) ||
+             config_str_check(NULL, whitelist_db->lists.to_ac, to));
+    pthread_rwlock_unlock(&whitelist_db_lock);
+    return found;
+}
+
+
+/**
+ * config_has_from_whitelist - Whether any sender whitelist is configured
+ */
+int config_has_from_whitelist(void) {
+    return conf.froms || conf.from_ac || conf.from_addrs || conf.from_domains || conf.whitelist_db ||
+           (conf.whitelist_re && conf.whitelist_re->tags & WHITELIST_RE_FROM);
+}
+
+
+/**
+ * config_has_to_whitelist - Whether any recipient whitelist is configured
+ */
+int config_has_to_whitelist(void) {
+    return conf.tos || conf.to_ac || conf.to_addrs || conf.to_domains || conf.whitelist_db ||
+           (conf.whitelist_re && conf.whitelist_re->tags & WHITELIST_RE_TO);
+}
+
+
+/**
+ * config_rcpt_policy - Settings that apply to a recipient
+ * @rcpt: Lowercased recipient address
+ *
+ * Starts from the global directives and applies the DomainPolicy of
+ * the recipient domain or of its closest listed parent
+ * Returns: POLICY_* bits of the settings in effect
+ */
+unsigned int config_rcpt_policy(const char *rcpt) {
+    unsigned int policy = 0;
+    const char *at;
+    uint32_t value;
+
+    if (conf.refuse_fail)
+        policy |= POLICY_REFUSE_FAIL;
+    if (conf.soft_fail)
+        policy |= POLICY_SOFT_FAIL;
+    if (conf.tag_subject)
+        policy |= POLICY_TAG_SUBJECT;
+    if (conf.add_header)
+        policy |= POLICY_ADD_HEADER;
+    if (conf.add_recv_spf_header)
+        policy |= POLICY_ADD_RECV_HEADER;
+    if (conf.quarantine)
+        policy |= POLICY_QUARANTINE;
+    if ((at = strrchr(rcpt, '@')) && str_set_find_domain(conf.domain_policies, at + 1, &value))
+        policy = (policy & ~(value >> 8)) | (value & 0xff);
+    return policy;
+}
+
+
+/**
+ * config_has_domain_policy - Whether any DomainPolicy is configured
+ */
+int config_has_domain_policy(void) {
+    return conf.domain_policies != NULL;
 }
@@ -21,16 +21,27 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+#include "utils/aho_corasick.h"
+#include "utils/ip_index.h"
+#include "utils/ip_nat.h"
+#include "utils/name_trie.h"
+#include "utils/regex_set.h"
+#include "utils/str_set.h"
+
 /* Data Structures */
 typedef struct CIDR {
+    int family;
     unsigned long ip;
+    unsigned char ip6[16];
     unsigned short int mask;
     struct CIDR *next;
 } CIDR;
 
+/* Addresses in IPv6 form, IPv4 mapped into ::ffff:0:0/96 */
 typedef struct IPNAT {
-    unsigned long srcip;
-    unsigned long destip;
+    unsigned char srcip[16];
+    unsigned char destip[16];
+    unsigned short int mask;
     struct IPNAT *next;
 } IPNAT;
 
@@ -46,14 +57,39 @@ typedef struct config {
     char *sendmail_socket;
     char *fixed_ip;
     char *reject_reason;
+    char *cache_file;
+    char *cache_shm_name;
+    char *cache_memcached;
+    char *control_socket;
 
     IPNAT *ipnats;
+    /* conf.ipnats hashed for lookup */
+    ip_nat nat_table;
     CIDR *cidrs;
+    /* conf.cidrs compiled for lookup by config_load() */
+    ip_index ip_whitelist;
     STR *ptrs;
+    /* conf.ptrs compiled for lookup, NULL while empty */
+    name_trie *ptr_trie;
     STR *froms;
     STR *tos;
+    /* conf.froms and conf.tos compiled for lookup, NULL while empty */
+    ac_matcher *from_ac;
+    ac_matcher *to_ac;
+    /* Whitelist{From,To}{Addr,Domain}, NULL while empty */
+    str_set *from_addrs;
+    str_set *from_domains;
+    str_set *to_addrs;
+    str_set *to_domains;
+    /* Whitelist{PTR,From,To}Regex in one automaton, NULL while empty */
+    regex_set *whitelist_re;
+    /* WhitelistDB path, the mapping itself is private to config.c */
+    char *whitelist_db;
+    /* DomainPolicy entries by recipient domain, NULL while empty */
+    str_set *domain_policies;
 
     int relaxed_localpart;
+    int ptr_labels;
     int best_guess;
     int refuse_fail;
     int refuse_none;
@@ -72,6 +108,21 @@ typedef struct config {
     int syslog_facility;
 
     unsigned long spf_ttl;
+    unsigned long ttl_pass;
+    unsigned long ttl_fail;
+    unsigned long ttl_softfail;
+    unsigned long ttl_neutral;
+    unsigned long ttl_none;
+    unsigned long ttl_max;
+    unsigned long cache_file_interval;
+    unsigned long cache_stats_interval;
+    unsigned long cache_shm_slots;
+    unsigned long cache_buckets;
+    unsigned long cache_prefix4;
+    unsigned long cache_prefix6;
+    int cache_hugepages;
+    unsigned long cache_memcached_pool;
+    unsigned long cache_memcached_timeout;
 } config_t;
 
 /* Backward compatibility alias */
@@ -87,12 +138,31 @@ void config_free(void);
 
 /* Whitelist Checkers */
 int config_ip_check(unsigned long check_ip);
+int config_ip6_check(const unsigned char *check_ip);
 unsigned long config_natip_check(unsigned long check_ip);
+int config_natip6_check(const unsigned char *check_ip, unsigned char *nat_ip);
 int config_ptr_check(const char *ptr);
 int config_from_check(const char *from);
 int config_to_check(const char *to);
+int config_has_from_whitelist(void);
+int config_has_to_whitelist(void);
+void config_whitelist_db_refresh(int force);
+long config_whitelist_save(const char *filepath);
+
+/* Settings a DomainPolicy can override, as returned by config_rcpt_policy() */
+#define POLICY_REFUSE_FAIL	0x01
+#define POLICY_SOFT_FAIL	0x02
+#define POLICY_TAG_SUBJECT	0x04
+#define POLICY_ADD_HEADER	0x08
+#define POLICY_ADD_RECV_HEADER	0x10
+#define POLICY_QUARANTINE	0x20
+
+/* Recipient Policies */
+unsigned int config_rcpt_policy(const char *rcpt);
+int config_has_domain_policy(void);
 
 /* Helper Functions */
 unsigned long config_translate_time(const char *str);
+unsigned long config_class_ttl(unsigned long ttl);
 
 #endif /* CONFIG_H */
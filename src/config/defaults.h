@@ -33,7 +33,21 @@
 /* Default boolean and numeric settings */
 #define SYSLOG_FACILITY_DEFAULT		LOG_MAIL
 #define SPF_TTL_DEFAULT			3600
+/* Per-result TTLs follow TTL until set */
+#define TTL_INHERIT			((unsigned long) -1)
+#define TTL_MAX_DEFAULT			0
+#define CACHE_FILE_INTERVAL_DEFAULT	900
+#define CACHE_SHM_SLOTS_DEFAULT		65536
+#define CACHE_BUCKETS_DEFAULT		65536
+#define CACHE_PREFIX4_DEFAULT		0
+#define CACHE_PREFIX6_DEFAULT		0
+#define CACHE_HUGEPAGES_DEFAULT		0
+#define CACHE_STATS_INTERVAL_DEFAULT	0
+#define CACHE_MEMCACHED_POOL_DEFAULT	4
+#define CACHE_MEMCACHED_TIMEOUT_DEFAULT	100
 #define RELAXED_LOCALPART_DEFAULT	0
+#define WHITELIST_PTR_LABELS_DEFAULT	0
+#define WHITELIST_DB_CHECK_INTERVAL	5
 #define BEST_GUESS_DEFAULT		1
 #define REFUSE_FAIL_DEFAULT		1
 #define REFUSE_NONE_DEFAULT		0
@@ -59,6 +73,5 @@
 #define MAXLOCALPART			64
 #define IPV4_DOT_DECIMAL		"^[0-9]{1,3}[.][0-9]{1,3}[.][0-9]{1,3}[.][0-9]{1,3}$"
 #define FACILITIES_AMOUNT		10
-#define MAX_WHITELIST_ENTRIES		10000
 
 #endif /* CONFIG_DEFAULTS_H */
@@ -0,0 +1,310 @@
+/*  Copyright (C) 2005, 2006 by Eugene Kurmanin <me@kurmanin.info>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Admin control socket.
+ *
+ * A client connects to the UNIX socket, sends one command line and
+ * reads the reply until the daemon closes the connection. The last
+ * line of a reply is "OK ..." or "ERR ...". Commands:
+ *
+ *   stats                   cache statistics
+ *   dump                    every live result, one per line
+ *   flush all               drop every result
+ *   flush domain <domain>   drop the results of a sender domain
+ *   flush ip <addr>[/<len>] drop the results of an address or network,
+ *                           including aggregated ones that cover it
+ *
+ * memcached servers cannot be searched: "flush all" sends them
+ * flush_all, the other flushes leave them alone and say so.
+ *
+ * e.g. echo "flush domain example.com" | socat - UNIX:/var/run/smfs/smf-spf.ctl
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "utils/logging.h"
+
+typedef struct control_net {
+    int family;
+    int bits;
+    unsigned char addr[16];
+} control_net;
+
+static int listen_fd = -1;
+static char listen_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static pthread_t control_thread;
+
+
+/**
+ * control_parse_net - Parse "addr" or "addr/len" of at most size bytes
+ *
+ * Returns: 1 on success, 0 if it is not an address
+ */
+static int control_parse_net(const char *str, size_t size, control_net *net) {
+    char buf[INET6_ADDRSTRLEN + 5], *slash, *end;
+    long bits;
+
+    if (size >= sizeof(buf))
+        return 0;
+    memcpy(buf, str, size);
+    buf[size] = '\0';
+    net->family = strchr(buf, ':') ? AF_INET6 : AF_INET;
+    net->bits = net->family == AF_INET6 ? 128 : 32;
+    if ((slash = strchr(buf, '/'))) {
+        *slash++ = '\0';
+        bits = strtol(slash, &end, 10);
+        if (!*slash || *end || bits < 0 || bits > net->bits)
+            return 0;
+        net->bits = (int)bits;
+    }
+    return inet_pton(net->family, buf, net->addr) == 1;
+}
+
+/* Whether the two networks share an address */
+static int control_net_overlap(const control_net *a, const control_net *b) {
+    int bits = a->bits < b->bits ? a->bits : b->bits;
+    int i;
+
+    if (a->family != b->family)
+        return 0;
+    for (i = 0; i < bits / 8; i++)
+        if (a->addr[i] != b->addr[i])
+            return 0;
+    return !(bits % 8) || !((a->addr[i] ^ b->addr[i]) & (0xff << (8 - bits % 8)));
+}
+
+static int control_match_net(const char *key, void *arg) {
+    const char *bar = strchr(key, '|');
+    control_net net;
+
+    return bar && control_parse_net(key, bar - key, &net) && control_net_overlap(&net, (control_net *)arg);
+}
+
+static int control_match_domain(const char *key, void *arg) {
+    const char *bar = strchr(key, '|');
+
+    return bar && !strcasecmp(bar + 1, (const char *)arg);
+}
+
+
+static int control_reply(cache_writer writer, void *arg, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+static int control_reply(cache_writer writer, void *arg, const char *fmt, ...) {
+    char buf[1024];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf) - 1, fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        return 0;
+    if ((size_t)len > sizeof(buf) - 2)
+        len = sizeof(buf) - 2;
+    buf[len++] = '\n';
+    return writer(buf, len, arg);
+}
+
+
+/**
+ * control_command - Run one admin command
+ * @line: Command line, without the line terminator
+ * @writer: Receives the reply
+ * @arg: Passed to writer
+ *
+ * Returns: 1 if the command succeeded, 0 otherwise
+ */
+int control_command(const char *line, cache_writer writer, void *arg) {
+    char cmd[CONTROL_LINE], *what, *value, *save = NULL;
+    control_net net;
+    cache_stats stats;
+    char buf[1024];
+    unsigned long n;
+    int kept;
+    long count;
+
+    snprintf(cmd, sizeof(cmd), "%s", line);
+    what = strtok_r(cmd, " \t\r\n", &save);
+    if (!what) {
+        control_reply(writer, arg, "ERR empty command");
+        return 0;
+    }
+    if (!strcasecmp(what, "stats")) {
+        cache_stats_get(&stats, 1);
+        cache_stats_format(&stats, buf, sizeof(buf));
+        return control_reply(writer, arg, "%s", buf) && control_reply(writer, arg, "OK");
+    }
+    if (!strcasecmp(what, "dump")) {
+        if ((count = cache_dump(writer, arg)) < 0) {
+            control_reply(writer, arg, "ERR dump failed");
+            return 0;
+        }
+        return control_reply(writer, arg, "OK %ld results", count);
+    }
+    if (strcasecmp(what, "flush")) {
+        control_reply(writer, arg, "ERR unknown command %s", what);
+        return 0;
+    }
+    what = strtok_r(NULL, " \t\r\n", &save);
+    value = strtok_r(NULL, " \t\r\n", &save);
+    if (what && !strcasecmp(what, "all") && !value) {
+        n = cache_flush(NULL, NULL, &kept);
+    } else if (what && !strcasecmp(what, "domain") && value) {
+        n = cache_flush(control_match_domain, value, &kept);
+    } else if (what && !strcasecmp(what, "ip") && value) {
+        if (!control_parse_net(value, strlen(value), &net)) {
+            control_reply(writer, arg, "ERR bad address %s", value);
+            return 0;
+        }
+        n = cache_flush(control_match_net, &net, &kept);
+    } else {
+        control_reply(writer, arg, "ERR usage: flush all | flush domain <domain> | flush ip <addr>[/<len>]");
+        return 0;
+    }
+    log_message(LOG_NOTICE, "control: flush %s%s%s: %lu results dropped%s", what, value ? " " : "", value ? value : "",
+                n, kept ? ", memcached not flushed" : "");
+    return control_reply(writer, arg, "OK %lu results flushed%s", n, kept ? ", memcached not flushed" : "");
+}
+
+
+/* Writer sending a reply to the client socket */
+static int control_send(const char *buf, size_t len, void *arg) {
+    int fd = *(int *)arg;
+    ssize_t n;
+
+    while (len) {
+        if ((n = send(fd, buf, len, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static void control_client(int fd) {
+    struct timeval tv = { CONTROL_TIMEOUT, 0 };
+    char line[CONTROL_LINE];
+    size_t len = 0;
+    ssize_t n;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    while (len < sizeof(line) - 1 && !memchr(line, '\n', len)) {
+        if ((n = recv(fd, line + len, sizeof(line) - 1 - len, 0)) < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+    }
+    line[len] = '\0';
+    line[strcspn(line, "\r\n")] = '\0';
+    if (len)
+        control_command(line, control_send, &fd);
+}
+
+static void *control_loop(void *arg) {
+    int fd;
+
+    (void)arg;
+    for (;;) {
+        if ((fd = accept(listen_fd, NULL, NULL)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            /* control_stop() shut the socket down */
+            break;
+        }
+        control_client(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+
+/**
+ * control_start - Listen for admin commands
+ * @path: UNIX socket path, a stale socket there is replaced
+ *
+ * Returns: 1 on success, 0 on failure (errno is set)
+ */
+int control_start(const char *path) {
+    struct sockaddr_un sun;
+    struct stat st;
+    int saved_errno;
+
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    if (!lstat(path, &st)) {
+        if (!S_ISSOCK(st.st_mode)) {
+            errno = EEXIST;
+            return 0;
+        }
+        unlink(path);
+    }
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return 0;
+    if (bind(listen_fd, (struct sockaddr *)&sun, sizeof(sun)) || listen(listen_fd, 4))
+        goto fail;
+    chmod(path, 0600);
+    strcpy(listen_path, path);
+    if ((errno = pthread_create(&control_thread, NULL, control_loop, NULL))) {
+        unlink(path);
+        goto fail;
+    }
+    return 1;
+fail:
+    saved_errno = errno;
+    close(listen_fd);
+    listen_fd = -1;
+    errno = saved_errno;
+    return 0;
+}
+
+
+/**
+ * control_stop - Stop serving commands and remove the socket
+ */
+void control_stop(void) {
+    if (listen_fd < 0)
+        return;
+    shutdown(listen_fd, SHUT_RDWR);
+    pthread_join(control_thread, NULL);
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(listen_path);
+}
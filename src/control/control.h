@@ -0,0 +1,35 @@
+/*  Copyright (C) 2005, 2006 by Eugene Kurmanin <me@kurmanin.info>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "cache/cache.h"
+
+/* Longest command line accepted */
+#define CONTROL_LINE		512
+/* Seconds a client may take to send its command */
+#define CONTROL_TIMEOUT		5
+
+/* Serve admin commands on a UNIX socket from a thread of its own */
+int control_start(const char *path);
+void control_stop(void);
+
+/* Run one command line, the reply goes to writer */
+int control_command(const char *line, cache_writer writer, void *arg);
+
+#endif /* CONTROL_H */
@@ -0,0 +1,205 @@
+/*
+ * aho_corasick.c - Multi-pattern substring matcher for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * ac_build() walks the trie breadth first. The row of a node starts as
+ * a copy of the row of its failure node, which is shallower and so
+ * already complete, then the node's own children override their
+ * columns. The failure node of a child is where the parent's failure
+ * row sends the child's byte. Following failure links at scan time is
+ * thus folded into the table once, at load.
+ *
+ * When the table would be too large, the same walk only records the
+ * failure links, found by following the parent's links until a node
+ * has a child for the byte, and merges each node's match flag with
+ * its failure node's.
+ */
+
+#include "aho_corasick.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define AC_MIN_NODES	64
+
+ac_matcher *ac_new(void) {
+    ac_matcher *ac = calloc(1, sizeof(*ac));
+
+    if (ac && !(ac->nodes = calloc(AC_MIN_NODES, sizeof(*ac->nodes)))) {
+        free(ac);
+        return NULL;
+    }
+    if (ac) {
+        ac->count = 1;
+        ac->size = AC_MIN_NODES;
+    }
+    return ac;
+}
+
+static uint32_t ac_child(const ac_matcher *ac, uint32_t node, unsigned char c) {
+    uint32_t it;
+
+    for (it = ac->nodes[node].child; it; it = ac->nodes[it].sibling)
+        if (ac->nodes[it].c == c)
+            return it;
+    return 0;
+}
+
+int ac_add(ac_matcher *ac, const char *pattern) {
+    const unsigned char *p = (const unsigned char *)pattern;
+    uint32_t node = 0, next;
+
+    for (; *p; p++) {
+        if (!(next = ac_child(ac, node, *p))) {
+            if (ac->count == ac->size) {
+                ac_node *nodes = realloc(ac->nodes, ac->size * 2 * sizeof(*nodes));
+
+                if (!nodes)
+                    return 0;
+                ac->nodes = nodes;
+                ac->size *= 2;
+            }
+            next = (uint32_t)ac->count++;
+            memset(&ac->nodes[next], 0, sizeof(ac->nodes[next]));
+            ac->nodes[next].c = *p;
+            ac->nodes[next].sibling = ac->nodes[node].child;
+            ac->nodes[node].child = next;
+        }
+        node = next;
+    }
+    ac->nodes[node].out = 1;
+    return 1;
+}
+
+/* Failure links only, for a trie whose dense table is too large */
+static int ac_build_sparse(ac_matcher *ac) {
+    uint32_t *queue, u, w, f;
+    size_t head = 0, tail = 0;
+
+    if (!(ac->fail = calloc(ac->count, sizeof(*ac->fail))) ||
+        !(queue = malloc(ac->count * sizeof(*queue)))) {
+        free(ac->fail);
+        ac->fail = NULL;
+        return 0;
+    }
+    queue[tail++] = 0;
+    while (head < tail) {
+        u = queue[head++];
+        for (w = ac->nodes[u].child; w; w = ac->nodes[w].sibling) {
+            if (u) {
+                for (f = ac->fail[u]; f && !ac_child(ac, f, ac->nodes[w].c); f = ac->fail[f])
+                    ;
+                ac->fail[w] = ac_child(ac, f, ac->nodes[w].c);
+                ac->nodes[w].out |= ac->nodes[ac->fail[w]].out;
+            }
+            queue[tail++] = w;
+        }
+    }
+    free(queue);
+    return 1;
+}
+
+int ac_build(ac_matcher *ac) {
+    uint32_t *fail = NULL, *queue = NULL, *row, u, w;
+    size_t head = 0, tail = 0, i;
+    unsigned int classes = 1;
+
+    free(ac->table);
+    free(ac->fail);
+    ac->table = NULL;
+    ac->fail = NULL;
+    ac->table_size = 0;
+
+    /* Column 0 is every byte no pattern uses */
+    memset(ac->byte_class, 0, sizeof(ac->byte_class));
+    for (i = 1; i < ac->count; i++)
+        if (!ac->byte_class[ac->nodes[i].c])
+            ac->byte_class[ac->nodes[i].c] = classes++;
+    ac->classes = classes;
+    if (ac->count > AC_MAX_TABLE_CELLS / classes)
+        return ac_build_sparse(ac);
+
+    if (!(ac->table = calloc(ac->count * classes, sizeof(*ac->table))) ||
+        !(fail = calloc(ac->count, sizeof(*fail))) ||
+        !(queue = malloc(ac->count * sizeof(*queue)))) {
+        free(ac->table);
+        ac->table = NULL;
+        free(fail);
+        /* The failure links need far less memory than the table */
+        return ac_build_sparse(ac);
+    }
+    ac->table_size = ac->count * classes;
+
+    queue[tail++] = 0;
+    while (head < tail) {
+        u = queue[head++];
+        row = &ac->table[(size_t)u * classes];
+        if (u)
+            memcpy(row, &ac->table[(size_t)fail[u] * classes], classes * sizeof(*row));
+        for (w = ac->nodes[u].child; w; w = ac->nodes[w].sibling) {
+            if (u) {
+                fail[w] = ac->table[(size_t)fail[u] * classes + ac->byte_class[ac->nodes[w].c]] & ~AC_MATCH;
+                fail[w] /= classes;
+                ac->nodes[w].out |= ac->nodes[fail[w]].out;
+            }
+            row[ac->byte_class[ac->nodes[w].c]] = w * classes | (ac->nodes[w].out ? AC_MATCH : 0);
+            queue[tail++] = w;
+        }
+    }
+    free(fail);
+    free(queue);
+    return 1;
+}
+
+int ac_built(const ac_matcher *ac) {
+    return ac && (ac->table || ac->fail);
+}
+
+int ac_match(const ac_matcher *ac, const char *text) {
+    const unsigned char *p = (const unsigned char *)text;
+    const uint32_t *table = ac->table;
+    uint32_t s = 0, next;
+
+    if (!ac_built(ac))
+        return 0;
+    /* The empty pattern */
+    if (ac->nodes[0].out)
+        return 1;
+    if (!table) {
+        for (; *p; p++) {
+            while (!(next = ac_child(ac, s, *p)) && s)
+                s = ac->fail[s];
+            s = next;
+            if (ac->nodes[s].out)
+                return 1;
+        }
+        return 0;
+    }
+    for (; *p; p++) {
+        s = table[(s & ~AC_MATCH) + ac->byte_class[*p]];
+        if (s & AC_MATCH)
+            return 1;
+    }
+    return 0;
+}
+
+void ac_free(ac_matcher *ac) {
+    if (!ac)
+        return;
+    free(ac->nodes);
+    free(ac->fail);
+    free(ac->table);
+    free(ac);
+}
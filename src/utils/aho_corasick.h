@@ -0,0 +1,118 @@
+/*
+ * aho_corasick.h - Multi-pattern substring matcher for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SMF_SPF_AHO_CORASICK_H
+#define SMF_SPF_AHO_CORASICK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Set in a transition when the state it leads to ends a pattern */
+#define AC_MATCH	0x80000000U
+/* Largest dense table, 16 MB */
+#define AC_MAX_TABLE_CELLS	(4UL << 20)
+
+typedef struct ac_node {
+    uint32_t child;
+    uint32_t sibling;
+    unsigned char c;
+    unsigned char out;
+} ac_node;
+
+/**
+ * @brief Set of substring patterns compiled into one automaton
+ *
+ * Patterns are collected in a trie with ac_add(); ac_build() turns it
+ * into a dense DFA with one row per trie node. Bytes that appear in no
+ * pattern share a single column, so rows stay as narrow as the
+ * pattern alphabet. A transition is the offset of the next row, with
+ * AC_MATCH set if that state ends a pattern, so scanning costs one
+ * table load per input byte whatever the number of patterns.
+ *
+ * A table over AC_MAX_TABLE_CELLS entries, or one that cannot be
+ * allocated, is not built. The trie is
+ * then scanned in place with failure links, the classic goto/fail
+ * form: 16 bytes per node instead of 4 per node and byte class, for
+ * a few sibling hops per input byte.
+ */
+typedef struct ac_matcher {
+    /* Pattern trie, node 0 is the root */
+    ac_node *nodes;
+    size_t count;
+    size_t size;
+    /* Failure link of each node, when the table would be too large */
+    uint32_t *fail;
+    /* Compiled automaton */
+    uint32_t *table;
+    size_t table_size;
+    unsigned int classes;
+    uint16_t byte_class[256];
+} ac_matcher;
+
+/**
+ * @brief Allocate an empty matcher
+ *
+ * @return The matcher, or NULL on allocation failure
+ */
+ac_matcher *ac_new(void);
+
+/**
+ * @brief Add a pattern, compared byte for byte
+ *
+ * The matcher must be rebuilt before the next lookup.
+ *
+ * @param ac Matcher to add to
+ * @param pattern Substring to look for, "" matches everything
+ * @return 1 on success, 0 on allocation failure
+ */
+int ac_add(ac_matcher *ac, const char *pattern);
+
+/**
+ * @brief Compile the patterns added so far
+ *
+ * @param ac Matcher to compile
+ * @return 1 on success, 0 on allocation failure (lookups then miss)
+ */
+int ac_build(ac_matcher *ac);
+
+/**
+ * @brief Check whether a matcher was compiled, in either form
+ *
+ * @param ac Matcher, NULL is not built
+ * @return 1 if ac_match() can be used, 0 otherwise
+ */
+int ac_built(const ac_matcher *ac);
+
+/**
+ * @brief Check whether a text contains any of the patterns
+ *
+ * Same result as calling strstr() with every pattern. Thread safe as
+ * long as nobody modifies the matcher.
+ *
+ * @param ac Built matcher
+ * @param text Text to scan
+ * @return 1 if some pattern occurs in the text, 0 otherwise
+ */
+int ac_match(const ac_matcher *ac, const char *text);
+
+/**
+ * @brief Free a matcher
+ *
+ * @param ac Matcher to free, NULL is ignored
+ */
+void ac_free(ac_matcher *ac);
+
+#endif /* SMF_SPF_AHO_CORASICK_H */
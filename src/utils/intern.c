@@ -0,0 +1,233 @@
+/*
+ * intern.c - Interned string table for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Strings live in a chained hash table guarded by a read-write lock;
+ * lookups of strings already interned only take the read lock and an
+ * atomic reference increment. An array maps IDs back to entries, the
+ * IDs of freed strings are recycled through a stack.
+ */
+
+#include "intern.h"
+#include "memory.h"
+#include <pthread.h>
+#include <string.h>
+
+#define INTERN_MIN_BUCKETS	1024
+
+typedef struct intern_entry {
+    struct intern_entry *next;
+    unsigned long hash;
+    unsigned int refs;
+    intern_id id;
+    char str[];
+} intern_entry;
+
+static pthread_rwlock_t intern_lock = PTHREAD_RWLOCK_INITIALIZER;
+static intern_entry **buckets = NULL;
+static unsigned long mask = 0;
+static unsigned long count = 0;
+static intern_entry **by_id = NULL;
+static intern_id id_next = 1;
+static intern_id id_size = 0;
+static intern_id *free_ids = NULL;
+static intern_id nfree = 0;
+
+static unsigned long intern_hash(const char *str) {
+    unsigned long hash = 5381;
+
+    while (*str)
+        hash = hash * 33 ^ (unsigned char)*str++;
+    return hash;
+}
+
+/* Caller holds intern_lock */
+static intern_entry *intern_lookup(const char *str, unsigned long hash) {
+    intern_entry *e;
+
+    if (!buckets)
+        return NULL;
+    for (e = buckets[hash & mask]; e; e = e->next)
+        if (e->hash == hash && !strcmp(e->str, str))
+            return e;
+    return NULL;
+}
+
+/* Double the bucket array once chains average two entries, caller holds the write lock */
+static void intern_grow(void) {
+    unsigned long i, size = buckets ? (mask + 1) << 1 : INTERN_MIN_BUCKETS;
+    intern_entry **nb, *e, *e_next;
+
+    if (buckets && count <= (mask + 1) * 2)
+        return;
+    if (!(nb = calloc(size, sizeof(*nb))))
+        return;
+    for (i = 0; buckets && i <= mask; i++) {
+        for (e = buckets[i]; e; e = e_next) {
+            e_next = e->next;
+            e->next = nb[e->hash & (size - 1)];
+            nb[e->hash & (size - 1)] = e;
+        }
+    }
+    free(buckets);
+    buckets = nb;
+    mask = size - 1;
+}
+
+/* Caller holds the write lock */
+static intern_id intern_new_id(void) {
+    if (nfree)
+        return free_ids[--nfree];
+    if (id_next >= id_size) {
+        intern_id size = id_size ? id_size * 2 : INTERN_MIN_BUCKETS;
+        intern_entry **nb = realloc(by_id, size * sizeof(*nb));
+        intern_id *nf;
+
+        if (!nb)
+            return 0;
+        by_id = nb;
+        if (!(nf = realloc(free_ids, size * sizeof(*nf))))
+            return 0;
+        free_ids = nf;
+        id_size = size;
+    }
+    return id_next++;
+}
+
+intern_id intern_get(const char *str) {
+    unsigned long hash = intern_hash(str);
+    intern_entry *e;
+    intern_id id = 0;
+    size_t len;
+
+    pthread_rwlock_rdlock(&intern_lock);
+    if ((e = intern_lookup(str, hash))) {
+        __atomic_add_fetch(&e->refs, 1, __ATOMIC_RELAXED);
+        id = e->id;
+    }
+    pthread_rwlock_unlock(&intern_lock);
+    if (id)
+        return id;
+
+    pthread_rwlock_wrlock(&intern_lock);
+    if ((e = intern_lookup(str, hash))) {
+        __atomic_add_fetch(&e->refs, 1, __ATOMIC_RELAXED);
+        id = e->id;
+        goto done;
+    }
+    intern_grow();
+    len = strlen(str);
+    if (!buckets || !(e = malloc(sizeof(*e) + len + 1)))
+        goto done;
+    if (!(id = intern_new_id())) {
+        free(e);
+        goto done;
+    }
+    memcpy(e->str, str, len + 1);
+    e->hash = hash;
+    e->refs = 1;
+    e->id = id;
+    e->next = buckets[hash & mask];
+    buckets[hash & mask] = e;
+    by_id[id] = e;
+    count++;
+done:
+    pthread_rwlock_unlock(&intern_lock);
+    return id;
+}
+
+intern_id intern_find(const char *str) {
+    intern_entry *e;
+    intern_id id;
+
+    pthread_rwlock_rdlock(&intern_lock);
+    id = (e = intern_lookup(str, intern_hash(str))) ? e->id : 0;
+    pthread_rwlock_unlock(&intern_lock);
+    return id;
+}
+
+void intern_ref(intern_id id) {
+    pthread_rwlock_rdlock(&intern_lock);
+    if (id && id < id_next && by_id[id])
+        __atomic_add_fetch(&by_id[id]->refs, 1, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&intern_lock);
+}
+
+void intern_release(intern_id id) {
+    intern_entry *e, **pe;
+    unsigned int refs = 1;
+
+    if (!id)
+        return;
+    pthread_rwlock_rdlock(&intern_lock);
+    if (id < id_next && by_id[id])
+        refs = __atomic_sub_fetch(&by_id[id]->refs, 1, __ATOMIC_ACQ_REL);
+    pthread_rwlock_unlock(&intern_lock);
+    if (refs)
+        return;
+
+    /* Someone may have taken the string again meanwhile */
+    pthread_rwlock_wrlock(&intern_lock);
+    if ((e = by_id[id]) && !e->refs) {
+        for (pe = &buckets[e->hash & mask]; *pe != e; pe = &(*pe)->next)
+            continue;
+        *pe = e->next;
+        by_id[id] = NULL;
+        free_ids[nfree++] = id;
+        count--;
+        free(e);
+    }
+    pthread_rwlock_unlock(&intern_lock);
+}
+
+const char *intern_str(intern_id id) {
+    const char *str = NULL;
+
+    pthread_rwlock_rdlock(&intern_lock);
+    if (id && id < id_next && by_id[id])
+        str = by_id[id]->str;
+    pthread_rwlock_unlock(&intern_lock);
+    return str;
+}
+
+unsigned long intern_count(void) {
+    unsigned long n;
+
+    pthread_rwlock_rdlock(&intern_lock);
+    n = count;
+    pthread_rwlock_unlock(&intern_lock);
+    return n;
+}
+
+void intern_destroy(void) {
+    intern_entry *e, *e_next;
+    unsigned long i;
+
+    pthread_rwlock_wrlock(&intern_lock);
+    for (i = 0; buckets && i <= mask; i++) {
+        for (e = buckets[i]; e; e = e_next) {
+            e_next = e->next;
+            free(e);
+        }
+    }
+    SAFE_FREE(buckets);
+    SAFE_FREE(by_id);
+    SAFE_FREE(free_ids);
+    mask = count = 0;
+    id_next = 1;
+    id_size = nfree = 0;
+    pthread_rwlock_unlock(&intern_lock);
+}
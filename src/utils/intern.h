@@ -0,0 +1,89 @@
+/*
+ * intern.h - Interned string table for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SMF_SPF_INTERN_H
+#define SMF_SPF_INTERN_H
+
+#include <stdint.h>
+
+/**
+ * @brief Identifier of an interned string, 0 is never handed out
+ *
+ * Two holders of the same string hold the same ID, so comparing
+ * interned strings is an integer compare.
+ */
+typedef uint32_t intern_id;
+
+/**
+ * @brief Intern a string and take a reference on it
+ *
+ * Returns the ID of the string, adding it to the table if needed.
+ * Every successful call must be paired with intern_release().
+ * Thread safe.
+ *
+ * @param str String to intern (e.g. a sender domain)
+ * @return ID of the string, or 0 on allocation failure
+ */
+intern_id intern_get(const char *str);
+
+/**
+ * @brief Look up the ID of a string without taking a reference
+ *
+ * The ID stays valid only while some other reference keeps the
+ * string interned.
+ *
+ * @param str String to look up
+ * @return ID of the string, or 0 if it is not interned
+ */
+intern_id intern_find(const char *str);
+
+/**
+ * @brief Take another reference on an interned string
+ *
+ * @param id ID held by the caller
+ */
+void intern_ref(intern_id id);
+
+/**
+ * @brief Drop a reference, freeing the string with the last one
+ *
+ * The ID may be handed out again for another string afterwards.
+ *
+ * @param id ID held by the caller, 0 is ignored
+ */
+void intern_release(intern_id id);
+
+/**
+ * @brief Get the string of an ID
+ *
+ * The pointer stays valid while the caller holds a reference.
+ *
+ * @param id Interned string ID
+ * @return The string, or NULL for an unknown ID
+ */
+const char *intern_str(intern_id id);
+
+/**
+ * @brief Number of strings currently interned
+ */
+unsigned long intern_count(void);
+
+/**
+ * @brief Free the whole table, outstanding IDs become invalid
+ */
+void intern_destroy(void);
+
+#endif /* SMF_SPF_INTERN_H */
@@ -0,0 +1,209 @@
+/*
+ * ip_index.c - Address prefix index for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Each prefix becomes the range of addresses it covers. Once sorted
+ * by first address, overlapping and adjacent ranges are merged, which
+ * leaves a disjoint sorted array: the only candidate for an address
+ * is the last range starting at or below it. With a million prefixes
+ * that is 20 probes into one flat array, where the CIDR list took a
+ * million mask-and-compares. IPv6 ranges get the same treatment in
+ * an array of their own, with 128 bit keys split in two halves.
+ */
+
+#include "ip_index.h"
+#include <stdlib.h>
+
+#define IP_INDEX_MIN_SIZE	16
+
+/* Make room for one more element of an array doubling as it grows */
+static int ip_index_grow(void **array, size_t *size, size_t count, size_t elem) {
+    size_t grown = *size ? *size * 2 : IP_INDEX_MIN_SIZE;
+    void *p;
+
+    if (count < *size)
+        return 1;
+    if (!(p = realloc(*array, grown * elem)))
+        return 0;
+    *array = p;
+    *size = grown;
+    return 1;
+}
+
+/* Shrink an array to its final count, the index is read-only from here */
+static void *ip_index_shrink(void *array, size_t *size, size_t count, size_t elem) {
+    void *p;
+
+    if (count && (p = realloc(array, count * elem))) {
+        *size = count;
+        return p;
+    }
+    return array;
+}
+
+static ip_key6 ip_key6_load(const unsigned char *addr) {
+    ip_key6 key = { 0, 0 };
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        key.hi = key.hi << 8 | addr[i];
+        key.lo = key.lo << 8 | addr[i + 8];
+    }
+    return key;
+}
+
+static int ip_key6_cmp(const ip_key6 *a, const ip_key6 *b) {
+    if (a->hi != b->hi)
+        return a->hi < b->hi ? -1 : 1;
+    return (a->lo > b->lo) - (a->lo < b->lo);
+}
+
+/* ::ffff:0:0/96, where IPv4 addresses live in IPv6 */
+static int ip_key6_mapped(const ip_key6 *key) {
+    return !key->hi && key->lo >> 32 == 0xffff;
+}
+
+int ip_index_add(ip_index *idx, uint32_t addr, unsigned int bits) {
+    uint32_t mask = bits >= 32 ? 0xffffffffU : bits ? ~(0xffffffffU >> bits) : 0;
+
+    if (!ip_index_grow((void **)&idx->ranges, &idx->size, idx->count, sizeof(*idx->ranges)))
+        return 0;
+    idx->ranges[idx->count].first = addr & mask;
+    idx->ranges[idx->count].last = addr | ~mask;
+    idx->count++;
+    return 1;
+}
+
+int ip_index_add6(ip_index *idx, const unsigned char *addr, unsigned int bits) {
+    ip_key6 key = ip_key6_load(addr), mask;
+    ip_range6 *r;
+
+    if (bits > 128)
+        bits = 128;
+    if (bits >= 96 && ip_key6_mapped(&key))
+        return ip_index_add(idx, (uint32_t)key.lo, bits - 96);
+    mask.hi = bits >= 64 ? ~0ULL : bits ? ~(~0ULL >> bits) : 0;
+    mask.lo = bits >= 128 ? ~0ULL : bits > 64 ? ~(~0ULL >> (bits - 64)) : 0;
+    if (!ip_index_grow((void **)&idx->ranges6, &idx->size6, idx->count6, sizeof(*idx->ranges6)))
+        return 0;
+    r = &idx->ranges6[idx->count6++];
+    r->first.hi = key.hi & mask.hi;
+    r->first.lo = key.lo & mask.lo;
+    r->last.hi = key.hi | ~mask.hi;
+    r->last.lo = key.lo | ~mask.lo;
+    /* A shorter prefix spanning ::ffff:0:0/96 covers all of IPv4 too */
+    if (!r->first.hi && r->first.lo <= 0xffff00000000ULL && (r->last.hi || r->last.lo >= 0xffffffffffffULL))
+        return ip_index_add(idx, 0, 0);
+    return 1;
+}
+
+static int ip_range_cmp(const void *a, const void *b) {
+    const ip_range *x = a, *y = b;
+
+    if (x->first != y->first)
+        return x->first < y->first ? -1 : 1;
+    return (x->last > y->last) - (x->last < y->last);
+}
+
+static int ip_range6_cmp(const void *a, const void *b) {
+    const ip_range6 *x = a, *y = b;
+    int c = ip_key6_cmp(&x->first, &y->first);
+
+    return c ? c : ip_key6_cmp(&x->last, &y->last);
+}
+
+static void ip_index_build6(ip_index *idx) {
+    ip_key6 next;
+    size_t i, n = 0;
+
+    qsort(idx->ranges6, idx->count6, sizeof(*idx->ranges6), ip_range6_cmp);
+    for (i = 1; i < idx->count6; i++) {
+        ip_range6 *cur = &idx->ranges6[n];
+
+        next.lo = cur->last.lo + 1;
+        next.hi = cur->last.hi + !next.lo;
+        if (ip_key6_cmp(&idx->ranges6[i].first, &cur->last) <= 0 || !ip_key6_cmp(&idx->ranges6[i].first, &next)) {
+            if (ip_key6_cmp(&idx->ranges6[i].last, &cur->last) > 0)
+                cur->last = idx->ranges6[i].last;
+        } else {
+            idx->ranges6[++n] = idx->ranges6[i];
+        }
+    }
+    idx->count6 = n + 1;
+    idx->ranges6 = ip_index_shrink(idx->ranges6, &idx->size6, idx->count6, sizeof(*idx->ranges6));
+}
+
+void ip_index_build(ip_index *idx) {
+    size_t i, n = 0;
+
+    if (idx->count6)
+        ip_index_build6(idx);
+    if (!idx->count)
+        return;
+    qsort(idx->ranges, idx->count, sizeof(*idx->ranges), ip_range_cmp);
+    for (i = 1; i < idx->count; i++) {
+        ip_range *cur = &idx->ranges[n];
+
+        /* Overlapping or adjacent, the second test avoids last + 1 wrapping */
+        if (idx->ranges[i].first <= cur->last || idx->ranges[i].first - 1 == cur->last) {
+            if (idx->ranges[i].last > cur->last)
+                cur->last = idx->ranges[i].last;
+        } else {
+            idx->ranges[++n] = idx->ranges[i];
+        }
+    }
+    idx->count = n + 1;
+    idx->ranges = ip_index_shrink(idx->ranges, &idx->size, idx->count, sizeof(*idx->ranges));
+}
+
+int ip_index_lookup(const ip_index *idx, uint32_t addr) {
+    size_t lo = 0, hi = idx->count, mid;
+
+    /* Find the first range starting above addr */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (idx->ranges[mid].first <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 && addr <= idx->ranges[lo - 1].last;
+}
+
+int ip_index_lookup6(const ip_index *idx, const unsigned char *addr) {
+    ip_key6 key = ip_key6_load(addr);
+    size_t lo = 0, hi = idx->count6, mid;
+
+    if (ip_key6_mapped(&key))
+        return ip_index_lookup(idx, (uint32_t)key.lo);
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (ip_key6_cmp(&idx->ranges6[mid].first, &key) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 && ip_key6_cmp(&key, &idx->ranges6[lo - 1].last) <= 0;
+}
+
+void ip_index_free(ip_index *idx) {
+    free(idx->ranges);
+    free(idx->ranges6);
+    idx->ranges = NULL;
+    idx->ranges6 = NULL;
+    idx->count = idx->count6 = 0;
+    idx->size = idx->size6 = 0;
+}
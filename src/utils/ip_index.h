@@ -0,0 +1,122 @@
+/*
+ * ip_index.h - Address prefix index for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SMF_SPF_IP_INDEX_H
+#define SMF_SPF_IP_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Inclusive address range, host byte order */
+typedef struct ip_range {
+    uint32_t first;
+    uint32_t last;
+} ip_range;
+
+/* IPv6 address as two host order halves, compares like the address */
+typedef struct ip_key6 {
+    uint64_t hi;
+    uint64_t lo;
+} ip_key6;
+
+typedef struct ip_range6 {
+    ip_key6 first;
+    ip_key6 last;
+} ip_range6;
+
+/**
+ * @brief Set of CIDR prefixes compiled for lookup
+ *
+ * Prefixes are collected with ip_index_add(), then ip_index_build()
+ * sorts them and merges overlapping and adjacent ones into disjoint
+ * ranges, so a lookup is one binary search whatever the number of
+ * prefixes. A zeroed struct is an empty index.
+ *
+ * IPv4 and IPv6 prefixes are kept in separate arrays so IPv4 lookups
+ * stay on 8 byte ranges. IPv4-mapped IPv6 (::ffff:0:0/96) belongs to
+ * the IPv4 side, so both spellings of an address find the same entry.
+ */
+typedef struct ip_index {
+    ip_range *ranges;
+    size_t count;
+    size_t size;
+    ip_range6 *ranges6;
+    size_t count6;
+    size_t size6;
+} ip_index;
+
+/**
+ * @brief Add a prefix to the index
+ *
+ * Host bits of the address are ignored. The index must be rebuilt
+ * before the next lookup.
+ *
+ * @param idx Index to add to
+ * @param addr Network address (host byte order)
+ * @param bits Prefix length (0-32, larger values mean 32)
+ * @return 1 on success, 0 on allocation failure
+ */
+int ip_index_add(ip_index *idx, uint32_t addr, unsigned int bits);
+
+/**
+ * @brief Add an IPv6 prefix to the index
+ *
+ * Host bits of the address are ignored. The index must be rebuilt
+ * before the next lookup.
+ *
+ * @param idx Index to add to
+ * @param addr Network address (16 bytes, network byte order)
+ * @param bits Prefix length (0-128, larger values mean 128)
+ * @return 1 on success, 0 on allocation failure
+ */
+int ip_index_add6(ip_index *idx, const unsigned char *addr, unsigned int bits);
+
+/**
+ * @brief Sort and merge the prefixes added so far
+ *
+ * @param idx Index to compile
+ */
+void ip_index_build(ip_index *idx);
+
+/**
+ * @brief Check whether an address is covered by a prefix of the index
+ *
+ * The index must have been built. Thread safe as long as nobody
+ * modifies the index.
+ *
+ * @param idx Built index
+ * @param addr Address to look up (host byte order)
+ * @return 1 if the address is covered, 0 otherwise
+ */
+int ip_index_lookup(const ip_index *idx, uint32_t addr);
+
+/**
+ * @brief Check whether an IPv6 address is covered by the index
+ *
+ * @param idx Built index
+ * @param addr Address to look up (16 bytes, network byte order)
+ * @return 1 if the address is covered, 0 otherwise
+ */
+int ip_index_lookup6(const ip_index *idx, const unsigned char *addr);
+
+/**
+ * @brief Free the ranges, leaving an empty index
+ *
+ * @param idx Index to clear
+ */
+void ip_index_free(ip_index *idx);
+
+#endif /* SMF_SPF_IP_INDEX_H */
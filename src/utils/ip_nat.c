@@ -0,0 +1,132 @@
+/*
+ * ip_nat.c - Client address translation table for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * One open addressing table with linear probing holds every mapping,
+ * keyed on the masked source prefix and its length. It is kept at most
+ * half full so unsuccessful probes, the common case for an untranslated
+ * client, stop at an empty slot after a step or two.
+ */
+
+#include "ip_nat.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IP_NAT_MIN_SLOTS	64
+
+static void ip_nat_mask(const unsigned char *addr, unsigned int bits, unsigned char *out) {
+    unsigned int i;
+
+    for (i = 0; i < IP_NAT_ADDR_LEN; i++, bits = bits > 8 ? bits - 8 : 0)
+        out[i] = bits >= 8 ? addr[i] : addr[i] & (unsigned char)(0xff00 >> bits);
+}
+
+/* FNV-1a over the prefix and its length */
+static size_t ip_nat_hash(const unsigned char *prefix, unsigned int bits) {
+    uint64_t h = 14695981039346656037ULL;
+    int i;
+
+    for (i = 0; i < IP_NAT_ADDR_LEN; i++)
+        h = (h ^ prefix[i]) * 1099511628211ULL;
+    h = (h ^ bits) * 1099511628211ULL;
+    return (size_t)(h ^ h >> 32);
+}
+
+static ip_nat_entry *ip_nat_slot(ip_nat_entry *slots, size_t size, const unsigned char *prefix, unsigned int bits) {
+    size_t i = ip_nat_hash(prefix, bits) & (size - 1);
+
+    while (slots[i].used && (slots[i].bits != bits || memcmp(slots[i].src, prefix, IP_NAT_ADDR_LEN)))
+        i = (i + 1) & (size - 1);
+    return &slots[i];
+}
+
+static int ip_nat_grow(ip_nat *nat) {
+    size_t size = nat->size ? nat->size * 2 : IP_NAT_MIN_SLOTS, i;
+    ip_nat_entry *slots = calloc(size, sizeof(*slots));
+
+    if (!slots)
+        return 0;
+    for (i = 0; i < nat->size; i++)
+        if (nat->slots[i].used)
+            *ip_nat_slot(slots, size, nat->slots[i].src, nat->slots[i].bits) = nat->slots[i];
+    free(nat->slots);
+    nat->slots = slots;
+    nat->size = size;
+    return 1;
+}
+
+static int ip_nat_put(ip_nat *nat, const unsigned char *src, unsigned int bits, const unsigned char *dst, int host) {
+    unsigned char prefix[IP_NAT_ADDR_LEN];
+    ip_nat_entry *e;
+
+    if (bits > IP_NAT_MAX_BITS)
+        bits = IP_NAT_MAX_BITS;
+    if ((nat->count + 1) * 2 > nat->size && !ip_nat_grow(nat))
+        return 0;
+    ip_nat_mask(src, bits, prefix);
+    e = ip_nat_slot(nat->slots, nat->size, prefix, bits);
+    if (!e->used) {
+        memcpy(e->src, prefix, sizeof(prefix));
+        e->bits = (unsigned char)bits;
+        e->used = 1;
+        nat->count++;
+    }
+    if (host)
+        memcpy(e->dst, dst, sizeof(e->dst));
+    else
+        ip_nat_mask(dst, bits, e->dst);
+    e->host = (unsigned char)host;
+    nat->lengths[bits / 64] |= 1ULL << bits % 64;
+    return 1;
+}
+
+int ip_nat_add(ip_nat *nat, const unsigned char *src, unsigned int bits, const unsigned char *dst) {
+    return ip_nat_put(nat, src, bits, dst, 0);
+}
+
+int ip_nat_add_host(ip_nat *nat, const unsigned char *src, unsigned int bits, const unsigned char *dst) {
+    return ip_nat_put(nat, src, bits, dst, 1);
+}
+
+int ip_nat_lookup(const ip_nat *nat, const unsigned char *addr, unsigned char *out) {
+    unsigned char prefix[IP_NAT_ADDR_LEN];
+    const ip_nat_entry *e;
+    unsigned int bits, j;
+    uint64_t left;
+    int w;
+
+    /* Walk the prefix lengths in use, longest first */
+    for (w = IP_NAT_MAX_BITS / 64; w >= 0; w--) {
+        for (left = nat->lengths[w]; left; left &= ~(1ULL << bits % 64)) {
+            bits = w * 64 + 63 - __builtin_clzll(left);
+            ip_nat_mask(addr, bits, prefix);
+            e = ip_nat_slot(nat->slots, nat->size, prefix, bits);
+            if (!e->used)
+                continue;
+            /* The pool's network bits, the client's host bits */
+            for (j = 0; j < IP_NAT_ADDR_LEN; j++)
+                out[j] = e->host ? e->dst[j] : e->dst[j] | (addr[j] ^ prefix[j]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void ip_nat_free(ip_nat *nat) {
+    free(nat->slots);
+    memset(nat, 0, sizeof(*nat));
+}
@@ -0,0 +1,103 @@
+/*
+ * ip_nat.h - Client address translation table for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SMF_SPF_IP_NAT_H
+#define SMF_SPF_IP_NAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Addresses are 16 bytes in network byte order, IPv4 ones mapped
+ * into ::ffff:0:0/96 with the prefix length counted from bit 0 of
+ * the IPv6 form (a /24 IPv4 pool is a /120) */
+#define IP_NAT_ADDR_LEN		16
+#define IP_NAT_MAX_BITS		128
+
+typedef struct ip_nat_entry {
+    unsigned char src[IP_NAT_ADDR_LEN];
+    unsigned char dst[IP_NAT_ADDR_LEN];
+    unsigned char bits;
+    unsigned char used;
+    /* dst is one address for the whole source prefix */
+    unsigned char host;
+} ip_nat_entry;
+
+/**
+ * @brief Prefix to prefix translation table
+ *
+ * Entries are hashed on their source prefix and length, so a single
+ * address mapping costs one probe and a pool costs one probe per
+ * distinct prefix length in the table, tried longest first. A zeroed
+ * struct is an empty table.
+ */
+typedef struct ip_nat {
+    ip_nat_entry *slots;
+    size_t size;
+    size_t count;
+    /* Bit n set when some mapping has prefix length n */
+    uint64_t lengths[IP_NAT_MAX_BITS / 64 + 1];
+} ip_nat;
+
+/**
+ * @brief Map a source prefix onto a destination prefix
+ *
+ * The host bits of a translated address are kept, so 10.0.0.0/24 to
+ * 192.0.2.0/24 sends 10.0.0.7 to 192.0.2.7. A mapping for the same
+ * source prefix replaces the earlier one.
+ *
+ * @param nat Table to add to
+ * @param src Source network address
+ * @param bits Prefix length of both sides (0-128)
+ * @param dst Destination network address
+ * @return 1 on success, 0 on allocation failure
+ */
+int ip_nat_add(ip_nat *nat, const unsigned char *src, unsigned int bits, const unsigned char *dst);
+
+/**
+ * @brief Map every address of a source prefix onto one address
+ *
+ * 10.0.0.0/24 to 192.0.2.5 sends all of 10.0.0.0/24 to 192.0.2.5,
+ * for clients that all reach the outside through one relay. Replaces
+ * any earlier mapping of the same source prefix, like ip_nat_add().
+ *
+ * @param nat Table to add to
+ * @param src Source network address
+ * @param bits Prefix length of the source (0-128)
+ * @param dst Destination address, used as is
+ * @return 1 on success, 0 on allocation failure
+ */
+int ip_nat_add_host(ip_nat *nat, const unsigned char *src, unsigned int bits, const unsigned char *dst);
+
+/**
+ * @brief Translate an address with the most specific mapping
+ *
+ * Thread safe as long as nobody modifies the table.
+ *
+ * @param nat Table to search
+ * @param addr Address to translate
+ * @param out Receives the translated address
+ * @return 1 if a mapping applied, 0 otherwise (out is untouched)
+ */
+int ip_nat_lookup(const ip_nat *nat, const unsigned char *addr, unsigned char *out);
+
+/**
+ * @brief Free the table, leaving it empty
+ *
+ * @param nat Table to clear
+ */
+void ip_nat_free(ip_nat *nat);
+
+#endif /* SMF_SPF_IP_NAT_H */
@@ -0,0 +1,108 @@
+/*
+ * name_trie.c - Host name suffix trie for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Nodes sit in one array linked by index, each with its first child
+ * and next sibling. Host names only use letters, digits, '-' and '.',
+ * so no sibling list is longer than 38 and most are a few nodes.
+ */
+
+#include "name_trie.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NAME_TRIE_MIN_NODES	64
+
+name_trie *name_trie_new(void) {
+    name_trie *trie = calloc(1, sizeof(*trie));
+
+    if (trie && !(trie->nodes = calloc(NAME_TRIE_MIN_NODES, sizeof(*trie->nodes)))) {
+        free(trie);
+        return NULL;
+    }
+    if (trie) {
+        trie->count = 1;
+        trie->size = NAME_TRIE_MIN_NODES;
+    }
+    return trie;
+}
+
+static uint32_t name_trie_child(const name_trie *trie, uint32_t node, unsigned char c) {
+    uint32_t it;
+
+    for (it = trie->nodes[node].child; it; it = trie->nodes[it].sibling)
+        if (trie->nodes[it].c == c)
+            return it;
+    return 0;
+}
+
+int name_trie_add(name_trie *trie, const char *suffix) {
+    size_t i = strlen(suffix);
+    uint32_t node = 0, next;
+    unsigned char c;
+
+    while (i > 0) {
+        c = (unsigned char)tolower((unsigned char)suffix[--i]);
+        if (!(next = name_trie_child(trie, node, c))) {
+            if (trie->count == trie->size) {
+                name_trie_node *nodes = realloc(trie->nodes, trie->size * 2 * sizeof(*nodes));
+
+                if (!nodes)
+                    return 0;
+                trie->nodes = nodes;
+                trie->size *= 2;
+            }
+            next = (uint32_t)trie->count++;
+            memset(&trie->nodes[next], 0, sizeof(trie->nodes[next]));
+            trie->nodes[next].c = c;
+            trie->nodes[next].sibling = trie->nodes[node].child;
+            trie->nodes[node].child = next;
+        }
+        node = next;
+    }
+    trie->nodes[node].terminal = 1;
+    return 1;
+}
+
+int name_trie_match(const name_trie *trie, const char *name, int labels) {
+    size_t i = strlen(name);
+    uint32_t node = 0;
+    unsigned char c;
+
+    if (!trie)
+        return 0;
+    if (labels && i > 0 && name[i - 1] == '.')
+        i--;
+    if (trie->nodes[0].terminal)
+        return 1;
+    while (i > 0) {
+        c = (unsigned char)tolower((unsigned char)name[--i]);
+        if (!(node = name_trie_child(trie, node, c)))
+            return 0;
+        /* An entry starting with a dot carries its own boundary */
+        if (trie->nodes[node].terminal && (!labels || c == '.' || i == 0 || name[i - 1] == '.'))
+            return 1;
+    }
+    return 0;
+}
+
+void name_trie_free(name_trie *trie) {
+    if (!trie)
+        return;
+    free(trie->nodes);
+    free(trie);
+}
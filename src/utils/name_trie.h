@@ -0,0 +1,85 @@
+/*
+ * name_trie.h - Host name suffix trie for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SMF_SPF_NAME_TRIE_H
+#define SMF_SPF_NAME_TRIE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct name_trie_node {
+    /* Indexes into the node array, 0 (the root) means none */
+    uint32_t child;
+    uint32_t sibling;
+    unsigned char c;
+    unsigned char terminal;
+} name_trie_node;
+
+/**
+ * @brief Set of name suffixes, stored back to front
+ *
+ * Names are inserted lowercased and reversed, so "example.com" is the
+ * path m-o-c-.-e-l-p-m-a-x-e from the root and the top level label
+ * comes first. Every suffix of a name that is in the set lies on the
+ * single path its reversal walks, so one backward pass over a name
+ * answers a lookup whatever the number of entries.
+ */
+typedef struct name_trie {
+    name_trie_node *nodes;
+    size_t count;
+    size_t size;
+} name_trie;
+
+/**
+ * @brief Allocate an empty trie
+ *
+ * @return The trie, or NULL on allocation failure
+ */
+name_trie *name_trie_new(void);
+
+/**
+ * @brief Add a suffix, compared case insensitively
+ *
+ * @param trie Trie to add to
+ * @param suffix Name suffix (e.g. ".example.com" or "example.com")
+ * @return 1 on success, 0 on allocation failure
+ */
+int name_trie_add(name_trie *trie, const char *suffix);
+
+/**
+ * @brief Check whether a name ends with a suffix of the trie
+ *
+ * With labels set a suffix only matches whole labels, so "example.com"
+ * matches "example.com" and "mx.example.com" but not "badexample.com",
+ * and a trailing root dot on the name is ignored. Without it any
+ * trailing substring matches. Thread safe as long as nobody modifies
+ * the trie.
+ *
+ * @param trie Trie to search, NULL is an empty trie
+ * @param name Host name to check
+ * @param labels Whether matches must start at a label boundary
+ * @return 1 if the name matches, 0 otherwise
+ */
+int name_trie_match(const name_trie *trie, const char *name, int labels);
+
+/**
+ * @brief Free a trie
+ *
+ * @param trie Trie to free, NULL is ignored
+ */
+void name_trie_free(name_trie *trie);
+
+#endif /* SMF_SPF_NAME_TRIE_H */
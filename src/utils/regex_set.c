@@ -0,0 +1,788 @@
+/*
+ * regex_set.c - Regular expression set matcher for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * A pattern is parsed into a small syntax tree, then compiled back to
+ * front into NFA states: each node is emitted knowing the state that
+ * follows it, which makes loops and {m,n} copies straightforward.
+ * Patterns are joined by split states, so the set is one NFA.
+ *
+ * The subset construction runs over byte classes, bytes that no
+ * character set tells apart, and folds upper case onto lower case in
+ * the class map so lookups need no case conversion. Unanchored search
+ * is built in: every DFA state also contains the NFA entry. ^ is only
+ * followed from the initial state, and $ is resolved when the subject
+ * ends, from a second accept mask per state.
+ */
+
+#include "regex_set.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RE_NONE			UINT32_MAX
+#define RE_MIN_STATES		64
+/* Beyond these the DFA is dropped and lookups simulate the NFA */
+#define RE_MAX_DFA_STATES	16384
+#define RE_MAX_DFA_CELLS	(4UL << 20)
+#define RE_MAX_NFA_STATES	(1UL << 20)
+
+enum { RE_CHAR, RE_SPLIT, RE_BOL, RE_EOL, RE_MATCH };
+
+/* Closure flags: assertions that hold at the current position */
+#define RE_AT_BOL	1
+#define RE_AT_EOL	2
+
+/* Syntax tree */
+enum { RN_SET, RN_EMPTY, RN_BOL, RN_EOL, RN_CAT, RN_ALT, RN_REPEAT };
+
+typedef struct re_node {
+    int type;
+    int left;
+    int right;
+    int min;
+    /* -1 for no upper bound */
+    int max;
+    uint32_t set;
+} re_node;
+
+typedef struct re_parser {
+    const unsigned char *p;
+    re_node *nodes;
+    int count;
+    int size;
+    regex_set *set;
+    int error;
+} re_parser;
+
+/* Scratch space of a closure computation */
+typedef struct re_work {
+    uint32_t *mark;
+    uint32_t gen;
+    uint32_t *stack;
+} re_work;
+
+static unsigned char re_fold(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+static int re_set_has(const uint32_t *bits, unsigned char c) {
+    return bits[c >> 5] >> (c & 31) & 1;
+}
+
+/* Make room for one more element of an array doubling as it grows */
+static int re_grow(void **array, size_t *size, size_t count, size_t elem) {
+    size_t grown = *size ? *size * 2 : RE_MIN_STATES;
+    void *p;
+
+    if (count < *size)
+        return 1;
+    if (!(p = realloc(*array, grown * elem)))
+        return 0;
+    *array = p;
+    *size = grown;
+    return 1;
+}
+
+static uint32_t re_state_new(regex_set *set, int type, uint32_t out, uint32_t out1, uint32_t arg) {
+    re_state *s;
+
+    if (set->count >= RE_MAX_NFA_STATES ||
+        !re_grow((void **)&set->states, &set->size, set->count, sizeof(*set->states)))
+        return RE_NONE;
+    s = &set->states[set->count];
+    s->type = (unsigned char)type;
+    s->out = out;
+    s->out1 = out1;
+    s->arg = arg;
+    return (uint32_t)set->count++;
+}
+
+/* Parser */
+
+static int re_node_new(re_parser *ps, int type, int left, int right) {
+    re_node *n;
+
+    if (ps->count >= ps->size) {
+        int size = ps->size ? ps->size * 2 : 32;
+        re_node *nodes = realloc(ps->nodes, size * sizeof(*nodes));
+
+        if (!nodes) {
+            ps->error = 1;
+            return -1;
+        }
+        ps->nodes = nodes;
+        ps->size = size;
+    }
+    n = &ps->nodes[ps->count];
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    n->left = left;
+    n->right = right;
+    return ps->count++;
+}
+
+/* A set node from a 256 bit map, folded to lower case and maybe negated */
+static int re_node_set(re_parser *ps, uint32_t *bits, int negate) {
+    regex_set *set = ps->set;
+    int c, n;
+
+    for (c = 'A'; c <= 'Z'; c++)
+        if (re_set_has(bits, c))
+            bits[re_fold(c) >> 5] |= 1U << (re_fold(c) & 31);
+    if (negate)
+        for (c = 0; c < 8; c++)
+            bits[c] = ~bits[c];
+    /* The subject never contains NUL */
+    bits[0] &= ~1U;
+    if (!re_grow((void **)&set->sets, &set->set_size, set->set_count, sizeof(*set->sets))) {
+        ps->error = 1;
+        return -1;
+    }
+    memcpy(set->sets[set->set_count], bits, sizeof(set->sets[0]));
+    if ((n = re_node_new(ps, RN_SET, -1, -1)) >= 0)
+        ps->nodes[n].set = (uint32_t)set->set_count++;
+    return n;
+}
+
+static void re_bits_add(uint32_t *bits, int c) {
+    bits[c >> 5] |= 1U << (c & 31);
+}
+
+static int re_class_add(uint32_t *bits, const char *name, size_t len) {
+    static const struct {
+        const char *name;
+        int (*is)(int);
+    } classes[] = {
+        { "alpha", isalpha }, { "digit", isdigit }, { "alnum", isalnum }, { "upper", isupper },
+        { "lower", islower }, { "space", isspace }, { "blank", isblank }, { "punct", ispunct },
+        { "print", isprint }, { "graph", isgraph }, { "cntrl", iscntrl }, { "xdigit", isxdigit }
+    };
+    size_t i;
+    int c;
+
+    for (i = 0; i < sizeof(classes) / sizeof(classes[0]); i++)
+        if (strlen(classes[i].name) == len && !memcmp(classes[i].name, name, len)) {
+            for (c = 1; c < 256; c++)
+                if (classes[i].is(c))
+                    re_bits_add(bits, c);
+            return 1;
+        }
+    return 0;
+}
+
+/* After the opening bracket */
+static int re_parse_bracket(re_parser *ps) {
+    uint32_t bits[8] = { 0 };
+    int negate = 0, first = 1, c, last;
+
+    if (*ps->p == '^') {
+        negate = 1;
+        ps->p++;
+    }
+    while (*ps->p && (first || *ps->p != ']')) {
+        first = 0;
+        if (ps->p[0] == '[' && ps->p[1] == ':') {
+            const char *name = (const char *)ps->p + 2, *end = strstr(name, ":]");
+
+            if (!end || !re_class_add(bits, name, end - name)) {
+                ps->error = 1;
+                return -1;
+            }
+            ps->p = (const unsigned char *)end + 2;
+            continue;
+        }
+        /* Collating elements and equivalence classes are not supported */
+        if (ps->p[0] == '[' && (ps->p[1] == '.' || ps->p[1] == '=')) {
+            ps->error = 1;
+            return -1;
+        }
+        c = *ps->p++;
+        if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']') {
+            last = ps->p[1];
+            ps->p += 2;
+            if (last < c) {
+                ps->error = 1;
+                return -1;
+            }
+            for (; c <= last; c++)
+                re_bits_add(bits, c);
+        } else
+            re_bits_add(bits, c);
+    }
+    if (*ps->p != ']') {
+        ps->error = 1;
+        return -1;
+    }
+    ps->p++;
+    return re_node_set(ps, bits, negate);
+}
+
+static int re_parse_alt(re_parser *ps, int depth);
+
+static int re_parse_atom(re_parser *ps, int depth) {
+    uint32_t bits[8] = { 0 };
+    int c = *ps->p++, n;
+
+    switch (c) {
+    case '(':
+        n = re_parse_alt(ps, depth + 1);
+        if (ps->error || *ps->p != ')') {
+            ps->error = 1;
+            return -1;
+        }
+        ps->p++;
+        return n;
+    case '[':
+        return re_parse_bracket(ps);
+    case '.':
+        memset(bits, 0xff, sizeof(bits));
+        return re_node_set(ps, bits, 0);
+    case '^':
+        return re_node_new(ps, RN_BOL, -1, -1);
+    case '$':
+        return re_node_new(ps, RN_EOL, -1, -1);
+    case '\\':
+        if (!(c = *ps->p++)) {
+            ps->error = 1;
+            return -1;
+        }
+        /* GNU word and space shorthands */
+        if (c == 'w' || c == 'W') {
+            re_class_add(bits, "alnum", 5);
+            re_bits_add(bits, '_');
+            return re_node_set(ps, bits, c == 'W');
+        }
+        if (c == 's' || c == 'S') {
+            re_class_add(bits, "space", 5);
+            return re_node_set(ps, bits, c == 'S');
+        }
+        break;
+    case '*': case '+': case '?': case ')': case '|':
+        ps->error = 1;
+        return -1;
+    }
+    re_bits_add(bits, c);
+    return re_node_set(ps, bits, 0);
+}
+
+static int re_parse_number(re_parser *ps) {
+    int n = 0;
+
+    if (!isdigit(*ps->p))
+        return -1;
+    while (isdigit(*ps->p) && n <= REGEX_SET_DUP_MAX)
+        n = n * 10 + (*ps->p++ - '0');
+    return n > REGEX_SET_DUP_MAX ? -1 : n;
+}
+
+static int re_parse_repeat(re_parser *ps, int depth) {
+    int anchor = *ps->p == '^' || *ps->p == '$';
+    int n = re_parse_atom(ps, depth), r, min, max;
+
+    /* Like regcomp(), a bare anchor takes no repetition */
+    if (anchor &&
+        (*ps->p == '*' || *ps->p == '+' || *ps->p == '?' || (*ps->p == '{' && isdigit(ps->p[1])))) {
+        ps->error = 1;
+        return -1;
+    }
+    while (!ps->error && (*ps->p == '*' || *ps->p == '+' || *ps->p == '?' ||
+                          (*ps->p == '{' && isdigit(ps->p[1])))) {
+        if (*ps->p == '{') {
+            ps->p++;
+            min = max = re_parse_number(ps);
+            if (*ps->p == ',') {
+                ps->p++;
+                max = *ps->p == '}' ? -1 : re_parse_number(ps);
+                if (max < 0 && *ps->p != '}')
+                    ps->error = 1;
+            }
+            if (min < 0 || *ps->p != '}' || (max >= 0 && max < min)) {
+                ps->error = 1;
+                return -1;
+            }
+        } else {
+            min = *ps->p == '+';
+            max = *ps->p == '?' ? 1 : -1;
+        }
+        ps->p++;
+        if ((r = re_node_new(ps, RN_REPEAT, n, -1)) < 0)
+            return -1;
+        ps->nodes[r].min = min;
+        ps->nodes[r].max = max;
+        n = r;
+    }
+    return n;
+}
+
+static int re_parse_cat(re_parser *ps, int depth) {
+    int n = -1, r;
+
+    while (!ps->error && *ps->p && *ps->p != '|' && *ps->p != ')') {
+        r = re_parse_repeat(ps, depth);
+        n = n < 0 ? r : re_node_new(ps, RN_CAT, n, r);
+    }
+    return n < 0 && !ps->error ? re_node_new(ps, RN_EMPTY, -1, -1) : n;
+}
+
+static int re_parse_alt(re_parser *ps, int depth) {
+    int n;
+
+    if (depth > 64) {
+        ps->error = 1;
+        return -1;
+    }
+    n = re_parse_cat(ps, depth);
+    while (!ps->error && *ps->p == '|') {
+        ps->p++;
+        n = re_node_new(ps, RN_ALT, n, re_parse_cat(ps, depth));
+    }
+    return n;
+}
+
+/* Compiler: emit node n so that it continues into state next */
+static uint32_t re_emit(regex_set *set, const re_node *nodes, int n, uint32_t next) {
+    const re_node *node = &nodes[n];
+    uint32_t s, tail;
+    int i;
+
+    if (next == RE_NONE)
+        return RE_NONE;
+    switch (node->type) {
+    case RN_SET:
+        return re_state_new(set, RE_CHAR, next, RE_NONE, node->set);
+    case RN_EMPTY:
+        return next;
+    case RN_BOL:
+        return re_state_new(set, RE_BOL, next, RE_NONE, 0);
+    case RN_EOL:
+        return re_state_new(set, RE_EOL, next, RE_NONE, 0);
+    case RN_CAT:
+        return re_emit(set, nodes, node->left, re_emit(set, nodes, node->right, next));
+    case RN_ALT:
+        s = re_emit(set, nodes, node->left, next);
+        tail = re_emit(set, nodes, node->right, next);
+        return s == RE_NONE || tail == RE_NONE ? RE_NONE : re_state_new(set, RE_SPLIT, s, tail, 0);
+    }
+
+    /* RN_REPEAT: the optional part first, then min mandatory copies */
+    if (node->max < 0) {
+        if ((s = re_state_new(set, RE_SPLIT, RE_NONE, next, 0)) == RE_NONE)
+            return RE_NONE;
+        tail = re_emit(set, nodes, node->left, s);
+        set->states[s].out = tail;
+        if (tail == RE_NONE)
+            return RE_NONE;
+        tail = s;
+    } else {
+        tail = next;
+        for (i = node->min; i < node->max && tail != RE_NONE; i++) {
+            s = re_emit(set, nodes, node->left, tail);
+            tail = s == RE_NONE ? RE_NONE : re_state_new(set, RE_SPLIT, s, next, 0);
+        }
+    }
+    for (i = 0; i < node->min && tail != RE_NONE; i++)
+        tail = re_emit(set, nodes, node->left, tail);
+    return tail;
+}
+
+regex_set *regex_set_new(void) {
+    regex_set *set = calloc(1, sizeof(*set));
+
+    if (set)
+        set->start = RE_NONE;
+    return set;
+}
+
+int regex_set_add(regex_set *set, const char *pattern, unsigned int tag) {
+    re_parser ps;
+    size_t count = set->count, set_count = set->set_count;
+    uint32_t s = RE_NONE;
+    int root;
+
+    memset(&ps, 0, sizeof(ps));
+    ps.p = (const unsigned char *)pattern;
+    ps.set = set;
+    root = re_parse_alt(&ps, 0);
+    if (!ps.error && *ps.p)
+        ps.error = 1;
+    if (!ps.error && root >= 0 &&
+        (s = re_state_new(set, RE_MATCH, RE_NONE, RE_NONE, tag & 0xff)) != RE_NONE &&
+        (s = re_emit(set, ps.nodes, root, s)) != RE_NONE)
+        s = re_state_new(set, RE_SPLIT, s, set->start, 0);
+    free(ps.nodes);
+    if (s == RE_NONE) {
+        /* Forget whatever this pattern left behind */
+        set->count = count;
+        set->set_count = set_count;
+        return 0;
+    }
+    set->start = s;
+    set->tags |= tag & 0xff;
+    return 1;
+}
+
+/* Closure */
+
+/* Add the states reachable from s without reading a byte to list */
+static void re_closure(const regex_set *set, uint32_t s, int flags, uint32_t *list, size_t *len, re_work *w) {
+    const re_state *st;
+    size_t top = 0;
+
+    if (s == RE_NONE || w->mark[s] == w->gen)
+        return;
+    w->mark[s] = w->gen;
+    w->stack[top++] = s;
+    while (top) {
+        st = &set->states[s = w->stack[--top]];
+        switch (st->type) {
+        case RE_SPLIT:
+            if (st->out1 != RE_NONE && w->mark[st->out1] != w->gen) {
+                w->mark[st->out1] = w->gen;
+                w->stack[top++] = st->out1;
+            }
+            /* fall through */
+        case RE_BOL:
+        case RE_EOL:
+            if (st->type == RE_BOL && !(flags & RE_AT_BOL))
+                break;
+            if (st->type == RE_EOL && !(flags & RE_AT_EOL)) {
+                /* Kept until we know whether the subject ends here */
+                list[(*len)++] = s;
+                break;
+            }
+            if (st->out != RE_NONE && w->mark[st->out] != w->gen) {
+                w->mark[st->out] = w->gen;
+                w->stack[top++] = st->out;
+            }
+            break;
+        default:
+            list[(*len)++] = s;
+        }
+    }
+}
+
+/* Tags of the matches in list, and of those reached at the end of the subject */
+static unsigned char re_accept(const regex_set *set, const uint32_t *list, size_t len, int flags,
+                               unsigned char *eol, uint32_t *tmp, re_work *w) {
+    unsigned char accept = 0;
+    size_t i, n = 0;
+
+    for (i = 0; i < len; i++)
+        if (set->states[list[i]].type == RE_MATCH)
+            accept |= set->states[list[i]].arg;
+    if (eol) {
+        w->gen++;
+        for (i = 0; i < len; i++)
+            if (set->states[list[i]].type == RE_EOL)
+                re_closure(set, set->states[list[i]].out, flags | RE_AT_EOL, tmp, &n, w);
+        *eol = accept;
+        for (i = 0; i < n; i++)
+            if (set->states[tmp[i]].type == RE_MATCH)
+                *eol |= set->states[tmp[i]].arg;
+    }
+    return accept;
+}
+
+/* Subset construction */
+
+typedef struct re_dfa {
+    uint32_t *pool;
+    size_t pool_len;
+    size_t pool_size;
+    size_t *off;
+    uint32_t *len;
+    size_t size;
+    uint32_t *slots;
+    size_t slot_count;
+} re_dfa;
+
+static int re_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static size_t re_list_hash(const uint32_t *list, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        h = (h ^ list[i]) * 1099511628211ULL;
+    return (size_t)(h ^ h >> 32);
+}
+
+static int re_dfa_rehash(regex_set *set, re_dfa *d) {
+    size_t count = d->slot_count ? d->slot_count * 2 : 1024, i, j;
+    uint32_t *slots = calloc(count, sizeof(*slots));
+
+    if (!slots)
+        return 0;
+    /* State 0 is the initial one, only ever reached at the start */
+    for (i = 1; i < set->dfa_count; i++) {
+        j = re_list_hash(d->pool + d->off[i], d->len[i]) & (count - 1);
+        while (slots[j])
+            j = (j + 1) & (count - 1);
+        slots[j] = (uint32_t)i;
+    }
+    free(d->slots);
+    d->slots = slots;
+    d->slot_count = count;
+    return 1;
+}
+
+/* Find or add the state for a sorted list, RE_NONE past the limits */
+static uint32_t re_dfa_state(regex_set *set, re_dfa *d, const uint32_t *list, size_t len,
+                             int initial, uint32_t *tmp, re_work *w) {
+    size_t j = 0, id = set->dfa_count;
+    void *p;
+
+    if (!initial) {
+        j = re_list_hash(list, len) & (d->slot_count - 1);
+        for (; d->slots[j]; j = (j + 1) & (d->slot_count - 1))
+            if (d->len[d->slots[j]] == len && !memcmp(d->pool + d->off[d->slots[j]], list, len * sizeof(*list)))
+                return d->slots[j];
+    }
+    if (id >= RE_MAX_DFA_STATES || (id + 1) * set->classes > RE_MAX_DFA_CELLS)
+        return RE_NONE;
+
+    if (id >= d->size) {
+        size_t size = d->size ? d->size * 2 : 64;
+
+        if (!(p = realloc(d->off, size * sizeof(*d->off))))
+            return RE_NONE;
+        d->off = p;
+        if (!(p = realloc(d->len, size * sizeof(*d->len))))
+            return RE_NONE;
+        d->len = p;
+        if (!(p = realloc(set->accept, size)))
+            return RE_NONE;
+        set->accept = p;
+        if (!(p = realloc(set->accept_eol, size)))
+            return RE_NONE;
+        set->accept_eol = p;
+        if (!(p = realloc(set->table, size * set->classes * sizeof(*set->table))))
+            return RE_NONE;
+        set->table = p;
+        d->size = size;
+    }
+    while (d->pool_len + len > d->pool_size) {
+        size_t size = d->pool_size ? d->pool_size * 2 : 4096;
+
+        if (!(p = realloc(d->pool, size * sizeof(*d->pool))))
+            return RE_NONE;
+        d->pool = p;
+        d->pool_size = size;
+    }
+    memcpy(d->pool + d->pool_len, list, len * sizeof(*list));
+    d->off[id] = d->pool_len;
+    d->len[id] = (uint32_t)len;
+    d->pool_len += len;
+    set->accept[id] = re_accept(set, list, len, initial ? RE_AT_BOL : 0, &set->accept_eol[id], tmp, w);
+    set->dfa_count++;
+
+    if (!initial) {
+        d->slots[j] = (uint32_t)id;
+        if (set->dfa_count * 2 > d->slot_count && !re_dfa_rehash(set, d))
+            return RE_NONE;
+    }
+    return (uint32_t)id;
+}
+
+static void re_classes(regex_set *set, unsigned char *rep) {
+    /* Indexed by old class, times two plus membership */
+    uint16_t map[512];
+    size_t i;
+    unsigned int c, classes = 1;
+
+    memset(set->byte_class, 0, sizeof(set->byte_class));
+    /* Split the classes by membership of each set in turn */
+    for (i = 0; i < set->set_count; i++) {
+        memset(map, 0xff, sizeof(map));
+        for (c = 0, classes = 0; c < 256; c++) {
+            unsigned int key = set->byte_class[c] * 2 + re_set_has(set->sets[i], (unsigned char)c);
+
+            if (map[key] == 0xffff)
+                map[key] = (uint16_t)classes++;
+            set->byte_class[c] = map[key];
+        }
+    }
+    /* Renumber by first byte, leaving upper case to share lower case classes */
+    memset(map, 0xff, sizeof(map));
+    for (c = 0, classes = 0; c < 256; c++) {
+        if (c >= 'A' && c <= 'Z')
+            continue;
+        if (map[set->byte_class[c]] == 0xffff) {
+            rep[classes] = (unsigned char)c;
+            map[set->byte_class[c]] = (uint16_t)classes++;
+        }
+        set->byte_class[c] = map[set->byte_class[c]];
+    }
+    for (c = 'A'; c <= 'Z'; c++)
+        set->byte_class[c] = set->byte_class[re_fold((unsigned char)c)];
+    set->classes = classes;
+}
+
+static void re_dfa_drop(regex_set *set) {
+    free(set->table);
+    free(set->accept);
+    free(set->accept_eol);
+    set->table = NULL;
+    set->accept = set->accept_eol = NULL;
+    set->dfa_count = 0;
+}
+
+int regex_set_build(regex_set *set) {
+    unsigned char rep[256];
+    uint32_t *list = NULL, *tmp = NULL, next;
+    size_t len, i, k, id;
+    re_work w;
+    re_dfa d;
+    int ok = 0, scratch = 0;
+
+    re_dfa_drop(set);
+    if (set->start == RE_NONE)
+        return 1;
+    memset(&d, 0, sizeof(d));
+    memset(&w, 0, sizeof(w));
+    re_classes(set, rep);
+    if (!(w.mark = calloc(set->count, sizeof(*w.mark))) || !(w.stack = malloc(set->count * sizeof(*w.stack))) ||
+        !(list = malloc(set->count * sizeof(*list))) || !(tmp = malloc(set->count * sizeof(*tmp))) ||
+        !re_dfa_rehash(set, &d))
+        goto done;
+    scratch = 1;
+
+    w.gen++;
+    len = 0;
+    re_closure(set, set->start, RE_AT_BOL, list, &len, &w);
+    qsort(list, len, sizeof(*list), re_cmp);
+    if (re_dfa_state(set, &d, list, len, 1, tmp, &w) == RE_NONE)
+        goto done;
+
+    for (id = 0; id < set->dfa_count; id++) {
+        for (k = 0; k < set->classes; k++) {
+            w.gen++;
+            len = 0;
+            for (i = 0; i < d.len[id]; i++) {
+                const re_state *st = &set->states[d.pool[d.off[id] + i]];
+
+                if (st->type == RE_CHAR && re_set_has(set->sets[st->arg], rep[k]))
+                    re_closure(set, st->out, 0, list, &len, &w);
+            }
+            re_closure(set, set->start, 0, list, &len, &w);
+            qsort(list, len, sizeof(*list), re_cmp);
+            if ((next = re_dfa_state(set, &d, list, len, 0, tmp, &w)) == RE_NONE)
+                goto done;
+            set->table[id * set->classes + k] = next;
+        }
+    }
+    ok = 1;
+
+done:
+    /* Too large or out of memory: lookups simulate the NFA */
+    if (!ok)
+        re_dfa_drop(set);
+    free(d.pool);
+    free(d.off);
+    free(d.len);
+    free(d.slots);
+    free(w.mark);
+    free(w.stack);
+    free(list);
+    free(tmp);
+    return scratch;
+}
+
+/* Lookup without a DFA: carry the set of live NFA states along */
+static int re_simulate(const regex_set *set, const unsigned char *p, unsigned int tags) {
+    const unsigned char *begin = p;
+    uint32_t *cur, *next, *tmp, *swap;
+    size_t ncur = 0, nnext, i;
+    unsigned char eol;
+    re_work w;
+    int found = 0;
+
+    w.gen = 1;
+    w.mark = calloc(set->count, sizeof(*w.mark));
+    w.stack = malloc(set->count * sizeof(*w.stack));
+    cur = malloc(set->count * sizeof(*cur));
+    next = malloc(set->count * sizeof(*next));
+    tmp = malloc(set->count * sizeof(*tmp));
+    if (!w.mark || !w.stack || !cur || !next || !tmp)
+        goto done;
+
+    re_closure(set, set->start, RE_AT_BOL, cur, &ncur, &w);
+    found = re_accept(set, cur, ncur, 0, NULL, NULL, &w) & tags;
+    for (; *p && !found; p++) {
+        unsigned char c = re_fold(*p);
+
+        w.gen++;
+        nnext = 0;
+        for (i = 0; i < ncur; i++) {
+            const re_state *st = &set->states[cur[i]];
+
+            if (st->type == RE_CHAR && re_set_has(set->sets[st->arg], c))
+                re_closure(set, st->out, 0, next, &nnext, &w);
+        }
+        re_closure(set, set->start, 0, next, &nnext, &w);
+        swap = cur;
+        cur = next;
+        next = swap;
+        ncur = nnext;
+        found = re_accept(set, cur, ncur, 0, NULL, NULL, &w) & tags;
+    }
+    if (!found) {
+        re_accept(set, cur, ncur, p == begin ? RE_AT_BOL : 0, &eol, tmp, &w);
+        found = eol & tags;
+    }
+
+done:
+    free(w.mark);
+    free(w.stack);
+    free(cur);
+    free(next);
+    free(tmp);
+    return found != 0;
+}
+
+int regex_set_match(const regex_set *set, const char *str, unsigned int tags) {
+    const unsigned char *p = (const unsigned char *)str;
+    const uint32_t *table;
+    uint32_t s = 0;
+
+    if (!set || !(set->tags & tags))
+        return 0;
+    if (!set->table)
+        return re_simulate(set, p, tags);
+    table = set->table;
+    if (set->accept[0] & tags)
+        return 1;
+    for (; *p; p++) {
+        s = table[s * set->classes + set->byte_class[*p]];
+        if (set->accept[s] & tags)
+            return 1;
+    }
+    return (set->accept_eol[s] & tags) != 0;
+}
+
+void regex_set_free(regex_set *set) {
+    if (!set)
+        return;
+    free(set->states);
+    free(set->sets);
+    re_dfa_drop(set);
+    free(set);
+}
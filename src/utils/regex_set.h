@@ -0,0 +1,116 @@
+/*
+ * regex_set.h - Regular expression set matcher for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SMF_SPF_REGEX_SET_H
+#define SMF_SPF_REGEX_SET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Largest {m,n} bound, as RE_DUP_MAX */
+#define REGEX_SET_DUP_MAX	255
+
+typedef struct re_state {
+    /* Next states, RE_NONE when unused */
+    uint32_t out;
+    uint32_t out1;
+    /* Character set of a RE_CHAR, tag of a RE_MATCH */
+    uint32_t arg;
+    unsigned char type;
+} re_state;
+
+/**
+ * @brief POSIX extended regular expressions compiled into one automaton
+ *
+ * Every pattern added with regex_set_add() joins a single Thompson NFA,
+ * which regex_set_build() turns into a DFA over byte classes. A lookup
+ * then reads each byte of the subject once, one table step per byte,
+ * however many patterns there are. Should the DFA outgrow its limit,
+ * lookups simulate the NFA instead, still in a single pass.
+ *
+ * Matching is unanchored and case insensitive, like regexec() with
+ * REG_EXTENDED | REG_ICASE | REG_NOSUB. Each pattern carries a tag bit
+ * so patterns for different subjects can share the automaton.
+ */
+typedef struct regex_set {
+    re_state *states;
+    size_t count;
+    size_t size;
+    /* 256 bit character sets of the RE_CHAR states */
+    uint32_t (*sets)[8];
+    size_t set_count;
+    size_t set_size;
+    /* Entry of the NFA, a split into every pattern */
+    uint32_t start;
+    /* Union of the tags added */
+    unsigned int tags;
+    /* Compiled DFA, NULL until built or when it was too large */
+    uint32_t *table;
+    size_t dfa_count;
+    unsigned int classes;
+    unsigned char *accept;
+    unsigned char *accept_eol;
+    uint16_t byte_class[256];
+} regex_set;
+
+/**
+ * @brief Allocate an empty set
+ *
+ * @return The set, or NULL on allocation failure
+ */
+regex_set *regex_set_new(void);
+
+/**
+ * @brief Add a pattern
+ *
+ * The set must be rebuilt before the next lookup.
+ *
+ * @param set Set to add to
+ * @param pattern Extended regular expression
+ * @param tag Tag of the pattern, a single bit of the low byte
+ * @return 1 on success, 0 on a syntax error or allocation failure
+ */
+int regex_set_add(regex_set *set, const char *pattern, unsigned int tag);
+
+/**
+ * @brief Compile the patterns added so far
+ *
+ * @param set Set to compile
+ * @return 1 on success, 0 on allocation failure
+ */
+int regex_set_build(regex_set *set);
+
+/**
+ * @brief Check whether a pattern with one of the tags matches a string
+ *
+ * Thread safe as long as nobody modifies the set. A NULL set matches
+ * nothing.
+ *
+ * @param set Built set
+ * @param str String to search
+ * @param tags Tags of the patterns to consider
+ * @return 1 if some pattern matches, 0 otherwise
+ */
+int regex_set_match(const regex_set *set, const char *str, unsigned int tags);
+
+/**
+ * @brief Free a set, NULL is ignored
+ *
+ * @param set Set to free
+ */
+void regex_set_free(regex_set *set);
+
+#endif /* SMF_SPF_REGEX_SET_H */
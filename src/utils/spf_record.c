@@ -0,0 +1,76 @@
+/*
+ * spf_record.c - SPF record text checks for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "spf_record.h"
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+int spf_record_is_spf1(const char *txt) {
+    return !strncasecmp(txt, "v=spf1", 6) && (!txt[6] || txt[6] == ' ');
+}
+
+/* CIDR length of an ip4/ip6 argument, max when absent, -1 if invalid */
+static int spf_record_cidr(const char *arg, size_t len, int max) {
+    const char *slash = memchr(arg, '/', len);
+    int bits = 0;
+
+    if (!slash)
+        return max;
+    len -= slash + 1 - arg;
+    if (!len || len > 3)
+        return -1;
+    for (arg = slash + 1; len--; arg++) {
+        if (!isdigit((unsigned char)*arg))
+            return -1;
+        bits = bits * 10 + (*arg - '0');
+    }
+    return bits <= max ? bits : -1;
+}
+
+int spf_record_prefix_uniform(const char *txt, int v6, int bits) {
+    const char *p = txt + 6, *term;
+    size_t len;
+    int cidr;
+
+    if (!spf_record_is_spf1(txt))
+        return 0;
+    for (;;) {
+        p += strspn(p, " ");
+        if (!*p)
+            return 1;
+        term = p;
+        len = strcspn(p, " ");
+        p += len;
+        if (strchr("+-~?", *term)) {
+            term++;
+            len--;
+        }
+        if (len == 3 && !strncasecmp(term, "all", 3))
+            continue;
+        if (len > 4 && (!strncasecmp(term, "ip4:", 4) || !strncasecmp(term, "ip6:", 4))) {
+            int ip6 = term[2] == '6';
+
+            if ((cidr = spf_record_cidr(term + 4, len - 4, ip6 ? 128 : 32)) < 0)
+                return 0;
+            if (ip6 == !!v6 && cidr > bits)
+                return 0;
+            continue;
+        }
+        /* a, mx, ptr, exists, include, modifiers and anything unknown */
+        return 0;
+    }
+}
@@ -0,0 +1,45 @@
+/*
+ * spf_record.h - SPF record text checks for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SMF_SPF_SPF_RECORD_H
+#define SMF_SPF_SPF_RECORD_H
+
+/**
+ * @brief Check whether a TXT string is an SPF version 1 record
+ *
+ * @param txt TXT record contents
+ * @return 1 if it starts with "v=spf1" as a whole term, 0 otherwise
+ */
+int spf_record_is_spf1(const char *txt);
+
+/**
+ * @brief Check whether a record gives one result to a whole prefix
+ *
+ * True when the record holds nothing but "all" and ip4/ip6 mechanisms
+ * at least as wide as the prefix, so that every address of the prefix
+ * matches the same mechanisms. A mechanism without a CIDR length is a
+ * single host (/32, /128). Any other mechanism and any modifier, such
+ * as redirect= or exp=, make the result address specific.
+ *
+ * @param txt Record text, starting with "v=spf1"
+ * @param v6 Whether the prefix is IPv6; mechanisms of the other family
+ *           never match and are ignored
+ * @param bits Prefix length
+ * @return 1 if the result is uniform over the prefix, 0 otherwise
+ */
+int spf_record_prefix_uniform(const char *txt, int v6, int bits);
+
+#endif /* SMF_SPF_SPF_RECORD_H */
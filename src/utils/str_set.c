@@ -0,0 +1,173 @@
+/*
+ * str_set.c - Exact string hash set for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "str_set.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define STR_SET_MIN_SLOTS	64
+#define STR_SET_MIN_POOL	1024
+
+/* FNV-1a, folded to 32 bits */
+static uint32_t str_set_hash(const char *str, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        h = (h ^ (unsigned char)str[i]) * 1099511628211ULL;
+    return (uint32_t)(h ^ h >> 32);
+}
+
+static str_set_slot *str_set_slot_find(str_set_slot *slots, size_t size, const char *pool,
+                                       const char *str, size_t len, uint32_t hash) {
+    size_t i = hash & (size - 1);
+
+    while (slots[i].off && (slots[i].hash != hash || slots[i].len != len || memcmp(pool + slots[i].off, str, len)))
+        i = (i + 1) & (size - 1);
+    return &slots[i];
+}
+
+str_set *str_set_new(void) {
+    str_set *set = calloc(1, sizeof(*set));
+
+    if (set && (!(set->slots = calloc(STR_SET_MIN_SLOTS, sizeof(*set->slots))) ||
+                !(set->pool = malloc(STR_SET_MIN_POOL)))) {
+        free(set->slots);
+        free(set);
+        return NULL;
+    }
+    if (set) {
+        set->size = STR_SET_MIN_SLOTS;
+        set->pool_len = 1;
+        set->pool_size = STR_SET_MIN_POOL;
+    }
+    return set;
+}
+
+static int str_set_grow(str_set *set) {
+    size_t size = set->size * 2, i;
+    str_set_slot *slots = calloc(size, sizeof(*slots)), *slot;
+    uint32_t *values = NULL;
+
+    if (!slots || (set->values && !(values = calloc(size, sizeof(*values))))) {
+        free(slots);
+        return 0;
+    }
+    for (i = 0; i < set->size; i++)
+        if (set->slots[i].off) {
+            slot = str_set_slot_find(slots, size, set->pool, set->pool + set->slots[i].off,
+                                     set->slots[i].len, set->slots[i].hash);
+            *slot = set->slots[i];
+            if (values)
+                values[slot - slots] = set->values[i];
+        }
+    free(set->slots);
+    free(set->values);
+    set->slots = slots;
+    set->values = values;
+    set->size = size;
+    return 1;
+}
+
+/* Slot of a string, added if missing, NULL on allocation failure */
+static str_set_slot *str_set_insert(str_set *set, const char *str) {
+    size_t len = strlen(str);
+    uint32_t hash = str_set_hash(str, len);
+    str_set_slot *slot;
+
+    if ((set->count + 1) * 2 > set->size && !str_set_grow(set))
+        return NULL;
+    slot = str_set_slot_find(set->slots, set->size, set->pool, str, len, hash);
+    if (slot->off)
+        return slot;
+    if (set->pool_len + len + 1 > set->pool_size) {
+        size_t pool_size = set->pool_size * 2;
+        char *pool;
+
+        while (set->pool_len + len + 1 > pool_size)
+            pool_size *= 2;
+        if (pool_size > UINT32_MAX || !(pool = realloc(set->pool, pool_size)))
+            return NULL;
+        set->pool = pool;
+        set->pool_size = pool_size;
+    }
+    memcpy(set->pool + set->pool_len, str, len + 1);
+    slot->off = (uint32_t)set->pool_len;
+    set->pool_len += len + 1;
+    slot->hash = hash;
+    slot->len = (uint32_t)len;
+    set->count++;
+    return slot;
+}
+
+int str_set_add(str_set *set, const char *str) {
+    return str_set_insert(set, str) != NULL;
+}
+
+int str_set_put(str_set *set, const char *str, uint32_t value) {
+    str_set_slot *slot;
+
+    if (!set->values && !(set->values = calloc(set->size, sizeof(*set->values))))
+        return 0;
+    if (!(slot = str_set_insert(set, str)))
+        return 0;
+    set->values[slot - set->slots] = value;
+    return 1;
+}
+
+/* Slot of the first len bytes of str, an empty one when absent */
+static const str_set_slot *str_set_lookup(const str_set *set, const char *str, size_t len) {
+    return str_set_slot_find(set->slots, set->size, set->pool, str, len, str_set_hash(str, len));
+}
+
+int str_set_contains(const str_set *set, const char *str, size_t len) {
+    if (!set || !set->count)
+        return 0;
+    return str_set_lookup(set, str, len)->off != 0;
+}
+
+int str_set_contains_domain(const str_set *set, const char *domain) {
+    return str_set_find_domain(set, domain, NULL);
+}
+
+int str_set_find_domain(const str_set *set, const char *domain, uint32_t *value) {
+    const str_set_slot *slot;
+    const char *end, *dot;
+
+    if (!set || !set->count)
+        return 0;
+    end = domain + strlen(domain);
+    while (domain < end) {
+        if ((slot = str_set_lookup(set, domain, end - domain))->off) {
+            if (value)
+                *value = set->values ? set->values[slot - set->slots] : 0;
+            return 1;
+        }
+        if (!(dot = memchr(domain, '.', end - domain)))
+            break;
+        domain = dot + 1;
+    }
+    return 0;
+}
+
+void str_set_free(str_set *set) {
+    if (!set)
+        return;
+    free(set->slots);
+    free(set->values);
+    free(set->pool);
+    free(set);
+}
@@ -0,0 +1,128 @@
+/*
+ * str_set.h - Exact string hash set for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SMF_SPF_STR_SET_H
+#define SMF_SPF_STR_SET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct str_set_slot {
+    /* Offset of the string in the pool, 0 for an empty slot */
+    uint32_t off;
+    uint32_t hash;
+    uint32_t len;
+} str_set_slot;
+
+/**
+ * @brief Set of strings compared byte for byte
+ *
+ * Open addressing with linear probing, kept at most half full. Each
+ * slot carries the full hash and length of its string, so a probe
+ * only compares bytes when both agree.
+ *
+ * The strings live back to back in one pool and slots refer to them
+ * by offset, which saves an allocation per entry and leaves nothing
+ * to relocate when the set is written out and mapped back.
+ *
+ * A set can also map its strings to values, see str_set_put(). They
+ * are kept apart from the slots, so plain sets pay nothing for them.
+ */
+typedef struct str_set {
+    str_set_slot *slots;
+    /* Value of each slot, NULL until str_set_put() is used */
+    uint32_t *values;
+    size_t size;
+    size_t count;
+    /* NUL terminated strings, byte 0 is unused */
+    char *pool;
+    size_t pool_len;
+    size_t pool_size;
+} str_set;
+
+/**
+ * @brief Allocate an empty set
+ *
+ * @return The set, or NULL on allocation failure
+ */
+str_set *str_set_new(void);
+
+/**
+ * @brief Add a copy of a string, duplicates are ignored
+ *
+ * @param set Set to add to
+ * @param str String to add
+ * @return 1 on success, 0 on allocation failure
+ */
+int str_set_add(str_set *set, const char *str);
+
+/**
+ * @brief Add a string with a value, replacing the value of a duplicate
+ *
+ * Strings added with str_set_add() have the value 0.
+ *
+ * @param set Set to add to
+ * @param str String to add
+ * @param value Value of the string
+ * @return 1 on success, 0 on allocation failure
+ */
+int str_set_put(str_set *set, const char *str, uint32_t value);
+
+/**
+ * @brief Check whether the first len bytes of a string are in the set
+ *
+ * Thread safe as long as nobody modifies the set.
+ *
+ * @param set Set to search, NULL is an empty set
+ * @param str String to look up, need not be terminated at len
+ * @param len Number of bytes to look up
+ * @return 1 if present, 0 otherwise
+ */
+int str_set_contains(const str_set *set, const char *str, size_t len);
+
+/**
+ * @brief Check a domain and each of its parents against the set
+ *
+ * "mx.example.com" looks up "mx.example.com", "example.com" and
+ * "com", one probe per label.
+ *
+ * @param set Set of domains, NULL is an empty set
+ * @param domain Domain to look up
+ * @return 1 if the domain or a parent is present, 0 otherwise
+ */
+int str_set_contains_domain(const str_set *set, const char *domain);
+
+/**
+ * @brief Find the value of a domain or of its closest parent in the set
+ *
+ * Walks the labels like str_set_contains_domain() and stops at the
+ * first entry present.
+ *
+ * @param set Set of domains, NULL is an empty set
+ * @param domain Domain to look up
+ * @param value Receives the value of the entry found, may be NULL
+ * @return 1 if the domain or a parent is present, 0 otherwise
+ */
+int str_set_find_domain(const str_set *set, const char *domain, uint32_t *value);
+
+/**
+ * @brief Free a set and its strings
+ *
+ * @param set Set to free, NULL is ignored
+ */
+void str_set_free(str_set *set);
+
+#endif /* SMF_SPF_STR_SET_H */
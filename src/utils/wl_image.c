@@ -0,0 +1,426 @@
+/*
+ * wl_image.c - Precompiled whitelist database for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * The file is a header followed by one section per list, each the
+ * array the in-memory index already uses: merged address ranges, trie
+ * nodes, the automaton table and the string set slots with their pool.
+ * None of them holds a pointer, they refer to each other by index or
+ * offset, so the sections are usable in place at whatever address the
+ * file is mapped. Sections start on 8 byte boundaries.
+ *
+ * Every index and offset is checked once when the file is mapped, so
+ * lookups never leave their section or loop, whatever the file holds.
+ * Tries were built by appending nodes and pushing new children in
+ * front of their siblings: a child always comes after its parent and
+ * a sibling before its left neighbour, which also rules out cycles.
+ */
+
+#include "wl_image.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WL_IMAGE_BYTEORDER	0x01020304
+#define WL_IMAGE_ALIGN		8
+
+enum {
+    WL_SECTION_IP4,
+    WL_SECTION_IP6,
+    WL_SECTION_PTR,
+    WL_SECTION_FROM_AC,
+    WL_SECTION_TO_AC,
+    /* One per str_set, in wl_lists order */
+    WL_SECTION_SETS,
+    WL_SECTIONS = WL_SECTION_SETS + 4
+};
+
+typedef struct wl_image_section {
+    /* From the start of the file */
+    uint64_t offset;
+    uint64_t length;
+    /* Elements: ranges, nodes, table entries or set slots */
+    uint64_t count;
+    /* Automaton byte classes, or set entries */
+    uint32_t param;
+    /* Automaton flags, WL_AC_* */
+    uint32_t flags;
+} wl_image_section;
+
+typedef struct wl_image_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+    int64_t created;
+    uint64_t size;
+    wl_image_section sections[WL_SECTIONS];
+} wl_image_header;
+
+/*
+ * Automaton sections start with the byte class map, then the table,
+ * or for a matcher too large for a table the trie nodes followed by
+ * their failure links
+ */
+#define WL_AC_CLASSES_SIZE	(256 * sizeof(uint16_t))
+#define WL_AC_ROOT_MATCH	1
+#define WL_AC_SPARSE		2
+#define WL_AC_SPARSE_ELEM	(sizeof(ac_node) + sizeof(uint32_t))
+
+static const ac_node wl_ac_root[2] = { { 0, 0, 0, 0 }, { 0, 0, 0, 1 } };
+
+static const str_set *wl_lists_set(const wl_lists *lists, int i) {
+    const str_set *sets[4] = { lists->from_addrs, lists->from_domains, lists->to_addrs, lists->to_domains };
+
+    return sets[i];
+}
+
+/* Lay out one section of length bytes after the previous ones */
+static void wl_image_place(wl_image_header *hdr, int i, uint64_t length, uint64_t count, uint64_t *end) {
+    hdr->sections[i].offset = length ? *end : 0;
+    hdr->sections[i].length = length;
+    hdr->sections[i].count = count;
+    *end += (length + WL_IMAGE_ALIGN - 1) & ~(uint64_t)(WL_IMAGE_ALIGN - 1);
+}
+
+static int wl_image_put(FILE *fp, const void *data, size_t len) {
+    static const char pad[WL_IMAGE_ALIGN];
+
+    if (len && fwrite(data, len, 1, fp) != 1)
+        return 0;
+    if (len % WL_IMAGE_ALIGN && fwrite(pad, WL_IMAGE_ALIGN - len % WL_IMAGE_ALIGN, 1, fp) != 1)
+        return 0;
+    return 1;
+}
+
+long wl_image_write(const char *path, const wl_lists *lists) {
+    const ac_matcher *acs[2] = { lists->from_ac, lists->to_ac };
+    const str_set *set;
+    wl_image_header hdr;
+    char tmppath[PATH_MAX];
+    uint64_t end = sizeof(hdr);
+    FILE *fp;
+    int i, fail = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, WL_IMAGE_MAGIC, sizeof(WL_IMAGE_MAGIC));
+    hdr.version = WL_IMAGE_VERSION;
+    hdr.byteorder = WL_IMAGE_BYTEORDER;
+    hdr.created = (int64_t)time(NULL);
+
+    wl_image_place(&hdr, WL_SECTION_IP4, lists->ips.count * sizeof(ip_range), lists->ips.count, &end);
+    wl_image_place(&hdr, WL_SECTION_IP6, lists->ips.count6 * sizeof(ip_range6), lists->ips.count6, &end);
+    if (lists->ptrs)
+        wl_image_place(&hdr, WL_SECTION_PTR, lists->ptrs->count * sizeof(name_trie_node), lists->ptrs->count, &end);
+    for (i = 0; i < 2; i++)
+        if (acs[i] && acs[i]->table) {
+            wl_image_place(&hdr, WL_SECTION_FROM_AC + i,
+                           WL_AC_CLASSES_SIZE + acs[i]->table_size * sizeof(uint32_t), acs[i]->table_size, &end);
+            hdr.sections[WL_SECTION_FROM_AC + i].param = acs[i]->classes;
+            hdr.sections[WL_SECTION_FROM_AC + i].flags = acs[i]->nodes[0].out ? WL_AC_ROOT_MATCH : 0;
+        } else if (ac_built(acs[i])) {
+            wl_image_place(&hdr, WL_SECTION_FROM_AC + i,
+                           WL_AC_CLASSES_SIZE + acs[i]->count * WL_AC_SPARSE_ELEM, acs[i]->count, &end);
+            hdr.sections[WL_SECTION_FROM_AC + i].param = acs[i]->classes;
+            hdr.sections[WL_SECTION_FROM_AC + i].flags = WL_AC_SPARSE | (acs[i]->nodes[0].out ? WL_AC_ROOT_MATCH : 0);
+        }
+    for (i = 0; i < 4; i++)
+        if ((set = wl_lists_set(lists, i)) && set->count) {
+            wl_image_place(&hdr, WL_SECTION_SETS + i,
+                           set->size * sizeof(str_set_slot) + set->pool_len, set->size, &end);
+            hdr.sections[WL_SECTION_SETS + i].param = (uint32_t)set->count;
+        }
+    hdr.size = end;
+
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+    if (!(fp = fopen(tmppath, "w")))
+        return -1;
+    fail = !wl_image_put(fp, &hdr, sizeof(hdr)) ||
+           !wl_image_put(fp, lists->ips.ranges, lists->ips.count * sizeof(ip_range)) ||
+           !wl_image_put(fp, lists->ips.ranges6, lists->ips.count6 * sizeof(ip_range6)) ||
+           (lists->ptrs && !wl_image_put(fp, lists->ptrs->nodes, lists->ptrs->count * sizeof(name_trie_node)));
+    for (i = 0; i < 2 && !fail; i++)
+        if (acs[i] && acs[i]->table)
+            fail = fwrite(acs[i]->byte_class, WL_AC_CLASSES_SIZE, 1, fp) != 1 ||
+                   !wl_image_put(fp, acs[i]->table, acs[i]->table_size * sizeof(uint32_t));
+        else if (ac_built(acs[i]))
+            fail = fwrite(acs[i]->byte_class, WL_AC_CLASSES_SIZE, 1, fp) != 1 ||
+                   fwrite(acs[i]->nodes, acs[i]->count * sizeof(ac_node), 1, fp) != 1 ||
+                   /* 16 bytes a node, the section needs no padding */
+                   fwrite(acs[i]->fail, acs[i]->count * sizeof(uint32_t), 1, fp) != 1;
+    for (i = 0; i < 4 && !fail; i++)
+        if ((set = wl_lists_set(lists, i)) && set->count)
+            fail = fwrite(set->slots, set->size * sizeof(str_set_slot), 1, fp) != 1 ||
+                   !wl_image_put(fp, set->pool, set->pool_len);
+
+    if (!fail && (fflush(fp) || fsync(fileno(fp))))
+        fail = 1;
+    if (fclose(fp))
+        fail = 1;
+    if (fail || rename(tmppath, path)) {
+        unlink(tmppath);
+        return -1;
+    }
+    return (long)end;
+}
+
+/* Element size of each section, and the bytes before its first element */
+static const size_t wl_section_elem[WL_SECTIONS] = {
+    sizeof(ip_range), sizeof(ip_range6), sizeof(name_trie_node), sizeof(uint32_t), sizeof(uint32_t),
+    sizeof(str_set_slot), sizeof(str_set_slot), sizeof(str_set_slot), sizeof(str_set_slot)
+};
+
+static size_t wl_section_head(int i) {
+    return i == WL_SECTION_FROM_AC || i == WL_SECTION_TO_AC ? WL_AC_CLASSES_SIZE : 0;
+}
+
+/* An empty section, or one inside the file holding count elements */
+static int wl_image_section_ok(const wl_image *img, const wl_image_section *s, int i) {
+    size_t elem = wl_section_elem[i];
+
+    if (!s->length)
+        return 1;
+    if (wl_section_head(i) && (s->flags & WL_AC_SPARSE))
+        elem = WL_AC_SPARSE_ELEM;
+    return !(s->offset % WL_IMAGE_ALIGN) && s->offset <= img->size && s->length <= img->size - s->offset &&
+           s->length >= wl_section_head(i) && s->count && s->count <= (s->length - wl_section_head(i)) / elem;
+}
+
+/* Ranges sorted and disjoint, as the binary search expects */
+static int wl_image_ips_ok(const ip_range *r, size_t count) {
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        if (r[i].first > r[i].last || (i && r[i].first <= r[i - 1].last))
+            return 0;
+    return 1;
+}
+
+static int wl_image_key6_above(const ip_key6 *a, const ip_key6 *b) {
+    return a->hi > b->hi || (a->hi == b->hi && a->lo > b->lo);
+}
+
+static int wl_image_ips6_ok(const ip_range6 *r, size_t count) {
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        if (wl_image_key6_above(&r[i].first, &r[i].last) || (i && !wl_image_key6_above(&r[i].first, &r[i - 1].last)))
+            return 0;
+    return 1;
+}
+
+/* Child and sibling links of a trie, see the top of the file */
+#define WL_TRIE_LINKS_OK(nodes, i, count) \
+    ((!(nodes)[i].child || ((nodes)[i].child > (i) && (nodes)[i].child < (count))) && \
+     (nodes)[i].sibling < ((i) ? (i) : 1))
+
+static int wl_image_trie_ok(const name_trie_node *nodes, size_t count) {
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        if (!WL_TRIE_LINKS_OK(nodes, i, count))
+            return 0;
+    return 1;
+}
+
+/*
+ * Failure links must lead to a shallower node, so the scan falls back
+ * to the root at last
+ */
+static int wl_image_sparse_ok(const ac_node *nodes, const uint32_t *fail, size_t count) {
+    uint32_t *depth, it;
+    size_t i;
+    int ok = 1;
+
+    for (i = 0; i < count; i++)
+        if (!WL_TRIE_LINKS_OK(nodes, i, count) || fail[i] >= count)
+            return 0;
+    if (!(depth = calloc(count, sizeof(*depth))))
+        return 0;
+    /* Children come after their parent, one pass sets every depth */
+    for (i = 0; i < count; i++)
+        for (it = nodes[i].child; it; it = nodes[it].sibling)
+            depth[it] = depth[i] + 1;
+    for (i = 1; i < count && ok; i++)
+        ok = depth[fail[i]] < depth[i];
+    free(depth);
+    return ok;
+}
+
+/* Transitions land on the start of a row */
+static int wl_image_table_ok(const uint32_t *table, size_t size, unsigned int classes) {
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        if ((table[i] & ~AC_MATCH) >= size || (table[i] & ~AC_MATCH) % classes)
+            return 0;
+    return 1;
+}
+
+static int wl_image_map_ac(wl_image *img, const wl_image_section *s, ac_matcher *ac) {
+    const char *p = (const char *)img->map + s->offset;
+    int c;
+
+    if (!s->length)
+        return 1;
+    if (s->flags & WL_AC_SPARSE) {
+        ac->nodes = (ac_node *)(p + WL_AC_CLASSES_SIZE);
+        ac->count = ac->size = s->count;
+        ac->fail = (uint32_t *)(p + WL_AC_CLASSES_SIZE + s->count * sizeof(ac_node));
+        return wl_image_sparse_ok(ac->nodes, ac->fail, ac->count);
+    }
+    if (!s->param || s->count % s->param ||
+        !wl_image_table_ok((const uint32_t *)(p + WL_AC_CLASSES_SIZE), s->count, s->param))
+        return 0;
+    memcpy(ac->byte_class, p, WL_AC_CLASSES_SIZE);
+    for (c = 0; c < 256; c++)
+        if (ac->byte_class[c] >= s->param)
+            return 0;
+    ac->nodes = (ac_node *)&wl_ac_root[s->flags & WL_AC_ROOT_MATCH ? 1 : 0];
+    ac->count = ac->size = 1;
+    ac->table = (uint32_t *)(p + WL_AC_CLASSES_SIZE);
+    ac->table_size = s->count;
+    ac->classes = s->param;
+    return 1;
+}
+
+/* Strings inside the pool, and an empty slot to end every probe */
+static int wl_image_set_ok(const str_set *set) {
+    size_t i, used = 0;
+
+    for (i = 0; i < set->size; i++) {
+        if (!set->slots[i].off)
+            continue;
+        if (set->slots[i].off >= set->pool_len || set->slots[i].len >= set->pool_len - set->slots[i].off ||
+            set->pool[set->slots[i].off + set->slots[i].len])
+            return 0;
+        used++;
+    }
+    return used == set->count && used < set->size;
+}
+
+static int wl_image_map_set(wl_image *img, const wl_image_section *s, str_set *set) {
+    const char *p = (const char *)img->map + s->offset;
+    size_t slots = s->count * sizeof(str_set_slot);
+
+    if (!s->length)
+        return 1;
+    /* A power of two slot count, and a pool ending on a terminator */
+    if (s->count & (s->count - 1) || s->length <= slots || p[s->length - 1])
+        return 0;
+    set->slots = (str_set_slot *)p;
+    set->size = s->count;
+    set->count = s->param;
+    set->pool = (char *)p + slots;
+    set->pool_len = set->pool_size = s->length - slots;
+    return wl_image_set_ok(set);
+}
+
+wl_image *wl_image_open(const char *path) {
+    const wl_image_header *hdr;
+    const wl_image_section *s;
+    str_set **sets[4];
+    wl_image *img;
+    struct stat st;
+    int fd, i, ok = 1;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(wl_image_header)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!(img = calloc(1, sizeof(*img)))) {
+        close(fd);
+        return NULL;
+    }
+    img->size = st.st_size;
+    img->dev = st.st_dev;
+    img->ino = st.st_ino;
+    img->mtime = st.st_mtime;
+    img->map = mmap(NULL, img->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (img->map == MAP_FAILED) {
+        free(img);
+        return NULL;
+    }
+
+    hdr = img->map;
+    s = hdr->sections;
+    if (memcmp(hdr->magic, WL_IMAGE_MAGIC, sizeof(WL_IMAGE_MAGIC)) || hdr->version < 1 || hdr->version > WL_IMAGE_VERSION ||
+        hdr->byteorder != WL_IMAGE_BYTEORDER || hdr->size != img->size)
+        ok = 0;
+    for (i = 0; i < WL_SECTIONS && ok; i++)
+        ok = wl_image_section_ok(img, &s[i], i);
+
+    if (ok) {
+        img->lists.ips.ranges = (ip_range *)((char *)img->map + s[WL_SECTION_IP4].offset);
+        img->lists.ips.count = img->lists.ips.size = s[WL_SECTION_IP4].count;
+        img->lists.ips.ranges6 = (ip_range6 *)((char *)img->map + s[WL_SECTION_IP6].offset);
+        img->lists.ips.count6 = img->lists.ips.size6 = s[WL_SECTION_IP6].count;
+        if (s[WL_SECTION_PTR].length) {
+            img->ptrs.nodes = (name_trie_node *)((char *)img->map + s[WL_SECTION_PTR].offset);
+            img->ptrs.count = img->ptrs.size = s[WL_SECTION_PTR].count;
+            img->lists.ptrs = &img->ptrs;
+        }
+        ok = wl_image_ips_ok(img->lists.ips.ranges, img->lists.ips.count) &&
+             wl_image_ips6_ok(img->lists.ips.ranges6, img->lists.ips.count6) &&
+             wl_image_trie_ok(img->ptrs.nodes, img->ptrs.count) &&
+             wl_image_map_ac(img, &s[WL_SECTION_FROM_AC], &img->from_ac) &&
+             wl_image_map_ac(img, &s[WL_SECTION_TO_AC], &img->to_ac);
+        if (ac_built(&img->from_ac))
+            img->lists.from_ac = &img->from_ac;
+        if (ac_built(&img->to_ac))
+            img->lists.to_ac = &img->to_ac;
+    }
+
+    sets[0] = &img->lists.from_addrs;
+    sets[1] = &img->lists.from_domains;
+    sets[2] = &img->lists.to_addrs;
+    sets[3] = &img->lists.to_domains;
+    for (i = 0; i < 4 && ok; i++)
+        if ((ok = wl_image_map_set(img, &s[WL_SECTION_SETS + i], &img->sets[i])) && img->sets[i].count)
+            *sets[i] = &img->sets[i];
+
+    if (!ok) {
+        wl_image_close(img);
+        errno = EINVAL;
+        return NULL;
+    }
+    return img;
+}
+
+int wl_image_changed(const wl_image *img, const char *path) {
+    struct stat st;
+
+    if (stat(path, &st))
+        return 0;
+    return st.st_dev != img->dev || st.st_ino != img->ino || st.st_mtime != img->mtime ||
+           (size_t)st.st_size != img->size;
+}
+
+void wl_image_close(wl_image *img) {
+    if (!img)
+        return;
+    munmap(img->map, img->size);
+    free(img);
+}
@@ -0,0 +1,114 @@
+/*
+ * wl_image.h - Precompiled whitelist database for smf-spf
+ *
+ * This file is part of smf-spf.
+ *
+ * smf-spf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * smf-spf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef SMF_SPF_WL_IMAGE_H
+#define SMF_SPF_WL_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "aho_corasick.h"
+#include "ip_index.h"
+#include "name_trie.h"
+#include "str_set.h"
+
+#define WL_IMAGE_MAGIC		"SMFSPFW"
+/* Version 2 adds compact automatons, version 1 files are still read */
+#define WL_IMAGE_VERSION	2
+
+/**
+ * @brief Compiled whitelists, as config_load() builds them
+ *
+ * Pointer members are NULL when the list is empty. The IP index must
+ * have been built and the matchers compiled with ac_build().
+ */
+typedef struct wl_lists {
+    ip_index ips;
+    name_trie *ptrs;
+    ac_matcher *from_ac;
+    ac_matcher *to_ac;
+    str_set *from_addrs;
+    str_set *from_domains;
+    str_set *to_addrs;
+    str_set *to_domains;
+} wl_lists;
+
+/**
+ * @brief Whitelist database mapped from a file
+ *
+ * lists points straight into the read-only mapping, so opening costs
+ * a header check whatever the number of entries, and every process
+ * mapping the same file shares its pages.
+ */
+typedef struct wl_image {
+    wl_lists lists;
+    void *map;
+    size_t size;
+    /* Identity of the mapped file, to notice a replacement */
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    /* Storage behind the pointers of lists */
+    name_trie ptrs;
+    ac_matcher from_ac;
+    ac_matcher to_ac;
+    str_set sets[4];
+} wl_image;
+
+/**
+ * @brief Write whitelists to a database file
+ *
+ * The image is written next to the destination and renamed over it,
+ * so a running smf-spf sees either the old file or the new one.
+ *
+ * @param path Destination file
+ * @param lists Whitelists to write
+ * @return Size of the file in bytes, or -1 on error
+ */
+long wl_image_write(const char *path, const wl_lists *lists);
+
+/**
+ * @brief Map a database file read-only
+ *
+ * The header, the section bounds and every index or offset inside the
+ * sections are checked once, so lookups in a damaged file can neither
+ * leave the mapping nor loop.
+ *
+ * @param path File written by wl_image_write()
+ * @return The image, or NULL if the file is missing, unreadable, damaged
+ *         or not a database of this version (errno is EINVAL)
+ */
+wl_image *wl_image_open(const char *path);
+
+/**
+ * @brief Check whether the file at path is another one than the mapped one
+ *
+ * @param img Mapped image
+ * @param path File the image was opened from
+ * @return 1 if the file was replaced or modified, 0 otherwise
+ */
+int wl_image_changed(const wl_image *img, const char *path);
+
+/**
+ * @brief Unmap and free an image, NULL is ignored
+ *
+ * @param img Image to close
+ */
+void wl_image_close(wl_image *img);
+
+#endif /* SMF_SPF_WL_IMAGE_H */
@@ -0,0 +1,76 @@
+/*
+ * bench_cache.c - Lookup latency of the result cache at large sizes
+ *
+ * Usage: bench_cache [entries ...]
+ *
+ * For each size the private table is filled with that many results,
+ * then timed over random lookups of the stored keys, once with
+ * ordinary pages and once with CacheHugePages.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cache/cache.h"
+
+#define BENCH_LOOKUPS	2000000
+
+static void bench_key(char *buf, size_t size, unsigned long n) {
+    snprintf(buf, size, "%lu.%lu.%lu.%lu|host%lu.example.com",
+        10 + (n >> 24 & 0xff), n >> 16 & 0xff, n >> 8 & 0xff, n & 0xff, n % 5000);
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns nanoseconds per lookup, or -1 if the table could not be built */
+static double bench_run(unsigned long entries, int hugepages) {
+    unsigned long i, seed = 88172645463325252UL, found = 0;
+    char key[64];
+    double start;
+
+    cache_hugepages(hugepages);
+    /* Sized up front, so no resize runs while timing */
+    if (!cache_init(entries / 2))
+        return -1;
+    for (i = 0; i < entries; i++) {
+        bench_key(key, sizeof(key), i);
+        cache_put(key, 3600, 2);
+    }
+    start = bench_now();
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        bench_key(key, sizeof(key), seed % entries);
+        if (cache_get(key) != CACHE_MISS)
+            found++;
+    }
+    start = bench_now() - start;
+    cache_destroy();
+    if (found != BENCH_LOOKUPS)
+        fprintf(stderr, "warning: %lu of %d lookups missed\n", BENCH_LOOKUPS - found, BENCH_LOOKUPS);
+    return start * 1e9 / BENCH_LOOKUPS;
+}
+
+int main(int argc, char **argv) {
+    static const unsigned long sizes[] = { 262144, 1048576, 4194304 };
+    unsigned long entries;
+    int i, count = argc > 1 ? argc - 1 : (int)(sizeof(sizes) / sizeof(sizes[0]));
+
+    printf("%10s %14s %14s\n", "entries", "4k ns/lookup", "2M ns/lookup");
+    for (i = 0; i < count; i++) {
+        entries = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : sizes[i];
+        if (!entries)
+            continue;
+        printf("%10lu %14.1f", entries, bench_run(entries, 0));
+        fflush(stdout);
+        printf(" %14.1f\n", bench_run(entries, 1));
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * bench_whitelist.c - WhitelistIP lookup cost at large list sizes
+ *
+ * Usage: bench_whitelist [entries ...]
+ *
+ * For each size a random set of /16 to /32 prefixes is timed over
+ * random addresses, once with the linear CIDR walk the whitelist
+ * used to do and once with the compiled prefix index.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "utils/ip_index.h"
+
+#define BENCH_LOOKUPS		2000000
+/* The linear walk gets this many entry compares in total */
+#define BENCH_LINEAR_WORK	400000000UL
+
+typedef struct bench_cidr {
+    uint32_t net;
+    uint32_t mask;
+} bench_cidr;
+
+static unsigned long seed = 88172645463325252UL;
+
+static uint32_t bench_random(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (uint32_t)seed;
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench_linear(const bench_cidr *cidrs, unsigned long entries, unsigned long *found, unsigned long *lookups) {
+    unsigned long i, j, count = BENCH_LINEAR_WORK / entries;
+    uint32_t addr;
+    double start = bench_now();
+
+    *lookups += count;
+    for (i = 0; i < count; i++) {
+        addr = bench_random();
+        for (j = 0; j < entries; j++)
+            if ((addr & cidrs[j].mask) == cidrs[j].net) {
+                (*found)++;
+                break;
+            }
+    }
+    return (bench_now() - start) * 1e9 / count;
+}
+
+static double bench_index(const ip_index *idx, unsigned long *found, unsigned long *lookups) {
+    unsigned long i;
+    double start = bench_now();
+
+    *lookups += BENCH_LOOKUPS;
+    for (i = 0; i < BENCH_LOOKUPS; i++)
+        *found += ip_index_lookup(idx, bench_random());
+    return (bench_now() - start) * 1e9 / BENCH_LOOKUPS;
+}
+
+static void bench_run(unsigned long entries) {
+    bench_cidr *cidrs = malloc(entries * sizeof(*cidrs));
+    ip_index idx = { 0 };
+    unsigned long i, found = 0, lookups = 0;
+    unsigned int bits;
+    double build;
+
+    if (!cidrs)
+        return;
+    build = bench_now();
+    for (i = 0; i < entries; i++) {
+        bits = 16 + bench_random() % 17;
+        cidrs[i].mask = 0xffffffffU << (32 - bits);
+        cidrs[i].net = bench_random() & cidrs[i].mask;
+        ip_index_add(&idx, cidrs[i].net, bits);
+    }
+    ip_index_build(&idx);
+    build = bench_now() - build;
+    printf("%10lu %10lu %10.1f %14.1f", entries, (unsigned long)idx.count, build * 1e3, bench_index(&idx, &found, &lookups));
+    fflush(stdout);
+    printf(" %14.1f", bench_linear(cidrs, entries, &found, &lookups));
+    /* Printing the hits also keeps the compiler from dropping the walks */
+    printf(" %7.2f\n", found * 100.0 / lookups);
+    ip_index_free(&idx);
+    free(cidrs);
+}
+
+int main(int argc, char **argv) {
+    static const unsigned long sizes[] = { 10000, 100000, 1000000 };
+    unsigned long entries;
+    int i, count = argc > 1 ? argc - 1 : (int)(sizeof(sizes) / sizeof(sizes[0]));
+
+    printf("%10s %10s %10s %14s %14s %7s\n", "entries", "ranges", "build ms", "index ns", "linear ns", "hit %");
+    for (i = 0; i < count; i++) {
+        entries = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : sizes[i];
+        if (entries)
+            bench_run(entries);
+    }
+    return 0;
+}
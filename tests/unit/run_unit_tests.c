@@ -12,6 +12,17 @@ extern Suite *ip_utils_suite(void);
 extern Suite *memory_suite(void);
 extern Suite *logging_suite(void);
 extern Suite *config_suite(void);
+extern Suite *cache_suite(void);
+extern Suite *intern_suite(void);
+extern Suite *control_suite(void);
+extern Suite *ip_index_suite(void);
+extern Suite *ip_nat_suite(void);
+extern Suite *name_trie_suite(void);
+extern Suite *aho_corasick_suite(void);
+extern Suite *str_set_suite(void);
+extern Suite *regex_set_suite(void);
+extern Suite *spf_record_suite(void);
+extern Suite *wl_image_suite(void);
 
 int main(void)
 {
@@ -26,6 +37,17 @@ int main(void)
     srunner_add_suite(sr, memory_suite());
     srunner_add_suite(sr, logging_suite());
     srunner_add_suite(sr, config_suite());
+    srunner_add_suite(sr, cache_suite());
+    srunner_add_suite(sr, intern_suite());
+    srunner_add_suite(sr, control_suite());
+    srunner_add_suite(sr, ip_index_suite());
+    srunner_add_suite(sr, ip_nat_suite());
+    srunner_add_suite(sr, name_trie_suite());
+    srunner_add_suite(sr, aho_corasick_suite());
+    srunner_add_suite(sr, str_set_suite());
+    srunner_add_suite(sr, regex_set_suite());
+    srunner_add_suite(sr, spf_record_suite());
+    srunner_add_suite(sr, wl_image_suite());
 
     /* Run the tests */
     srunner_run_all(sr, CK_VERBOSE);
@@ -0,0 +1,155 @@
+/*
+ * test_aho_corasick.c - Unit tests for the multi-pattern matcher
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+#include "aho_corasick.h"
+
+START_TEST(test_ac_empty)
+{
+    ac_matcher *ac = ac_new();
+
+    ck_assert_ptr_nonnull(ac);
+    ck_assert_int_eq(ac_build(ac), 1);
+    ck_assert_int_eq(ac_match(ac, "user@example.com"), 0);
+    ck_assert_int_eq(ac_match(ac, ""), 0);
+    ac_free(ac);
+    ac_free(NULL);
+}
+END_TEST
+
+START_TEST(test_ac_patterns)
+{
+    ac_matcher *ac = ac_new();
+
+    ac_add(ac, "friend@");
+    ac_add(ac, "@example.com");
+    ac_add(ac, "she");
+    ac_add(ac, "hers");
+    ck_assert_int_eq(ac_build(ac), 1);
+
+    ck_assert_int_eq(ac_match(ac, "friend@other.org"), 1);
+    ck_assert_int_eq(ac_match(ac, "bob@example.com"), 1);
+    ck_assert_int_eq(ac_match(ac, "bob@example.co"), 0);
+    /* Found through a failure link, "he" then "rs" after "s" */
+    ck_assert_int_eq(ac_match(ac, "ushers"), 1);
+    ck_assert_int_eq(ac_match(ac, "xhersx"), 1);
+    ck_assert_int_eq(ac_match(ac, "frien@d"), 0);
+    /* Matching is byte for byte */
+    ck_assert_int_eq(ac_match(ac, "FRIEND@other.org"), 0);
+    ac_free(ac);
+}
+END_TEST
+
+START_TEST(test_ac_empty_pattern)
+{
+    ac_matcher *ac = ac_new();
+
+    ac_add(ac, "");
+    ck_assert_int_eq(ac_build(ac), 1);
+    ck_assert_int_eq(ac_match(ac, "anything"), 1);
+    ck_assert_int_eq(ac_match(ac, ""), 1);
+    ac_free(ac);
+}
+END_TEST
+
+/* Random patterns against strstr(), compact adds filler past the table limit */
+static void ac_check_strstr(int compact)
+{
+    static char patterns[300][8];
+    ac_matcher *ac = ac_new();
+    unsigned int seed = 4242;
+    char text[40];
+    int i, j, len, expect;
+
+    /* Digits never occur in the texts below */
+    for (i = 0; compact && i < 400000; i++) {
+        snprintf(text, sizeof(text), "9%08d", i * 7);
+        ck_assert_int_eq(ac_add(ac, text), 1);
+    }
+
+    /* Small alphabet, so patterns overlap and share prefixes a lot */
+    for (i = 0; i < 300; i++) {
+        seed = seed * 1103515245 + 12345;
+        len = 1 + (seed >> 16) % 6;
+        for (j = 0; j < len; j++) {
+            seed = seed * 1103515245 + 12345;
+            patterns[i][j] = "ab@.c"[(seed >> 16) % 5];
+        }
+        patterns[i][len] = '\0';
+        if (i % 7 == 0 || len > 4)
+            ac_add(ac, patterns[i]);
+        else
+            patterns[i][0] = '\0';
+    }
+    ck_assert_int_eq(ac_build(ac), 1);
+    ck_assert_int_eq(ac_built(ac), 1);
+    if (compact)
+        ck_assert_ptr_null(ac->table);
+    else
+        ck_assert_ptr_nonnull(ac->table);
+    for (i = 0; i < 5000; i++) {
+        seed = seed * 1103515245 + 12345;
+        len = (seed >> 16) % (sizeof(text) - 1);
+        for (j = 0; j < len; j++) {
+            seed = seed * 1103515245 + 12345;
+            text[j] = "ab@.cx"[(seed >> 16) % 6];
+        }
+        text[len] = '\0';
+        expect = 0;
+        for (j = 0; j < 300 && !expect; j++)
+            expect = patterns[j][0] && strstr(text, patterns[j]) != NULL;
+        ck_assert_int_eq(ac_match(ac, text), expect);
+    }
+    if (compact) {
+        ck_assert_int_eq(ac_match(ac, "x900000007x"), 1);
+        ck_assert_int_eq(ac_match(ac, "x900000008x"), 0);
+    }
+    ac_free(ac);
+}
+
+START_TEST(test_ac_matches_strstr)
+{
+    ac_check_strstr(0);
+}
+END_TEST
+
+START_TEST(test_ac_compact_matches_strstr)
+{
+    ac_check_strstr(1);
+}
+END_TEST
+
+START_TEST(test_ac_rebuild)
+{
+    ac_matcher *ac = ac_new();
+
+    ac_add(ac, "one");
+    ac_build(ac);
+    ck_assert_int_eq(ac_match(ac, "two"), 0);
+    ac_add(ac, "two");
+    ac_build(ac);
+    ck_assert_int_eq(ac_match(ac, "two"), 1);
+    ck_assert_int_eq(ac_match(ac, "one"), 1);
+    ac_free(ac);
+}
+END_TEST
+
+/* Create test suite */
+Suite *aho_corasick_suite(void)
+{
+    Suite *s = suite_create("Aho-Corasick");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_ac_empty);
+    tcase_add_test(tc_core, test_ac_patterns);
+    tcase_add_test(tc_core, test_ac_empty_pattern);
+    tcase_add_test(tc_core, test_ac_matches_strstr);
+    tcase_add_test(tc_core, test_ac_compact_matches_strstr);
+    tcase_add_test(tc_core, test_ac_rebuild);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,913 @@
+/*
+ * test_cache.c - Unit tests for the SPF result cache
+ */
+
+#include <check.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache/cache.h"
+#include "cache/cache_local.h"
+
+#define CACHE_TEST_FILE "/tmp/test_cache_snapshot.bin"
+
+/* Result codes as used by libspf2 */
+#define TEST_PASS	2
+#define TEST_FAIL	3
+
+/* Test Suite 1: Lookups */
+
+START_TEST(test_cache_get_miss)
+{
+    ck_assert_int_eq(cache_init(0), 1);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), CACHE_MISS);
+    cache_destroy();
+}
+END_TEST
+
+START_TEST(test_cache_put_get)
+{
+    cache_init(0);
+    cache_put("192.0.2.1|example.com", 60, TEST_PASS);
+    cache_put("192.0.2.2|example.com", 60, TEST_FAIL);
+
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), TEST_PASS);
+    ck_assert_int_eq(cache_get("192.0.2.2|example.com"), TEST_FAIL);
+    ck_assert_int_eq(cache_get("192.0.2.3|example.com"), CACHE_MISS);
+    cache_destroy();
+}
+END_TEST
+
+START_TEST(test_cache_put_keeps_live_entry)
+{
+    cache_init(0);
+    cache_put("192.0.2.1|example.com", 60, TEST_PASS);
+    cache_put("192.0.2.1|example.com", 60, TEST_FAIL);
+
+    /* A live entry is not overwritten */
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), TEST_PASS);
+    cache_destroy();
+}
+END_TEST
+
+START_TEST(test_cache_expired_entry)
+{
+    cache_init(0);
+    cache_put("192.0.2.1|example.com", 0, TEST_PASS);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), CACHE_MISS);
+
+    /* The expired slot is reused by the next put */
+    cache_put("192.0.2.1|example.com", 60, TEST_FAIL);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), TEST_FAIL);
+    cache_destroy();
+}
+END_TEST
+
+START_TEST(test_cache_hugepages)
+{
+    char key[64];
+    int i;
+
+    /* 2^20 buckets take 8 MB, mapped with or without hugepages */
+    cache_hugepages(1);
+    ck_assert_int_eq(cache_init(1UL << 20), 1);
+    for (i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "192.0.2.%d|host%d.example", i % 256, i);
+        cache_put(key, 600, TEST_PASS);
+    }
+    for (i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "192.0.2.%d|host%d.example", i % 256, i);
+        ck_assert_int_eq(cache_get(key), TEST_PASS);
+    }
+    cache_destroy();
+    cache_hugepages(0);
+}
+END_TEST
+
+START_TEST(test_cache_thread_slots)
+{
+    char key[200];
+    cache_stats stats;
+
+    cache_init(0);
+    cache_put("192.0.2.1|example.com", 600, TEST_PASS);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), TEST_PASS);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), TEST_PASS);
+
+    /* The first hit fills the thread slot, the second is served from it */
+    cache_stats_get(&stats, 0);
+    ck_assert_uint_eq(stats.hits, 2);
+    ck_assert_uint_eq(stats.thread_hits, 1);
+
+    /* Keys too long for a slot always go to the shared table */
+    memset(key, 'a', sizeof(key) - 1);
+    key[sizeof(key) - 1] = '\0';
+    cache_put(key, 600, TEST_FAIL);
+    ck_assert_int_eq(cache_get(key), TEST_FAIL);
+    ck_assert_int_eq(cache_get(key), TEST_FAIL);
+    cache_stats_get(&stats, 0);
+    ck_assert_uint_eq(stats.thread_hits, 1);
+    cache_destroy();
+
+    /* A new table is not answered from slots filled for the old one */
+    cache_init(0);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), CACHE_MISS);
+    cache_destroy();
+}
+END_TEST
+
+/* Stand-in policy: only TEST_NONE results depend on it */
+#define TEST_NONE	1
+static unsigned int test_policy_tag = 1;
+
+static unsigned int test_policy(int record) {
+    return CACHE_RESULT_STATUS(record) == TEST_NONE ? test_policy_tag : 0;
+}
+
+START_TEST(test_cache_policy_tags)
+{
+    cache_init(0);
+    cache_policy(test_policy);
+    test_policy_tag = 1;
+    cache_put("192.0.2.1|none.example", 600, CACHE_RESULT_TAG(TEST_NONE, 1));
+    cache_put("192.0.2.1|pass.example", 600, TEST_PASS);
+    ck_assert_int_eq(cache_get("192.0.2.1|none.example"), CACHE_RESULT_TAG(TEST_NONE, 1));
+    ck_assert_int_eq(cache_save(CACHE_TEST_FILE), 2);
+
+    /* Only the results depending on the changed setting go stale */
+    test_policy_tag = 2;
+    cache_policy(test_policy);
+    ck_assert_int_eq(cache_get("192.0.2.1|none.example"), CACHE_MISS);
+    ck_assert_int_eq(cache_get("192.0.2.1|pass.example"), TEST_PASS);
+
+    /* A result of the new policy replaces the live stale one */
+    cache_put("192.0.2.1|none.example", 600, CACHE_RESULT_TAG(TEST_NONE, 2));
+    ck_assert_int_eq(cache_get("192.0.2.1|none.example"), CACHE_RESULT_TAG(TEST_NONE, 2));
+    cache_destroy();
+
+    /* Stale records of a snapshot are not loaded */
+    cache_init(0);
+    ck_assert_int_eq(cache_load(CACHE_TEST_FILE), 1);
+    ck_assert_int_eq(cache_get("192.0.2.1|pass.example"), TEST_PASS);
+    cache_policy(NULL);
+    cache_destroy();
+    unlink(CACHE_TEST_FILE);
+}
+END_TEST
+
+START_TEST(test_cache_domains_shared)
+{
+    cache_stats stats;
+
+    cache_init(0);
+    cache_put("192.0.2.1|example.com", 600, TEST_PASS);
+    cache_put("192.0.2.2|example.com", 600, TEST_FAIL);
+    cache_put("192.0.2.1|example.org", 600, TEST_PASS);
+    cache_put("no-domain", 600, TEST_PASS);
+
+    /* Entries of one domain share its interned string */
+    cache_stats_get(&stats, 1);
+    ck_assert_uint_eq(stats.entries, 4);
+    ck_assert_uint_eq(stats.domains, 2);
+    ck_assert_int_eq(cache_get("192.0.2.2|example.com"), TEST_FAIL);
+    ck_assert_int_eq(cache_get("192.0.2.2|example.org"), CACHE_MISS);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.org"), TEST_PASS);
+    ck_assert_int_eq(cache_get("no-domain"), TEST_PASS);
+
+    /* Keys are rebuilt whole for snapshots */
+    ck_assert_int_eq(cache_save(CACHE_TEST_FILE), 4);
+    cache_destroy();
+    cache_init(0);
+    cache_stats_get(&stats, 1);
+    ck_assert_uint_eq(stats.domains, 0);
+    ck_assert_int_eq(cache_load(CACHE_TEST_FILE), 4);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), TEST_PASS);
+    ck_assert_int_eq(cache_get("192.0.2.2|example.com"), TEST_FAIL);
+    cache_destroy();
+    unlink(CACHE_TEST_FILE);
+}
+END_TEST
+
+START_TEST(test_cache_result_record)
+{
+    cache_stats stats;
+    int record = CACHE_RESULT_PACK(TEST_PASS, CACHE_RESULT_BEST_GUESS, 4), hit;
+
+    cache_init(0);
+    cache_put("192.0.2.1|example.com", 600, record);
+    ck_assert_int_eq(cache_save(CACHE_TEST_FILE), 1);
+    cache_destroy();
+
+    /* The whole record survives a snapshot */
+    cache_init(0);
+    ck_assert_int_eq(cache_load(CACHE_TEST_FILE), 1);
+    hit = cache_get("192.0.2.1|example.com");
+    ck_assert_int_eq(CACHE_RESULT_STATUS(hit), TEST_PASS);
+    ck_assert_int_eq(CACHE_RESULT_FLAGS(hit), CACHE_RESULT_BEST_GUESS);
+    ck_assert_int_eq(CACHE_RESULT_REASON(hit), 4);
+
+    /* Hits are counted under the result class */
+    cache_stats_get(&stats, 0);
+    ck_assert_uint_eq(stats.class_hits[TEST_PASS], 1);
+    cache_destroy();
+    unlink(CACHE_TEST_FILE);
+
+    /* A bare status is a valid record */
+    ck_assert_int_eq(CACHE_RESULT_STATUS(TEST_FAIL), TEST_FAIL);
+    ck_assert_int_eq(CACHE_RESULT_FLAGS(TEST_FAIL), 0);
+}
+END_TEST
+
+START_TEST(test_cache_size_rounded)
+{
+    cache_stats stats;
+
+    ck_assert_int_eq(cache_init(100), 1);
+    cache_stats_get(&stats, 1);
+    ck_assert_uint_eq(stats.buckets, 128);
+    cache_destroy();
+
+    ck_assert_int_eq(cache_init(1), 1);
+    cache_stats_get(&stats, 1);
+    ck_assert_uint_eq(stats.buckets, CACHE_LOCAL_MIN_BUCKETS);
+    cache_destroy();
+}
+END_TEST
+
+START_TEST(test_cache_grows_incrementally)
+{
+    cache_stats stats;
+    char key[64];
+    int i, j;
+
+    cache_init(64);
+    for (i = 0; i < 20000; i++) {
+        snprintf(key, sizeof(key), "203.0.113.%d|domain%d.example", i % 256, i);
+        cache_put(key, 600, i % 2 ? TEST_PASS : TEST_FAIL);
+        /* Lookups keep working while buckets move */
+        if (i % 97 == 0)
+            for (j = 0; j <= i; j += 101) {
+                snprintf(key, sizeof(key), "203.0.113.%d|domain%d.example", j % 256, j);
+                ck_assert_int_eq(cache_get(key), j % 2 ? TEST_PASS : TEST_FAIL);
+            }
+    }
+    for (i = 0; i < 20000; i++) {
+        snprintf(key, sizeof(key), "203.0.113.%d|domain%d.example", i % 256, i);
+        ck_assert_int_eq(cache_get(key), i % 2 ? TEST_PASS : TEST_FAIL);
+    }
+    cache_stats_get(&stats, 1);
+    ck_assert_uint_eq(stats.entries, 20000);
+    ck_assert_uint_eq(stats.insertions, 20000);
+    ck_assert_uint_ge(stats.buckets, 20000 / CACHE_LOAD_MAX);
+    cache_destroy();
+}
+END_TEST
+
+
+/* Test Suite 2: Snapshots */
+
+START_TEST(test_cache_save_load_roundtrip)
+{
+    char key[64];
+    int i;
+
+    cache_init(0);
+    for (i = 0; i < 500; i++) {
+        snprintf(key, sizeof(key), "192.0.2.%d|domain%d.example", i % 256, i);
+        cache_put(key, 600, i % 2 ? TEST_PASS : TEST_FAIL);
+    }
+    cache_put("198.51.100.1|expired.example", 0, TEST_PASS);
+    ck_assert_int_eq(cache_save(CACHE_TEST_FILE), 500);
+    cache_destroy();
+
+    cache_init(0);
+    ck_assert_int_eq(cache_load(CACHE_TEST_FILE), 500);
+    for (i = 0; i < 500; i++) {
+        snprintf(key, sizeof(key), "192.0.2.%d|domain%d.example", i % 256, i);
+        ck_assert_int_eq(cache_get(key), i % 2 ? TEST_PASS : TEST_FAIL);
+    }
+    ck_assert_int_eq(cache_get("198.51.100.1|expired.example"), CACHE_MISS);
+    cache_destroy();
+    unlink(CACHE_TEST_FILE);
+}
+END_TEST
+
+START_TEST(test_cache_load_missing_file)
+{
+    cache_init(0);
+    ck_assert_int_eq(cache_load("/tmp/nonexistent_cache_xyz.bin"), -1);
+    cache_destroy();
+}
+END_TEST
+
+START_TEST(test_cache_load_bad_magic)
+{
+    FILE *fp = fopen(CACHE_TEST_FILE, "w");
+    fprintf(fp, "this is not a cache snapshot file at all");
+    fclose(fp);
+
+    cache_init(0);
+    ck_assert_int_eq(cache_load(CACHE_TEST_FILE), -1);
+    cache_destroy();
+    unlink(CACHE_TEST_FILE);
+}
+END_TEST
+
+START_TEST(test_cache_load_truncated_file)
+{
+    FILE *fp;
+    long size;
+
+    cache_init(0);
+    cache_put("192.0.2.1|example.com", 600, TEST_PASS);
+    cache_put("192.0.2.2|example.com", 600, TEST_PASS);
+    ck_assert_int_eq(cache_save(CACHE_TEST_FILE), 2);
+    cache_destroy();
+
+    fp = fopen(CACHE_TEST_FILE, "r+");
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fclose(fp);
+    ck_assert_int_eq(truncate(CACHE_TEST_FILE, size - 3), 0);
+
+    /* Only the intact record is loaded */
+    cache_init(0);
+    ck_assert_int_eq(cache_load(CACHE_TEST_FILE), 1);
+    cache_destroy();
+    unlink(CACHE_TEST_FILE);
+}
+END_TEST
+
+
+/* Test Suite 3: Expiry sweeper and statistics */
+
+START_TEST(test_cache_expire_frees_expired)
+{
+    char key[64];
+    int i;
+
+    cache_init(0);
+    for (i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "192.0.2.%d|domain%d.example", i % 256, i);
+        cache_put(key, 1, TEST_PASS);
+    }
+    cache_put("198.51.100.1|live.example", 600, TEST_FAIL);
+    /* Due a full lap later, shares a slot the sweep visits now */
+    cache_put("198.51.100.2|far.example", CACHE_WHEEL_SLOTS + 1, TEST_PASS);
+    ck_assert_int_eq(cache_expire(), 0);
+
+    sleep(2);
+    ck_assert_int_eq(cache_expire(), 1000);
+    ck_assert_int_eq(cache_expire(), 0);
+    ck_assert_int_eq(cache_get("198.51.100.1|live.example"), TEST_FAIL);
+    ck_assert_int_eq(cache_get("198.51.100.2|far.example"), TEST_PASS);
+    ck_assert_int_eq(cache_save(CACHE_TEST_FILE), 2);
+    cache_destroy();
+    unlink(CACHE_TEST_FILE);
+}
+END_TEST
+
+START_TEST(test_cache_expire_already_expired)
+{
+    cache_init(0);
+    /* Due in the current second, which the sweeper has passed */
+    cache_put("192.0.2.1|example.com", 0, TEST_PASS);
+
+    sleep(2);
+    ck_assert_int_eq(cache_expire(), 1);
+    cache_destroy();
+}
+END_TEST
+
+START_TEST(test_cache_expire_reused_item)
+{
+    cache_init(0);
+    cache_put("192.0.2.1|example.com", 0, TEST_PASS);
+    sleep(1);
+    /* The expired item is reused and must move to its new slot */
+    cache_put("192.0.2.1|example.com", 600, TEST_FAIL);
+
+    sleep(1);
+    ck_assert_int_eq(cache_expire(), 0);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), TEST_FAIL);
+    cache_destroy();
+}
+END_TEST
+
+
+/* Dump writer keeping the expiry time of the last line */
+static int dump_exptime(const char *buf, size_t len, void *arg) {
+    const char *p = buf + len - 1;
+
+    while (p > buf && p[-1] != ' ')
+        p--;
+    *(long *)arg = strtol(p, NULL, 10);
+    return 1;
+}
+
+/* Store a re-evaluated result and return the TTL it got */
+static long stored_ttl(int status) {
+    long exptime = 0;
+
+    cache_flush(NULL, NULL, NULL);
+    cache_put("192.0.2.1|example.com", 1000, status);
+    ck_assert_int_eq(cache_dump(dump_exptime, &exptime), 1);
+    return exptime - (long)time(NULL);
+}
+
+START_TEST(test_cache_adaptive_ttl)
+{
+    cache_stats stats;
+    long ttl;
+
+    cache_adaptive_ttl(4000);
+    cache_init(0);
+
+    /* The TTL doubles with each unchanged result, up to the cap */
+    ttl = stored_ttl(TEST_PASS);
+    ck_assert(ttl >= 999 && ttl <= 1000);
+    ttl = stored_ttl(TEST_PASS);
+    ck_assert(ttl >= 1999 && ttl <= 2000);
+    ttl = stored_ttl(TEST_PASS);
+    ck_assert(ttl >= 3999 && ttl <= 4000);
+    ttl = stored_ttl(TEST_PASS);
+    ck_assert(ttl >= 3999 && ttl <= 4000);
+
+    /* A changed result starts over */
+    ttl = stored_ttl(TEST_FAIL);
+    ck_assert(ttl >= 999 && ttl <= 1000);
+
+    cache_stats_get(&stats, 0);
+    ck_assert_uint_eq(stats.extended, 3);
+    cache_destroy();
+    cache_adaptive_ttl(0);
+}
+END_TEST
+
+START_TEST(test_cache_stats_counters)
+{
+    cache_stats stats;
+
+    cache_init(0);
+    cache_put("192.0.2.1|example.com", 0, TEST_PASS);
+    cache_put("192.0.2.2|example.com", 60, TEST_PASS);
+    cache_put("192.0.2.2|example.com", 60, TEST_FAIL);
+    ck_assert_int_eq(cache_get("192.0.2.2|example.com"), TEST_PASS);
+    ck_assert_int_eq(cache_get("192.0.2.3|example.com"), CACHE_MISS);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), CACHE_MISS);
+    sleep(1);
+    /* Reuses the expired item */
+    cache_put("192.0.2.1|example.com", 60, TEST_FAIL);
+
+    cache_stats_get(&stats, 0);
+    ck_assert_uint_eq(stats.hits, 1);
+    ck_assert_uint_eq(stats.misses, 2);
+    ck_assert_uint_eq(stats.insertions, 2);
+    ck_assert_uint_eq(stats.overwrites, 1);
+    ck_assert_uint_eq(stats.evictions, 0);
+    ck_assert_uint_eq(stats.buckets, 0);
+
+    /* The live entry kept by the second put is not a store */
+    ck_assert_uint_eq(stats.class_hits[TEST_PASS], 1);
+    ck_assert_uint_eq(stats.class_hits[TEST_FAIL], 0);
+    ck_assert_uint_eq(stats.class_stores[TEST_PASS], 2);
+    ck_assert_uint_eq(stats.class_stores[TEST_FAIL], 1);
+    cache_destroy();
+}
+END_TEST
+
+START_TEST(test_cache_stats_histogram)
+{
+    cache_stats stats;
+    char key[64], line[512];
+    unsigned long i, buckets = 0;
+
+    cache_init(0);
+    for (i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "203.0.113.%lu|domain%lu.example", i % 256, i);
+        cache_put(key, 60, TEST_PASS);
+    }
+    cache_stats_get(&stats, 1);
+    ck_assert_uint_eq(stats.entries, 1000);
+    ck_assert_uint_eq(stats.buckets, 1UL << HASH_POWER);
+    for (i = 0; i < CACHE_CHAIN_HIST; i++)
+        buckets += stats.chains[i];
+    ck_assert_uint_eq(buckets, stats.buckets);
+    ck_assert_uint_gt(stats.chains[1], 0);
+
+    ck_assert_int_lt(cache_stats_format(&stats, line, sizeof(line)), (int)sizeof(line));
+    ck_assert_ptr_nonnull(strstr(line, "insertions=1000"));
+    ck_assert_ptr_nonnull(strstr(line, "entries=1000"));
+    ck_assert_ptr_nonnull(strstr(line, "7+:"));
+    cache_destroy();
+}
+END_TEST
+
+
+/* Test Suite 5: Shared memory table */
+
+START_TEST(test_cache_shared_across_processes)
+{
+    char name[64];
+    pid_t pid;
+    int wstatus;
+
+    snprintf(name, sizeof(name), "/smf-spf-test-%d", (int)getpid());
+    shm_unlink(name);
+    ck_assert_int_eq(cache_init_shared(name, 1024), 1);
+    cache_put("192.0.2.1|example.com", 60, TEST_PASS);
+
+    pid = fork();
+    ck_assert_int_ne(pid, -1);
+    if (pid == 0) {
+        /* A second instance attaches by name and sees the result */
+        cache_destroy();
+        if (!cache_init_shared(name, 0) || cache_get("192.0.2.1|example.com") != TEST_PASS)
+            _exit(1);
+        cache_put("192.0.2.2|example.com", 60, TEST_FAIL);
+        cache_destroy();
+        _exit(0);
+    }
+    ck_assert_int_eq(waitpid(pid, &wstatus, 0), pid);
+    ck_assert_int_eq(WEXITSTATUS(wstatus), 0);
+    ck_assert_int_eq(cache_get("192.0.2.2|example.com"), TEST_FAIL);
+
+    /* A live result is replaced by one of another policy */
+    test_policy_tag = 1;
+    cache_policy(test_policy);
+    cache_put("192.0.2.3|example.com", 60, CACHE_RESULT_TAG(TEST_NONE, 1));
+    ck_assert_int_eq(cache_get("192.0.2.3|example.com"), CACHE_RESULT_TAG(TEST_NONE, 1));
+    test_policy_tag = 3;
+    cache_policy(test_policy);
+    ck_assert_int_eq(cache_get("192.0.2.3|example.com"), CACHE_MISS);
+    cache_put("192.0.2.3|example.com", 60, CACHE_RESULT_TAG(TEST_NONE, 3));
+    ck_assert_int_eq(cache_get("192.0.2.3|example.com"), CACHE_RESULT_TAG(TEST_NONE, 3));
+    cache_policy(NULL);
+
+    cache_destroy();
+    shm_unlink(name);
+}
+END_TEST
+
+START_TEST(test_cache_shared_flush_reaches_threads)
+{
+    char name[64], c = 0;
+    int ready[2], flushed[2], wstatus;
+    pid_t pid;
+
+    snprintf(name, sizeof(name), "/smf-spf-test-flush-%d", (int)getpid());
+    shm_unlink(name);
+    ck_assert_int_eq(cache_init_shared(name, 1024), 1);
+    cache_put("192.0.2.1|example.com", 60, TEST_PASS);
+    ck_assert_int_eq(pipe(ready), 0);
+    ck_assert_int_eq(pipe(flushed), 0);
+
+    pid = fork();
+    ck_assert_int_ne(pid, -1);
+    if (pid == 0) {
+        /* Another instance copies the result into its thread slot */
+        cache_destroy();
+        if (!cache_init_shared(name, 0) || cache_get("192.0.2.1|example.com") != TEST_PASS ||
+            write(ready[1], &c, 1) != 1 || read(flushed[0], &c, 1) != 1)
+            _exit(2);
+        _exit(cache_get("192.0.2.1|example.com") == CACHE_MISS ? 0 : 1);
+    }
+    ck_assert_int_eq(read(ready[0], &c, 1), 1);
+    ck_assert_uint_eq(cache_flush(NULL, NULL, NULL), 1);
+    ck_assert_int_eq(write(flushed[1], &c, 1), 1);
+    ck_assert_int_eq(waitpid(pid, &wstatus, 0), pid);
+    ck_assert_int_eq(WEXITSTATUS(wstatus), 0);
+
+    close(ready[0]);
+    close(ready[1]);
+    close(flushed[0]);
+    close(flushed[1]);
+    cache_destroy();
+    shm_unlink(name);
+}
+END_TEST
+
+START_TEST(test_cache_shared_bucket_eviction)
+{
+    char name[64], key[64];
+    cache_stats stats;
+    int i, found = 0;
+
+    snprintf(name, sizeof(name), "/smf-spf-test-evict-%d", (int)getpid());
+    shm_unlink(name);
+    ck_assert_int_eq(cache_init_shared(name, 1), 1);
+
+    /* Far more keys than slots, the table must stay consistent */
+    for (i = 0; i < 4096; i++) {
+        snprintf(key, sizeof(key), "198.51.100.%d|domain%d.example", i % 256, i);
+        cache_put(key, 60 + i, TEST_PASS);
+    }
+    for (i = 0; i < 4096; i++) {
+        snprintf(key, sizeof(key), "198.51.100.%d|domain%d.example", i % 256, i);
+        if (cache_get(key) == TEST_PASS)
+            found++;
+    }
+    ck_assert_int_gt(found, 0);
+    ck_assert_int_lt(found, 4096);
+
+    cache_stats_get(&stats, 1);
+    ck_assert_uint_gt(stats.evictions, 0);
+    ck_assert_uint_eq(stats.insertions + stats.evictions, 4096);
+    ck_assert_uint_eq(stats.entries, (unsigned long)found);
+
+    cache_destroy();
+    shm_unlink(name);
+}
+END_TEST
+
+START_TEST(test_cache_shared_snapshot)
+{
+    char name[64];
+
+    snprintf(name, sizeof(name), "/smf-spf-test-snap-%d", (int)getpid());
+    shm_unlink(name);
+    ck_assert_int_eq(cache_init_shared(name, 1024), 1);
+    cache_put("192.0.2.1|example.com", 600, TEST_PASS);
+    ck_assert_int_eq(cache_save(CACHE_TEST_FILE), 1);
+    cache_destroy();
+    shm_unlink(name);
+
+    cache_init(0);
+    ck_assert_int_eq(cache_load(CACHE_TEST_FILE), 1);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), TEST_PASS);
+    cache_destroy();
+    unlink(CACHE_TEST_FILE);
+}
+END_TEST
+
+
+/* Test Suite 6: memcached backend */
+
+/* Stand-in for memcached serving one client at a time: "get", "set [noreply]" and "flush_all" */
+static char mc_key_stored[256];
+static char mc_value_stored[1024];
+
+static void *mc_server_thread(void *arg)
+{
+    int lfd = *(int *)arg, fd;
+    char buf[4096], out[2048];
+    size_t len = 0;
+    ssize_t n;
+
+next:
+    if ((fd = accept(lfd, NULL, NULL)) < 0)
+        return NULL;
+    len = 0;
+    while ((n = recv(fd, buf + len, sizeof(buf) - 1 - len, 0)) > 0) {
+        char *line, *eol;
+
+        len += n;
+        buf[len] = '\0';
+        line = buf;
+        while ((eol = strstr(line, "\r\n"))) {
+            char key[256];
+            int bytes;
+
+            *eol = '\0';
+            if (sscanf(line, "set %255s %*d %*d %d", key, &bytes) == 2) {
+                if (strlen(eol + 2) < (size_t)bytes + 2) {
+                    *eol = '\r';
+                    break;
+                }
+                snprintf(mc_key_stored, sizeof(mc_key_stored), "%s", key);
+                snprintf(mc_value_stored, sizeof(mc_value_stored), "%.*s", bytes, eol + 2);
+                if (!strstr(line, " noreply"))
+                    send(fd, "STORED\r\n", 8, 0);
+                line = eol + 2 + bytes + 2;
+                continue;
+            }
+            if (!strcmp(line, "flush_all")) {
+                mc_key_stored[0] = '\0';
+                send(fd, "OK\r\n", 4, 0);
+            }
+            if (sscanf(line, "get %255s", key) == 1) {
+                /* A hit arrives in two segments, the data before END */
+                if (mc_key_stored[0] && !strcmp(key, mc_key_stored)) {
+                    snprintf(out, sizeof(out), "VALUE %s 0 %d\r\n%s\r\n",
+                             key, (int)strlen(mc_value_stored), mc_value_stored);
+                    send(fd, out, strlen(out), 0);
+                    usleep(20000);
+                }
+                send(fd, "END\r\n", 5, 0);
+            }
+            line = eol + 2;
+        }
+        len -= line - buf;
+        memmove(buf, line, len);
+    }
+    close(fd);
+    goto next;
+}
+
+static int mc_server_start(pthread_t *thread, int *lfd)
+{
+    struct sockaddr_in sin;
+    socklen_t sl = sizeof(sin);
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    *lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (*lfd < 0 || bind(*lfd, (struct sockaddr *)&sin, sizeof(sin)) || listen(*lfd, 4) ||
+        getsockname(*lfd, (struct sockaddr *)&sin, &sl))
+        return -1;
+    mc_key_stored[0] = '\0';
+    pthread_create(thread, NULL, mc_server_thread, lfd);
+    return ntohs(sin.sin_port);
+}
+
+START_TEST(test_cache_memcached_roundtrip)
+{
+    char servers[64];
+    pthread_t thread;
+    int lfd, port;
+
+    port = mc_server_start(&thread, &lfd);
+    ck_assert_int_gt(port, 0);
+    snprintf(servers, sizeof(servers), "127.0.0.1:%d", port);
+
+    ck_assert_int_eq(cache_init_memcached(servers, 1, 1000, 0), 1);
+    cache_put("192.0.2.1|example.com", 60, TEST_PASS);
+    cache_destroy();
+
+    /* Another instance with an empty local table finds the result */
+    ck_assert_int_eq(cache_init_memcached(servers, 1, 1000, 0), 1);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), TEST_PASS);
+    ck_assert_int_eq(cache_get("192.0.2.2|example.com"), CACHE_MISS);
+    cache_destroy();
+    ck_assert_str_eq(mc_key_stored, "smfspf:192.0.2.1|example.com");
+
+    shutdown(lfd, SHUT_RDWR);
+    pthread_join(thread, NULL);
+    close(lfd);
+}
+END_TEST
+
+START_TEST(test_cache_memcached_error_in_key)
+{
+    char servers[64];
+    pthread_t thread;
+    int lfd, port;
+
+    port = mc_server_start(&thread, &lfd);
+    ck_assert_int_gt(port, 0);
+    snprintf(servers, sizeof(servers), "127.0.0.1:%d", port);
+
+    /* A HELO name is client input and reaches the stored value */
+    ck_assert_int_eq(cache_init_memcached(servers, 1, 1000, 0), 1);
+    cache_put("192.0.2.1|ERROR.example", 60, TEST_PASS);
+    cache_destroy();
+
+    ck_assert_int_eq(cache_init_memcached(servers, 1, 1000, 0), 1);
+    ck_assert_int_eq(cache_get("192.0.2.1|ERROR.example"), TEST_PASS);
+    /* The server was not taken for a failing one */
+    ck_assert_int_eq(cache_get("192.0.2.1|ERROR.example"), TEST_PASS);
+    cache_put("192.0.2.2|SERVER_ERROR x", 60, TEST_FAIL);
+    cache_destroy();
+    ck_assert_int_eq(cache_init_memcached(servers, 1, 1000, 0), 1);
+    ck_assert_int_eq(cache_get("192.0.2.2|SERVER_ERROR x"), TEST_FAIL);
+    cache_destroy();
+
+    shutdown(lfd, SHUT_RDWR);
+    pthread_join(thread, NULL);
+    close(lfd);
+}
+END_TEST
+
+/* A flush selecting every key, unlike a NULL matcher */
+static int test_match_all(const char *key, void *arg)
+{
+    (void)key;
+    (void)arg;
+    return 1;
+}
+
+START_TEST(test_cache_memcached_flush)
+{
+    char servers[64];
+    pthread_t thread;
+    int lfd, port, kept;
+
+    port = mc_server_start(&thread, &lfd);
+    ck_assert_int_gt(port, 0);
+    snprintf(servers, sizeof(servers), "127.0.0.1:%d", port);
+
+    ck_assert_int_eq(cache_init_memcached(servers, 1, 1000, 0), 1);
+    cache_put("192.0.2.1|example.com", 60, TEST_PASS);
+
+    /* Only the local copy of a selected result can be dropped */
+    ck_assert_uint_eq(cache_flush(test_match_all, NULL, &kept), 1);
+    ck_assert_int_eq(kept, 1);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), TEST_PASS);
+
+    /* Flushing everything empties the servers too */
+    cache_flush(NULL, NULL, &kept);
+    ck_assert_int_eq(kept, 0);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), CACHE_MISS);
+    cache_destroy();
+
+    shutdown(lfd, SHUT_RDWR);
+    pthread_join(thread, NULL);
+    close(lfd);
+}
+END_TEST
+
+START_TEST(test_cache_memcached_server_down)
+{
+    struct sockaddr_in sin;
+    socklen_t sl = sizeof(sin);
+    char servers[64];
+    int fd;
+
+    /* A port nobody listens on */
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    ck_assert_int_eq(bind(fd, (struct sockaddr *)&sin, sizeof(sin)), 0);
+    getsockname(fd, (struct sockaddr *)&sin, &sl);
+    snprintf(servers, sizeof(servers), "127.0.0.1:%d", ntohs(sin.sin_port));
+
+    ck_assert_int_eq(cache_init_memcached(servers, 2, 100, 0), 1);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), CACHE_MISS);
+
+    /* The local table still answers */
+    cache_put("192.0.2.1|example.com", 60, TEST_FAIL);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), TEST_FAIL);
+    cache_destroy();
+    close(fd);
+}
+END_TEST
+
+START_TEST(test_cache_memcached_bad_servers)
+{
+    ck_assert_int_eq(cache_init_memcached("", 1, 100, 0), 0);
+    ck_assert_int_eq(cache_init_memcached(" , ", 1, 100, 0), 0);
+}
+END_TEST
+
+
+Suite *cache_suite(void)
+{
+    Suite *s = suite_create("cache");
+
+    TCase *tc_lookup = tcase_create("lookup");
+    tcase_add_test(tc_lookup, test_cache_get_miss);
+    tcase_add_test(tc_lookup, test_cache_put_get);
+    tcase_add_test(tc_lookup, test_cache_put_keeps_live_entry);
+    tcase_add_test(tc_lookup, test_cache_expired_entry);
+    tcase_add_test(tc_lookup, test_cache_result_record);
+    tcase_add_test(tc_lookup, test_cache_policy_tags);
+    tcase_add_test(tc_lookup, test_cache_domains_shared);
+    tcase_add_test(tc_lookup, test_cache_thread_slots);
+    tcase_add_test(tc_lookup, test_cache_hugepages);
+    tcase_add_test(tc_lookup, test_cache_size_rounded);
+    tcase_add_test(tc_lookup, test_cache_grows_incrementally);
+    suite_add_tcase(s, tc_lookup);
+
+    TCase *tc_snapshot = tcase_create("snapshot");
+    tcase_add_test(tc_snapshot, test_cache_save_load_roundtrip);
+    tcase_add_test(tc_snapshot, test_cache_load_missing_file);
+    tcase_add_test(tc_snapshot, test_cache_load_bad_magic);
+    tcase_add_test(tc_snapshot, test_cache_load_truncated_file);
+    suite_add_tcase(s, tc_snapshot);
+
+    TCase *tc_expiry = tcase_create("expiry");
+    tcase_add_test(tc_expiry, test_cache_expire_frees_expired);
+    tcase_add_test(tc_expiry, test_cache_expire_already_expired);
+    tcase_add_test(tc_expiry, test_cache_adaptive_ttl);
+    tcase_add_test(tc_expiry, test_cache_expire_reused_item);
+    tcase_add_test(tc_expiry, test_cache_stats_counters);
+    tcase_add_test(tc_expiry, test_cache_stats_histogram);
+    suite_add_tcase(s, tc_expiry);
+
+    TCase *tc_shared = tcase_create("shared");
+    tcase_add_test(tc_shared, test_cache_shared_across_processes);
+    tcase_add_test(tc_shared, test_cache_shared_flush_reaches_threads);
+    tcase_add_test(tc_shared, test_cache_shared_bucket_eviction);
+    tcase_add_test(tc_shared, test_cache_shared_snapshot);
+    suite_add_tcase(s, tc_shared);
+
+    TCase *tc_memcached = tcase_create("memcached");
+    tcase_add_test(tc_memcached, test_cache_memcached_roundtrip);
+    tcase_add_test(tc_memcached, test_cache_memcached_flush);
+    tcase_add_test(tc_memcached, test_cache_memcached_error_in_key);
+    tcase_add_test(tc_memcached, test_cache_memcached_server_down);
+    tcase_add_test(tc_memcached, test_cache_memcached_bad_servers);
+    suite_add_tcase(s, tc_memcached);
+
+    return s;
+}
@@ -3,6 +3,7 @@
  */
 
 #include <check.h>
+#include <arpa/inet.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -276,6 +277,34 @@ START_TEST(test_load_invalid_cidr_mask)
 }
 END_TEST
 
+START_TEST(test_load_malformed_cidr_mask)
+{
+    unsigned char any6[16] = { 0x20, 0x01, 0x0d, 0xb8 };
+    FILE *fp = fopen("/tmp/test_config_badmask.list", "w");
+    fprintf(fp, "1.2.3.4/x\n");
+    fprintf(fp, "10.0.0.1\n");
+    fclose(fp);
+    fp = fopen("/tmp/test_config_badmask.conf", "w");
+    fprintf(fp, "whitelistip 1.2.3.4/\n");
+    fprintf(fp, "whitelistip 5.6.7.8/8x\n");
+    fprintf(fp, "whitelistip ::1/ab\n");
+    fprintf(fp, "whitelistipfile /tmp/test_config_badmask.list\n");
+    fclose(fp);
+
+    config_init();
+    ck_assert_int_eq(config_load("/tmp/test_config_badmask.conf"), 1);
+    /* Skipped, not read as /0 */
+    ck_assert_int_eq(config_ip_check(inet_addr("192.0.2.1")), 0);
+    ck_assert_int_eq(config_ip_check(inet_addr("1.2.3.4")), 0);
+    ck_assert_int_eq(config_ip6_check(any6), 0);
+    ck_assert_int_eq(config_ip_check(inet_addr("10.0.0.1")), 1);
+
+    unlink("/tmp/test_config_badmask.conf");
+    unlink("/tmp/test_config_badmask.list");
+    config_free();
+}
+END_TEST
+
 START_TEST(test_load_all_boolean_variations)
 {
     /* Create file with boolean options */
@@ -338,6 +367,75 @@ START_TEST(test_load_file_paths)
 }
 END_TEST
 
+START_TEST(test_load_cache_file)
+{
+    FILE *fp = fopen("/tmp/test_config_cachefile.conf", "w");
+    fprintf(fp, "cachefile /var/run/smfs/smf-spf.cache\n");
+    fprintf(fp, "cachefileinterval 5m\n");
+    fclose(fp);
+
+    config_init();
+    ck_assert_ptr_null(conf.cache_file);
+    ck_assert_ulong_eq(conf.cache_file_interval, CACHE_FILE_INTERVAL_DEFAULT);
+    config_load("/tmp/test_config_cachefile.conf");
+
+    ck_assert_str_eq(conf.cache_file, "/var/run/smfs/smf-spf.cache");
+    ck_assert_ulong_eq(conf.cache_file_interval, 300);
+
+    unlink("/tmp/test_config_cachefile.conf");
+    config_free();
+}
+END_TEST
+
+START_TEST(test_load_class_ttls)
+{
+    FILE *fp = fopen("/tmp/test_config_classttl.conf", "w");
+    fprintf(fp, "ttlpass 4h\n");
+    fprintf(fp, "ttlnone 0\n");
+    fprintf(fp, "ttl 30m\n");
+    fprintf(fp, "ttlmax 1d\n");
+    fclose(fp);
+
+    config_init();
+    ck_assert_ulong_eq(config_class_ttl(conf.ttl_fail), SPF_TTL_DEFAULT);
+    ck_assert_ulong_eq(conf.ttl_max, 0);
+    config_load("/tmp/test_config_classttl.conf");
+
+    ck_assert_ulong_eq(conf.ttl_max, 86400);
+
+    ck_assert_ulong_eq(config_class_ttl(conf.ttl_pass), 14400);
+    ck_assert_ulong_eq(config_class_ttl(conf.ttl_none), 0);
+    /* Unset classes follow TTL wherever it appears in the file */
+    ck_assert_ulong_eq(config_class_ttl(conf.ttl_fail), 1800);
+    ck_assert_ulong_eq(config_class_ttl(conf.ttl_softfail), 1800);
+    ck_assert_ulong_eq(config_class_ttl(conf.ttl_neutral), 1800);
+
+    unlink("/tmp/test_config_classttl.conf");
+    config_free();
+}
+END_TEST
+
+START_TEST(test_load_cache_prefixes)
+{
+    FILE *fp = fopen("/tmp/test_config_prefix.conf", "w");
+    fprintf(fp, "cacheipv6prefix 64\n");
+    fprintf(fp, "cacheipv4prefix 32\n");
+    fclose(fp);
+
+    config_init();
+    ck_assert_ulong_eq(conf.cache_prefix4, 0);
+    ck_assert_ulong_eq(conf.cache_prefix6, 0);
+    config_load("/tmp/test_config_prefix.conf");
+
+    ck_assert_ulong_eq(conf.cache_prefix6, 64);
+    /* A full length is the exact address, aggregation stays off */
+    ck_assert_ulong_eq(conf.cache_prefix4, 0);
+
+    unlink("/tmp/test_config_prefix.conf");
+    config_free();
+}
+END_TEST
+
 
 /* Test Suite 3: Configuration Cleanup */
 
@@ -557,6 +655,40 @@ START_TEST(test_ip_check_broadcast_address)
 }
 END_TEST
 
+START_TEST(test_ip_check_ipv6)
+{
+    unsigned char addr[16];
+    FILE *fp = fopen("/tmp/test_ip_v6.conf", "w");
+    fprintf(fp, "whitelistip 2001:db8::/32\n");
+    fprintf(fp, "whitelistip ::1\n");
+    fprintf(fp, "whitelistip 192.168.1.0/24\n");
+    fprintf(fp, "whitelistip 2001:db8::zz\n");
+    fclose(fp);
+
+    config_init();
+    config_load("/tmp/test_ip_v6.conf");
+
+    ck_assert_ptr_nonnull(conf.cidrs);
+    inet_pton(AF_INET6, "2001:db8:ffff::25", addr);
+    ck_assert_int_eq(config_ip6_check(addr), 1);
+    inet_pton(AF_INET6, "2001:db9::25", addr);
+    ck_assert_int_eq(config_ip6_check(addr), 0);
+    inet_pton(AF_INET6, "::1", addr);
+    ck_assert_int_eq(config_ip6_check(addr), 1);
+    inet_pton(AF_INET6, "::2", addr);
+    ck_assert_int_eq(config_ip6_check(addr), 0);
+    /* IPv4-mapped clients match IPv4 entries */
+    inet_pton(AF_INET6, "::ffff:192.168.1.7", addr);
+    ck_assert_int_eq(config_ip6_check(addr), 1);
+    inet_pton(AF_INET6, "::ffff:192.168.2.7", addr);
+    ck_assert_int_eq(config_ip6_check(addr), 0);
+    ck_assert_int_eq(config_ip_check(inet_addr("192.168.1.7")), 1);
+
+    unlink("/tmp/test_ip_v6.conf");
+    config_free();
+}
+END_TEST
+
 
 /* Test Suite 5: PTR Whitelist Checking */
 
@@ -637,6 +769,34 @@ START_TEST(test_ptr_check_no_match)
 }
 END_TEST
 
+START_TEST(test_ptr_check_labels)
+{
+    FILE *fp = fopen("/tmp/test_ptr_labels.conf", "w");
+    fprintf(fp, "whitelistptr example.com\n");
+    fclose(fp);
+
+    config_init();
+    config_load("/tmp/test_ptr_labels.conf");
+    ck_assert_int_eq(conf.ptr_labels, 0);
+    ck_assert_int_eq(config_ptr_check("badexample.com"), 1);
+    config_free();
+
+    fp = fopen("/tmp/test_ptr_labels.conf", "a");
+    fprintf(fp, "WhitelistPTRLabels on\n");
+    fclose(fp);
+
+    config_init();
+    config_load("/tmp/test_ptr_labels.conf");
+    ck_assert_int_eq(conf.ptr_labels, 1);
+    ck_assert_int_eq(config_ptr_check("badexample.com"), 0);
+    ck_assert_int_eq(config_ptr_check("mail.example.com"), 1);
+    ck_assert_int_eq(config_ptr_check("example.com"), 1);
+
+    unlink("/tmp/test_ptr_labels.conf");
+    config_free();
+}
+END_TEST
+
 
 /* Test Suite 6: From/To Whitelist Checking */
 
@@ -726,6 +886,222 @@ START_TEST(test_to_check_domain_match)
 }
 END_TEST
 
+START_TEST(test_typed_address_whitelists)
+{
+    FILE *fp = fopen("/tmp/test_typed.conf", "w");
+    fprintf(fp, "WhitelistFromAddr Boss@Example.com\n");
+    fprintf(fp, "WhitelistFromDomain @partner.org\n");
+    fprintf(fp, "WhitelistToDomain .example.net\n");
+    fprintf(fp, "WhitelistToAddr postmaster@example.com\n");
+    fclose(fp);
+
+    config_init();
+    ck_assert_int_eq(config_has_from_whitelist(), 0);
+    ck_assert_int_eq(config_has_to_whitelist(), 0);
+    config_load("/tmp/test_typed.conf");
+
+    ck_assert_ptr_null(conf.froms);
+    ck_assert_int_eq(config_has_from_whitelist(), 1);
+    ck_assert_int_eq(config_has_to_whitelist(), 1);
+    ck_assert_int_eq(config_from_check("boss@example.com"), 1);
+    ck_assert_int_eq(config_from_check("xboss@example.com"), 0);
+    ck_assert_int_eq(config_from_check("anyone@partner.org"), 1);
+    ck_assert_int_eq(config_from_check("anyone@mail.partner.org"), 1);
+    ck_assert_int_eq(config_from_check("anyone@notpartner.org"), 0);
+    ck_assert_int_eq(config_to_check("user@lists.example.net"), 1);
+    ck_assert_int_eq(config_to_check("postmaster@example.com"), 1);
+    ck_assert_int_eq(config_to_check("user@example.com"), 0);
+
+    unlink("/tmp/test_typed.conf");
+    config_free();
+}
+END_TEST
+
+START_TEST(test_regex_whitelists)
+{
+    FILE *fp = fopen("/tmp/test_regex.conf", "w");
+    fprintf(fp, "WhitelistPTRRegex ^mail[0-9]+\\.example\\.com$\n");
+    fprintf(fp, "WhitelistFromRegex ^bounce-[a-z0-9]+@lists\\.\n");
+    fprintf(fp, "WhitelistFromRegex (unclosed\n");
+    fclose(fp);
+
+    config_init();
+    config_load("/tmp/test_regex.conf");
+
+    ck_assert_ptr_nonnull(conf.whitelist_re);
+    ck_assert_int_eq(config_has_from_whitelist(), 1);
+    ck_assert_int_eq(config_has_to_whitelist(), 0);
+    ck_assert_int_eq(config_ptr_check("mail12.example.com"), 1);
+    ck_assert_int_eq(config_ptr_check("MAIL3.Example.COM"), 1);
+    ck_assert_int_eq(config_ptr_check("mail.example.com"), 0);
+    ck_assert_int_eq(config_ptr_check("mail12.example.com.evil.tld"), 0);
+    ck_assert_int_eq(config_from_check("bounce-4f2a@lists.partner.org"), 1);
+    ck_assert_int_eq(config_from_check("xbounce-4f2a@lists.partner.org"), 0);
+    /* Tags keep the subjects apart */
+    ck_assert_int_eq(config_from_check("mail12.example.com"), 0);
+    ck_assert_int_eq(config_to_check("bounce-4f2a@lists.partner.org"), 0);
+
+    unlink("/tmp/test_regex.conf");
+    config_free();
+    ck_assert_ptr_null(conf.whitelist_re);
+}
+END_TEST
+
+START_TEST(test_domain_policies)
+{
+    FILE *fp = fopen("/tmp/test_policy.txt", "w");
+    unsigned int global;
+    int i;
+
+    fprintf(fp, "# hosted domains\n");
+    for (i = 0; i < 1000; i++)
+        fprintf(fp, "hosted%d.example TagSubject=off\n", i);
+    fclose(fp);
+    fp = fopen("/tmp/test_policy.conf", "w");
+    fprintf(fp, "RefuseFail off\n");
+    fprintf(fp, "DomainPolicy Strict.example RefuseFail=on,SoftFail=on\n");
+    fprintf(fp, "DomainPolicy @quarantined.example Quarantine=on AddHeader=off\n");
+    fprintf(fp, "DomainPolicy broken.example RefuseFail=maybe\n");
+    fprintf(fp, "DomainPolicyFile /tmp/test_policy.txt\n");
+    fclose(fp);
+
+    config_init();
+    ck_assert_int_eq(config_has_domain_policy(), 0);
+    config_load("/tmp/test_policy.conf");
+    ck_assert_int_eq(config_has_domain_policy(), 1);
+    ck_assert_uint_eq(conf.domain_policies->count, 1002);
+
+    global = config_rcpt_policy("user@other.example");
+    ck_assert_uint_eq(global, POLICY_TAG_SUBJECT | POLICY_ADD_HEADER);
+    ck_assert_uint_eq(config_rcpt_policy("user@strict.example"), global | POLICY_REFUSE_FAIL | POLICY_SOFT_FAIL);
+    ck_assert_uint_eq(config_rcpt_policy("user@lists.strict.example"), global | POLICY_REFUSE_FAIL | POLICY_SOFT_FAIL);
+    ck_assert_uint_eq(config_rcpt_policy("user@quarantined.example"), POLICY_TAG_SUBJECT | POLICY_QUARANTINE);
+    ck_assert_uint_eq(config_rcpt_policy("user@hosted999.example"), POLICY_ADD_HEADER);
+    /* The invalid entry is dropped as a whole */
+    ck_assert_uint_eq(config_rcpt_policy("user@broken.example"), global);
+    ck_assert_uint_eq(config_rcpt_policy("no-domain"), global);
+
+    unlink("/tmp/test_policy.conf");
+    unlink("/tmp/test_policy.txt");
+    config_free();
+    ck_assert_ptr_null(conf.domain_policies);
+}
+END_TEST
+
+START_TEST(test_whitelist_files)
+{
+    FILE *fp = fopen("/tmp/test_wl_ip.txt", "w");
+    int i;
+
+    /* Twice the 10000 entries the inline list used to be capped at */
+    fprintf(fp, "# generated\n\n");
+    for (i = 0; i < 20000; i++)
+        fprintf(fp, "10.%d.%d.0/24\n", i / 256, i % 256);
+    fprintf(fp, "  2001:db8::/32  # trailing comment\n");
+    fclose(fp);
+    fp = fopen("/tmp/test_wl_ptr.txt", "w");
+    fprintf(fp, ".friendly.tld\n");
+    fclose(fp);
+    fp = fopen("/tmp/test_wl_from.txt", "w");
+    fprintf(fp, "@Partner.org\n");
+    fclose(fp);
+    fp = fopen("/tmp/test_wl.conf", "w");
+    fprintf(fp, "WhitelistIPFile /tmp/test_wl_ip.txt\n");
+    fprintf(fp, "WhitelistPTRFile /tmp/test_wl_ptr.txt\n");
+    fprintf(fp, "WhitelistFromFile /tmp/test_wl_from.txt\n");
+    fprintf(fp, "WhitelistToDomainFile /tmp/test_wl_missing.txt\n");
+    fprintf(fp, "WhitelistBogusFile /tmp/test_wl_from.txt\n");
+    fclose(fp);
+
+    config_init();
+    ck_assert_int_eq(config_load("/tmp/test_wl.conf"), 1);
+
+    /* File entries are indexed without the inline lists */
+    ck_assert_ptr_null(conf.cidrs);
+    ck_assert_ptr_null(conf.ptrs);
+    ck_assert_ptr_null(conf.froms);
+    ck_assert_int_eq(config_ip_check(inet_addr("10.0.0.1")), 1);
+    ck_assert_int_eq(config_ip_check(inet_addr("10.78.31.200")), 1);
+    ck_assert_int_eq(config_ip_check(inet_addr("10.78.32.1")), 0);
+    {
+        unsigned char ip6[16];
+
+        inet_pton(AF_INET6, "2001:db8:1::5", ip6);
+        ck_assert_int_eq(config_ip6_check(ip6), 1);
+    }
+    ck_assert_int_eq(config_ptr_check("mx.friendly.tld"), 1);
+    ck_assert_int_eq(config_has_from_whitelist(), 1);
+    ck_assert_int_eq(config_from_check("someone@partner.org"), 1);
+    ck_assert_int_eq(config_has_to_whitelist(), 0);
+
+    unlink("/tmp/test_wl_ip.txt");
+    unlink("/tmp/test_wl_ptr.txt");
+    unlink("/tmp/test_wl_from.txt");
+    unlink("/tmp/test_wl.conf");
+    config_free();
+}
+END_TEST
+
+START_TEST(test_whitelist_db)
+{
+    FILE *fp = fopen("/tmp/test_wldb_src.conf", "w");
+    fprintf(fp, "WhitelistIP 198.51.100.0/24\n");
+    fprintf(fp, "WhitelistPTR .friendly.tld\n");
+    fprintf(fp, "WhitelistToDomain example.net\n");
+    fclose(fp);
+
+    /* Compile the way smf-spf-wlc does */
+    config_init();
+    ck_assert_int_eq(config_load("/tmp/test_wldb_src.conf"), 1);
+    ck_assert_int_gt(config_whitelist_save("/tmp/test_wldb.db"), 0);
+    config_free();
+
+    fp = fopen("/tmp/test_wldb.conf", "w");
+    fprintf(fp, "WhitelistDB /tmp/test_wldb.db\n");
+    fprintf(fp, "WhitelistIP 203.0.113.0/24\n");
+    fclose(fp);
+    config_init();
+    ck_assert_int_eq(config_load("/tmp/test_wldb.conf"), 1);
+    ck_assert_int_eq(config_ip_check(inet_addr("198.51.100.7")), 1);
+    ck_assert_int_eq(config_ip_check(inet_addr("203.0.113.7")), 1);
+    ck_assert_int_eq(config_ip_check(inet_addr("192.0.2.7")), 0);
+    ck_assert_int_eq(config_ptr_check("mx.friendly.tld"), 1);
+    ck_assert_int_eq(config_has_to_whitelist(), 1);
+    ck_assert_int_eq(config_to_check("user@example.net"), 1);
+    ck_assert_int_eq(config_from_check("user@example.net"), 0);
+
+    /* Drop a new database in place, the next check maps it */
+    config_free();
+    fp = fopen("/tmp/test_wldb_src.conf", "w");
+    fprintf(fp, "WhitelistIP 192.0.2.0/24\n");
+    fclose(fp);
+    config_init();
+    config_load("/tmp/test_wldb_src.conf");
+    config_whitelist_save("/tmp/test_wldb.db.new");
+    config_free();
+
+    config_init();
+    config_load("/tmp/test_wldb.conf");
+    rename("/tmp/test_wldb.db.new", "/tmp/test_wldb.db");
+    config_whitelist_db_refresh(1);
+    ck_assert_int_eq(config_ip_check(inet_addr("192.0.2.7")), 1);
+    ck_assert_int_eq(config_ip_check(inet_addr("198.51.100.7")), 0);
+
+    /* A broken replacement keeps the database in use */
+    fp = fopen("/tmp/test_wldb.db.new", "w");
+    fprintf(fp, "garbage\n");
+    fclose(fp);
+    rename("/tmp/test_wldb.db.new", "/tmp/test_wldb.db");
+    config_whitelist_db_refresh(1);
+    ck_assert_int_eq(config_ip_check(inet_addr("192.0.2.7")), 1);
+
+    unlink("/tmp/test_wldb_src.conf");
+    unlink("/tmp/test_wldb.conf");
+    unlink("/tmp/test_wldb.db");
+    config_free();
+}
+END_TEST
+
 
 /* Test Suite 7: NAT Translation */
 
@@ -793,6 +1169,51 @@ START_TEST(test_natip_check_no_match)
 }
 END_TEST
 
+START_TEST(test_natip_check_prefixes)
+{
+    unsigned char addr[16], nat[16], expect[16];
+    FILE *fp = fopen("/tmp/test_nat_prefix.conf", "w");
+    fprintf(fp, "clientipnat 10.1.0.0/16:192.0.0.0/16\n");
+    fprintf(fp, "clientipnat 10.1.2.3:198.51.100.1\n");
+    fprintf(fp, "clientipnat fd00::/64   2001:db8::/64\n");
+    fprintf(fp, "clientipnat fd01::1 192.0.2.77\n");
+    fprintf(fp, "clientipnat 10.2.0.0/16:192.0.0.0/24\n");
+    fprintf(fp, "clientipnat fd02::1:fd03::1\n");
+    fprintf(fp, "clientipnat 10.3.0.0/24:192.168.1.5\n");
+    fclose(fp);
+
+    config_init();
+    config_load("/tmp/test_nat_prefix.conf");
+
+    /* Pools keep the host part, the most specific rule wins */
+    ck_assert_ulong_eq(config_natip_check(inet_addr("10.1.7.9")), inet_addr("192.0.7.9"));
+    ck_assert_ulong_eq(config_natip_check(inet_addr("10.1.2.3")), inet_addr("198.51.100.1"));
+    /* Pools of different sizes are rejected */
+    ck_assert_ulong_eq(config_natip_check(inet_addr("10.2.0.1")), 0);
+    /* A pool onto one address sends all of it there */
+    ck_assert_ulong_eq(config_natip_check(inet_addr("10.3.0.7")), inet_addr("192.168.1.5"));
+    ck_assert_ulong_eq(config_natip_check(inet_addr("10.3.0.200")), inet_addr("192.168.1.5"));
+
+    inet_pton(AF_INET6, "fd00::abcd:1", addr);
+    inet_pton(AF_INET6, "2001:db8::abcd:1", expect);
+    ck_assert_int_eq(config_natip6_check(addr, nat), 1);
+    ck_assert_int_eq(memcmp(nat, expect, 16), 0);
+    inet_pton(AF_INET6, "fd00:0:0:1::1", addr);
+    ck_assert_int_eq(config_natip6_check(addr, nat), 0);
+    /* IPv6 clients may be mapped onto IPv4 addresses */
+    inet_pton(AF_INET6, "fd01::1", addr);
+    inet_pton(AF_INET6, "::ffff:192.0.2.77", expect);
+    ck_assert_int_eq(config_natip6_check(addr, nat), 1);
+    ck_assert_int_eq(memcmp(nat, expect, 16), 0);
+    /* Ambiguous colons are rejected */
+    inet_pton(AF_INET6, "fd02::1", addr);
+    ck_assert_int_eq(config_natip6_check(addr, nat), 0);
+
+    unlink("/tmp/test_nat_prefix.conf");
+    config_free();
+}
+END_TEST
+
 
 /* Test Suite 8: Time Translation */
 
@@ -871,9 +1292,13 @@ Suite *config_suite(void)
     tcase_add_test(tc_load, test_load_duplicate_options);
     tcase_add_test(tc_load, test_load_invalid_ip_format);
     tcase_add_test(tc_load, test_load_invalid_cidr_mask);
+    tcase_add_test(tc_load, test_load_malformed_cidr_mask);
     tcase_add_test(tc_load, test_load_all_boolean_variations);
     tcase_add_test(tc_load, test_load_syslog_facilities);
     tcase_add_test(tc_load, test_load_file_paths);
+    tcase_add_test(tc_load, test_load_cache_file);
+    tcase_add_test(tc_load, test_load_class_ttls);
+    tcase_add_test(tc_load, test_load_cache_prefixes);
     suite_add_tcase(s, tc_load);
 
     TCase *tc_free = tcase_create("cleanup");
@@ -893,6 +1318,7 @@ Suite *config_suite(void)
     tcase_add_test(tc_ip, test_ip_check_full_range);
     tcase_add_test(tc_ip, test_ip_check_network_address);
     tcase_add_test(tc_ip, test_ip_check_broadcast_address);
+    tcase_add_test(tc_ip, test_ip_check_ipv6);
     suite_add_tcase(s, tc_ip);
 
     TCase *tc_ptr = tcase_create("ptr_checking");
@@ -901,6 +1327,7 @@ Suite *config_suite(void)
     tcase_add_test(tc_ptr, test_ptr_check_partial_match);
     tcase_add_test(tc_ptr, test_ptr_check_case_insensitive);
     tcase_add_test(tc_ptr, test_ptr_check_no_match);
+    tcase_add_test(tc_ptr, test_ptr_check_labels);
     suite_add_tcase(s, tc_ptr);
 
     TCase *tc_email = tcase_create("email_checking");
@@ -910,6 +1337,11 @@ Suite *config_suite(void)
     tcase_add_test(tc_email, test_to_check_empty_list);
     tcase_add_test(tc_email, test_to_check_exact_match);
     tcase_add_test(tc_email, test_to_check_domain_match);
+    tcase_add_test(tc_email, test_typed_address_whitelists);
+    tcase_add_test(tc_email, test_regex_whitelists);
+    tcase_add_test(tc_email, test_domain_policies);
+    tcase_add_test(tc_email, test_whitelist_files);
+    tcase_add_test(tc_email, test_whitelist_db);
     suite_add_tcase(s, tc_email);
 
     TCase *tc_nat = tcase_create("nat_translation");
@@ -917,6 +1349,7 @@ Suite *config_suite(void)
     tcase_add_test(tc_nat, test_natip_check_single_mapping);
     tcase_add_test(tc_nat, test_natip_check_multiple_mappings);
     tcase_add_test(tc_nat, test_natip_check_no_match);
+    tcase_add_test(tc_nat, test_natip_check_prefixes);
     suite_add_tcase(s, tc_nat);
 
     TCase *tc_time = tcase_create("time_translation");
@@ -0,0 +1,168 @@
+/*
+ * test_control.c - Unit tests for the admin control socket
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cache/cache.h"
+#include "control/control.h"
+
+#define CONTROL_TEST_SOCKET "/tmp/test_control.sock"
+
+/* Result codes as used by libspf2 */
+#define TEST_PASS	2
+#define TEST_FAIL	3
+
+typedef struct reply_buffer {
+    char data[8192];
+    size_t len;
+} reply_buffer;
+
+static int collect(const char *buf, size_t len, void *arg) {
+    reply_buffer *reply = (reply_buffer *)arg;
+
+    if (reply->len + len >= sizeof(reply->data))
+        return 0;
+    memcpy(reply->data + reply->len, buf, len);
+    reply->len += len;
+    reply->data[reply->len] = '\0';
+    return 1;
+}
+
+static int run(const char *line, reply_buffer *reply) {
+    reply->len = 0;
+    reply->data[0] = '\0';
+    return control_command(line, collect, reply);
+}
+
+START_TEST(test_control_flush_domain)
+{
+    reply_buffer reply;
+
+    cache_init(0);
+    cache_put("192.0.2.1|example.com", 600, TEST_PASS);
+    cache_put("192.0.2.2|Example.COM", 600, TEST_PASS);
+    cache_put("192.0.2.1|example.org", 600, TEST_FAIL);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), TEST_PASS);
+
+    ck_assert_int_eq(run("flush domain example.com", &reply), 1);
+    ck_assert_str_eq(reply.data, "OK 2 results flushed\n");
+    ck_assert_int_eq(cache_get("192.0.2.1|example.com"), CACHE_MISS);
+    ck_assert_int_eq(cache_get("192.0.2.1|example.org"), TEST_FAIL);
+    cache_destroy();
+}
+END_TEST
+
+START_TEST(test_control_flush_ip)
+{
+    reply_buffer reply;
+
+    cache_init(0);
+    cache_put("192.0.2.5|example.com", 600, TEST_PASS);
+    cache_put("192.0.2.0/24|example.net", 600, TEST_PASS);
+    cache_put("198.51.100.1|example.com", 600, TEST_PASS);
+    cache_put("2001:db8::1|example.com", 600, TEST_PASS);
+
+    /* An address also drops the aggregated result covering it */
+    ck_assert_int_eq(run("flush ip 192.0.2.5", &reply), 1);
+    ck_assert_str_eq(reply.data, "OK 2 results flushed\n");
+    ck_assert_int_eq(cache_get("198.51.100.1|example.com"), TEST_PASS);
+
+    ck_assert_int_eq(run("flush ip 2001:db8::/32", &reply), 1);
+    ck_assert_str_eq(reply.data, "OK 1 results flushed\n");
+    ck_assert_int_eq(cache_get("2001:db8::1|example.com"), CACHE_MISS);
+
+    ck_assert_int_eq(run("flush all", &reply), 1);
+    ck_assert_str_eq(reply.data, "OK 1 results flushed\n");
+    cache_destroy();
+}
+END_TEST
+
+START_TEST(test_control_dump)
+{
+    reply_buffer reply;
+
+    cache_init(0);
+    cache_put("192.0.2.1|example.com", 600, TEST_PASS);
+    cache_put("192.0.2.2|example.com", 600, CACHE_RESULT_PACK(TEST_FAIL, 0, 4));
+
+    ck_assert_int_eq(run("dump", &reply), 1);
+    ck_assert_ptr_nonnull(strstr(reply.data, "192.0.2.1|example.com 2 0 0 0 "));
+    ck_assert_ptr_nonnull(strstr(reply.data, "192.0.2.2|example.com 3 0 4 0 "));
+    ck_assert_ptr_nonnull(strstr(reply.data, "OK 2 results\n"));
+    cache_destroy();
+}
+END_TEST
+
+START_TEST(test_control_errors)
+{
+    reply_buffer reply;
+
+    cache_init(0);
+    ck_assert_int_eq(run("bogus", &reply), 0);
+    ck_assert_int_eq(strncmp(reply.data, "ERR ", 4), 0);
+    ck_assert_int_eq(run("flush", &reply), 0);
+    ck_assert_int_eq(strncmp(reply.data, "ERR ", 4), 0);
+    ck_assert_int_eq(run("flush ip 192.0.2.300", &reply), 0);
+    ck_assert_int_eq(strncmp(reply.data, "ERR ", 4), 0);
+    ck_assert_int_eq(run("flush ip 192.0.2.0/33", &reply), 0);
+    ck_assert_int_eq(run("", &reply), 0);
+    cache_destroy();
+}
+END_TEST
+
+START_TEST(test_control_socket)
+{
+    struct sockaddr_un sun;
+    char buf[4096];
+    size_t len = 0;
+    ssize_t n;
+    int fd;
+
+    cache_init(0);
+    cache_put("192.0.2.1|example.com", 600, TEST_PASS);
+    ck_assert_int_eq(control_start(CONTROL_TEST_SOCKET), 1);
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, CONTROL_TEST_SOCKET);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(connect(fd, (struct sockaddr *)&sun, sizeof(sun)), 0);
+    ck_assert_int_eq(send(fd, "flush domain example.com\n", 25, 0), 25);
+    while (len < sizeof(buf) - 1 && (n = recv(fd, buf + len, sizeof(buf) - 1 - len, 0)) > 0)
+        len += n;
+    buf[len] = '\0';
+    close(fd);
+    ck_assert_str_eq(buf, "OK 1 results flushed\n");
+
+    control_stop();
+    ck_assert_int_ne(access(CONTROL_TEST_SOCKET, F_OK), 0);
+    cache_destroy();
+}
+END_TEST
+
+/* Create test suite */
+Suite *control_suite(void)
+{
+    Suite *s = suite_create("Control");
+
+    TCase *tc_commands = tcase_create("commands");
+    tcase_add_test(tc_commands, test_control_flush_domain);
+    tcase_add_test(tc_commands, test_control_flush_ip);
+    tcase_add_test(tc_commands, test_control_dump);
+    tcase_add_test(tc_commands, test_control_errors);
+    suite_add_tcase(s, tc_commands);
+
+    TCase *tc_socket = tcase_create("socket");
+    tcase_add_test(tc_socket, test_control_socket);
+    suite_add_tcase(s, tc_socket);
+
+    return s;
+}
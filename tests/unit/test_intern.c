@@ -0,0 +1,105 @@
+/*
+ * test_intern.c - Unit tests for the interned string table
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intern.h"
+
+START_TEST(test_intern_same_string_same_id)
+{
+    intern_id a = intern_get("example.com");
+    intern_id b = intern_get("example.com");
+    intern_id c = intern_get("example.org");
+
+    ck_assert_uint_ne(a, 0);
+    ck_assert_uint_eq(a, b);
+    ck_assert_uint_ne(a, c);
+    ck_assert_str_eq(intern_str(a), "example.com");
+    ck_assert_uint_eq(intern_find("example.org"), c);
+    intern_release(a);
+    intern_release(b);
+    intern_release(c);
+}
+END_TEST
+
+START_TEST(test_intern_release_frees)
+{
+    unsigned long count = intern_count();
+    intern_id id = intern_get("release.example");
+
+    intern_ref(id);
+    ck_assert_uint_eq(intern_count(), count + 1);
+    intern_release(id);
+    ck_assert_uint_eq(intern_find("release.example"), id);
+    intern_release(id);
+    ck_assert_uint_eq(intern_find("release.example"), 0);
+    ck_assert_ptr_null(intern_str(id));
+    ck_assert_uint_eq(intern_count(), count);
+}
+END_TEST
+
+START_TEST(test_intern_find_missing)
+{
+    ck_assert_uint_eq(intern_find("missing.example"), 0);
+    /* 0 is never a valid ID */
+    intern_release(0);
+    ck_assert_ptr_null(intern_str(0));
+}
+END_TEST
+
+START_TEST(test_intern_many)
+{
+    static intern_id ids[5000];
+    unsigned long count = intern_count();
+    char name[32];
+    int i;
+
+    /* Enough strings to grow the table several times */
+    for (i = 0; i < 5000; i++) {
+        snprintf(name, sizeof(name), "host%d.example", i);
+        ids[i] = intern_get(name);
+        ck_assert_uint_ne(ids[i], 0);
+    }
+    ck_assert_uint_eq(intern_count(), count + 5000);
+    for (i = 0; i < 5000; i++) {
+        snprintf(name, sizeof(name), "host%d.example", i);
+        ck_assert_uint_eq(intern_find(name), ids[i]);
+        ck_assert_str_eq(intern_str(ids[i]), name);
+    }
+    for (i = 0; i < 5000; i++)
+        intern_release(ids[i]);
+    ck_assert_uint_eq(intern_count(), count);
+}
+END_TEST
+
+START_TEST(test_intern_ids_reused)
+{
+    intern_id a = intern_get("first.example");
+    intern_id b;
+
+    intern_release(a);
+    b = intern_get("second.example");
+    ck_assert_uint_eq(a, b);
+    ck_assert_str_eq(intern_str(b), "second.example");
+    intern_release(b);
+}
+END_TEST
+
+/* Create test suite */
+Suite *intern_suite(void)
+{
+    Suite *s = suite_create("Intern");
+
+    TCase *tc_intern = tcase_create("intern");
+    tcase_add_test(tc_intern, test_intern_same_string_same_id);
+    tcase_add_test(tc_intern, test_intern_release_frees);
+    tcase_add_test(tc_intern, test_intern_find_missing);
+    tcase_add_test(tc_intern, test_intern_many);
+    tcase_add_test(tc_intern, test_intern_ids_reused);
+    suite_add_tcase(s, tc_intern);
+
+    return s;
+}
@@ -0,0 +1,194 @@
+/*
+ * test_ip_index.c - Unit tests for the address prefix index
+ */
+
+#include <check.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "ip_index.h"
+
+static uint32_t addr(const char *str) {
+    return ntohl(inet_addr(str));
+}
+
+static const unsigned char *addr6(const char *str) {
+    static unsigned char buf[4][16];
+    static int n;
+
+    n = (n + 1) % 4;
+    ck_assert_int_eq(inet_pton(AF_INET6, str, buf[n]), 1);
+    return buf[n];
+}
+
+START_TEST(test_ip_index_empty)
+{
+    ip_index idx = { 0 };
+
+    ip_index_build(&idx);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("192.0.2.1")), 0);
+    ip_index_free(&idx);
+}
+END_TEST
+
+START_TEST(test_ip_index_prefixes)
+{
+    ip_index idx = { 0 };
+
+    ck_assert_int_eq(ip_index_add(&idx, addr("192.168.0.0"), 16), 1);
+    ck_assert_int_eq(ip_index_add(&idx, addr("10.1.2.3"), 8), 1);
+    ck_assert_int_eq(ip_index_add(&idx, addr("198.51.100.7"), 32), 1);
+    ip_index_build(&idx);
+
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("192.168.0.0")), 1);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("192.168.255.255")), 1);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("192.169.0.0")), 0);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("192.167.255.255")), 0);
+    /* Host bits of an entry are ignored */
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("10.0.0.0")), 1);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("198.51.100.7")), 1);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("198.51.100.8")), 0);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("0.0.0.0")), 0);
+    ip_index_free(&idx);
+}
+END_TEST
+
+START_TEST(test_ip_index_merge)
+{
+    ip_index idx = { 0 };
+
+    /* Nested, duplicate and adjacent prefixes collapse into one range */
+    ip_index_add(&idx, addr("10.0.0.0"), 8);
+    ip_index_add(&idx, addr("10.20.0.0"), 16);
+    ip_index_add(&idx, addr("10.0.0.0"), 8);
+    ip_index_add(&idx, addr("11.0.0.0"), 8);
+    ip_index_add(&idx, addr("203.0.113.0"), 24);
+    ip_index_build(&idx);
+
+    ck_assert_uint_eq(idx.count, 2);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("11.255.255.255")), 1);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("12.0.0.0")), 0);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("203.0.113.255")), 1);
+    ip_index_free(&idx);
+    ck_assert_uint_eq(idx.count, 0);
+}
+END_TEST
+
+START_TEST(test_ip_index_edges)
+{
+    ip_index idx = { 0 };
+
+    ip_index_add(&idx, addr("255.255.255.0"), 24);
+    ip_index_add(&idx, addr("0.0.0.0"), 32);
+    ip_index_build(&idx);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("255.255.255.255")), 1);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("0.0.0.0")), 1);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("0.0.0.1")), 0);
+
+    /* A default route swallows everything */
+    ip_index_add(&idx, addr("1.2.3.4"), 0);
+    ip_index_build(&idx);
+    ck_assert_uint_eq(idx.count, 1);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("127.0.0.1")), 1);
+    ip_index_free(&idx);
+}
+END_TEST
+
+START_TEST(test_ip_index_matches_linear_scan)
+{
+    ip_index idx = { 0 };
+    uint32_t net[500], mask[500], probe;
+    unsigned int bits, seed = 12345;
+    int i, j, expect;
+
+    for (i = 0; i < 500; i++) {
+        seed = seed * 1103515245 + 12345;
+        bits = 8 + seed % 25;
+        mask[i] = 0xffffffffU << (32 - bits);
+        seed = seed * 1103515245 + 12345;
+        net[i] = (seed & 0x0fffffff) & mask[i];
+        ip_index_add(&idx, net[i], bits);
+    }
+    ip_index_build(&idx);
+    for (i = 0; i < 20000; i++) {
+        seed = seed * 1103515245 + 12345;
+        probe = seed & 0x0fffffff;
+        if (i & 1)
+            probe = net[i % 500] | (probe & ~mask[i % 500]);
+        expect = 0;
+        for (j = 0; j < 500 && !expect; j++)
+            expect = (probe & mask[j]) == net[j];
+        ck_assert_int_eq(ip_index_lookup(&idx, probe), expect);
+    }
+    ip_index_free(&idx);
+}
+END_TEST
+
+START_TEST(test_ip_index_ipv6)
+{
+    ip_index idx = { 0 };
+
+    ck_assert_int_eq(ip_index_add6(&idx, addr6("2001:db8::"), 32), 1);
+    ck_assert_int_eq(ip_index_add6(&idx, addr6("2001:db9::"), 32), 1);
+    ck_assert_int_eq(ip_index_add6(&idx, addr6("fe80::1:2"), 128), 1);
+    ck_assert_int_eq(ip_index_add6(&idx, addr6("2001:db8:1::"), 48), 1);
+    ck_assert_int_eq(ip_index_add6(&idx, addr6("ffff:ffff:ffff:ffff:ffff:ffff:ffff:ff00"), 120), 1);
+    ip_index_build(&idx);
+
+    /* The two adjacent /32 and the nested /48 merge */
+    ck_assert_uint_eq(idx.count6, 3);
+    ck_assert_uint_eq(idx.count, 0);
+    ck_assert_int_eq(ip_index_lookup6(&idx, addr6("2001:db8::1")), 1);
+    ck_assert_int_eq(ip_index_lookup6(&idx, addr6("2001:db9:ffff:ffff:ffff:ffff:ffff:ffff")), 1);
+    ck_assert_int_eq(ip_index_lookup6(&idx, addr6("2001:dba::")), 0);
+    ck_assert_int_eq(ip_index_lookup6(&idx, addr6("2001:db7:ffff::")), 0);
+    ck_assert_int_eq(ip_index_lookup6(&idx, addr6("fe80::1:2")), 1);
+    ck_assert_int_eq(ip_index_lookup6(&idx, addr6("fe80::1:3")), 0);
+    ck_assert_int_eq(ip_index_lookup6(&idx, addr6("ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff")), 1);
+    ck_assert_int_eq(ip_index_lookup6(&idx, addr6("::")), 0);
+    ip_index_free(&idx);
+    ck_assert_uint_eq(idx.count6, 0);
+}
+END_TEST
+
+START_TEST(test_ip_index_ipv4_mapped)
+{
+    ip_index idx = { 0 };
+
+    /* A mapped prefix lands on the IPv4 side, and the other way round */
+    ip_index_add6(&idx, addr6("::ffff:198.51.100.0"), 120);
+    ip_index_add(&idx, addr("192.0.2.0"), 24);
+    ip_index_build(&idx);
+    ck_assert_uint_eq(idx.count6, 0);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("198.51.100.9")), 1);
+    ck_assert_int_eq(ip_index_lookup6(&idx, addr6("::ffff:192.0.2.9")), 1);
+    ck_assert_int_eq(ip_index_lookup6(&idx, addr6("::ffff:192.0.3.9")), 0);
+    ck_assert_int_eq(ip_index_lookup6(&idx, addr6("::192.0.2.9")), 0);
+
+    /* A shorter prefix spanning ::ffff:0:0/96 takes in all of IPv4 */
+    ip_index_add6(&idx, addr6("::"), 64);
+    ip_index_build(&idx);
+    ck_assert_int_eq(ip_index_lookup(&idx, addr("8.8.8.8")), 1);
+    ck_assert_int_eq(ip_index_lookup6(&idx, addr6("::1")), 1);
+    ck_assert_int_eq(ip_index_lookup6(&idx, addr6("2001:db8::1")), 0);
+    ip_index_free(&idx);
+}
+END_TEST
+
+/* Create test suite */
+Suite *ip_index_suite(void)
+{
+    Suite *s = suite_create("IP Index");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_ip_index_empty);
+    tcase_add_test(tc_core, test_ip_index_prefixes);
+    tcase_add_test(tc_core, test_ip_index_merge);
+    tcase_add_test(tc_core, test_ip_index_edges);
+    tcase_add_test(tc_core, test_ip_index_matches_linear_scan);
+    tcase_add_test(tc_core, test_ip_index_ipv6);
+    tcase_add_test(tc_core, test_ip_index_ipv4_mapped);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,137 @@
+/*
+ * test_ip_nat.c - Unit tests for the address translation table
+ */
+
+#include <check.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include "ip_nat.h"
+
+static const unsigned char *addr6(const char *str) {
+    static unsigned char buf[4][16];
+    static int n;
+
+    n = (n + 1) % 4;
+    ck_assert_int_eq(inet_pton(AF_INET6, str, buf[n]), 1);
+    return buf[n];
+}
+
+START_TEST(test_ip_nat_empty)
+{
+    ip_nat nat = { 0 };
+    unsigned char out[16];
+
+    ck_assert_int_eq(ip_nat_lookup(&nat, addr6("::ffff:10.0.0.1"), out), 0);
+    ip_nat_free(&nat);
+}
+END_TEST
+
+START_TEST(test_ip_nat_exact_and_pool)
+{
+    ip_nat nat = { 0 };
+    unsigned char out[16];
+
+    ck_assert_int_eq(ip_nat_add(&nat, addr6("::ffff:10.0.0.0"), 104, addr6("::ffff:192.0.0.0")), 1);
+    ck_assert_int_eq(ip_nat_add(&nat, addr6("::ffff:10.1.0.0"), 112, addr6("::ffff:198.51.0.0")), 1);
+    ck_assert_int_eq(ip_nat_add(&nat, addr6("::ffff:10.1.2.3"), 128, addr6("::ffff:203.0.113.9")), 1);
+
+    ck_assert_int_eq(ip_nat_lookup(&nat, addr6("::ffff:10.1.2.3"), out), 1);
+    ck_assert_int_eq(memcmp(out, addr6("::ffff:203.0.113.9"), 16), 0);
+    ck_assert_int_eq(ip_nat_lookup(&nat, addr6("::ffff:10.1.2.4"), out), 1);
+    ck_assert_int_eq(memcmp(out, addr6("::ffff:198.51.2.4"), 16), 0);
+    ck_assert_int_eq(ip_nat_lookup(&nat, addr6("::ffff:10.200.2.4"), out), 1);
+    ck_assert_int_eq(memcmp(out, addr6("::ffff:192.200.2.4"), 16), 0);
+    ck_assert_int_eq(ip_nat_lookup(&nat, addr6("::ffff:11.0.0.1"), out), 0);
+    ip_nat_free(&nat);
+}
+END_TEST
+
+START_TEST(test_ip_nat_many_to_one)
+{
+    ip_nat nat = { 0 };
+    unsigned char out[16];
+
+    ck_assert_int_eq(ip_nat_add_host(&nat, addr6("::ffff:10.0.0.0"), 120, addr6("::ffff:192.168.1.5")), 1);
+    ck_assert_int_eq(ip_nat_lookup(&nat, addr6("::ffff:10.0.0.7"), out), 1);
+    ck_assert_int_eq(memcmp(out, addr6("::ffff:192.168.1.5"), 16), 0);
+    ck_assert_int_eq(ip_nat_lookup(&nat, addr6("::ffff:10.0.0.255"), out), 1);
+    ck_assert_int_eq(memcmp(out, addr6("::ffff:192.168.1.5"), 16), 0);
+
+    /* A later pool mapping of the prefix keeps host bits again */
+    ck_assert_int_eq(ip_nat_add(&nat, addr6("::ffff:10.0.0.0"), 120, addr6("::ffff:192.0.2.0")), 1);
+    ck_assert_int_eq(ip_nat_lookup(&nat, addr6("::ffff:10.0.0.7"), out), 1);
+    ck_assert_int_eq(memcmp(out, addr6("::ffff:192.0.2.7"), 16), 0);
+    ip_nat_free(&nat);
+}
+END_TEST
+
+START_TEST(test_ip_nat_replace)
+{
+    ip_nat nat = { 0 };
+    unsigned char out[16];
+
+    ip_nat_add(&nat, addr6("2001:db8::1"), 128, addr6("2001:db8::2"));
+    ip_nat_add(&nat, addr6("2001:db8::1"), 128, addr6("2001:db8::3"));
+    ck_assert_uint_eq(nat.count, 1);
+    ck_assert_int_eq(ip_nat_lookup(&nat, addr6("2001:db8::1"), out), 1);
+    ck_assert_int_eq(memcmp(out, addr6("2001:db8::3"), 16), 0);
+    ip_nat_free(&nat);
+}
+END_TEST
+
+START_TEST(test_ip_nat_many)
+{
+    ip_nat nat = { 0 };
+    unsigned char src[16] = { 0 }, dst[16] = { 0 }, out[16];
+    int i;
+
+    /* Enough entries to grow the table several times */
+    src[10] = src[11] = dst[10] = dst[11] = 0xff;
+    for (i = 0; i < 5000; i++) {
+        src[12] = 10; src[14] = i >> 8; src[15] = i & 0xff;
+        dst[12] = 192; dst[14] = i & 0xff; dst[15] = i >> 8;
+        ck_assert_int_eq(ip_nat_add(&nat, src, 128, dst), 1);
+    }
+    ck_assert_uint_eq(nat.count, 5000);
+    for (i = 0; i < 5000; i++) {
+        src[12] = 10; src[14] = i >> 8; src[15] = i & 0xff;
+        ck_assert_int_eq(ip_nat_lookup(&nat, src, out), 1);
+        ck_assert_int_eq(out[12], 192);
+        ck_assert_int_eq(out[14], i & 0xff);
+        ck_assert_int_eq(out[15], i >> 8);
+    }
+    src[12] = 11;
+    ck_assert_int_eq(ip_nat_lookup(&nat, src, out), 0);
+    ip_nat_free(&nat);
+}
+END_TEST
+
+START_TEST(test_ip_nat_catch_all)
+{
+    ip_nat nat = { 0 };
+    unsigned char out[16];
+
+    /* A zero length prefix maps everything, host bits and all */
+    ip_nat_add(&nat, addr6("::"), 0, addr6("::"));
+    ck_assert_int_eq(ip_nat_lookup(&nat, addr6("2001:db8::5"), out), 1);
+    ck_assert_int_eq(memcmp(out, addr6("2001:db8::5"), 16), 0);
+    ip_nat_free(&nat);
+}
+END_TEST
+
+/* Create test suite */
+Suite *ip_nat_suite(void)
+{
+    Suite *s = suite_create("IP NAT");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_ip_nat_empty);
+    tcase_add_test(tc_core, test_ip_nat_exact_and_pool);
+    tcase_add_test(tc_core, test_ip_nat_many_to_one);
+    tcase_add_test(tc_core, test_ip_nat_replace);
+    tcase_add_test(tc_core, test_ip_nat_many);
+    tcase_add_test(tc_core, test_ip_nat_catch_all);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,94 @@
+/*
+ * test_name_trie.c - Unit tests for the host name suffix trie
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include "name_trie.h"
+
+START_TEST(test_name_trie_empty)
+{
+    name_trie *trie = name_trie_new();
+
+    ck_assert_ptr_nonnull(trie);
+    ck_assert_int_eq(name_trie_match(trie, "mail.example.com", 0), 0);
+    ck_assert_int_eq(name_trie_match(NULL, "mail.example.com", 0), 0);
+    name_trie_free(trie);
+    name_trie_free(NULL);
+}
+END_TEST
+
+START_TEST(test_name_trie_suffixes)
+{
+    name_trie *trie = name_trie_new();
+
+    ck_assert_int_eq(name_trie_add(trie, ".Example.COM"), 1);
+    ck_assert_int_eq(name_trie_add(trie, "relay.example.org"), 1);
+    ck_assert_int_eq(name_trie_add(trie, "example.net"), 1);
+
+    ck_assert_int_eq(name_trie_match(trie, "MX1.example.com", 0), 1);
+    ck_assert_int_eq(name_trie_match(trie, "example.com", 0), 0);
+    ck_assert_int_eq(name_trie_match(trie, "relay.example.org", 0), 1);
+    ck_assert_int_eq(name_trie_match(trie, "example.org", 0), 0);
+    ck_assert_int_eq(name_trie_match(trie, "example.net", 0), 1);
+    ck_assert_int_eq(name_trie_match(trie, "mail.example.net", 0), 1);
+    ck_assert_int_eq(name_trie_match(trie, "example.com.evil.org", 0), 0);
+    ck_assert_int_eq(name_trie_match(trie, "", 0), 0);
+    name_trie_free(trie);
+}
+END_TEST
+
+START_TEST(test_name_trie_labels)
+{
+    name_trie *trie = name_trie_new();
+
+    name_trie_add(trie, "example.com");
+    name_trie_add(trie, ".example.org");
+
+    /* Without label boundaries any trailing substring matches */
+    ck_assert_int_eq(name_trie_match(trie, "badexample.com", 0), 1);
+    ck_assert_int_eq(name_trie_match(trie, "badexample.com", 1), 0);
+    ck_assert_int_eq(name_trie_match(trie, "example.com", 1), 1);
+    ck_assert_int_eq(name_trie_match(trie, "mx.example.com", 1), 1);
+    ck_assert_int_eq(name_trie_match(trie, "mx.example.com.", 1), 1);
+    ck_assert_int_eq(name_trie_match(trie, "mx.example.com.", 0), 0);
+    ck_assert_int_eq(name_trie_match(trie, "mx.example.org", 1), 1);
+    ck_assert_int_eq(name_trie_match(trie, "badexample.org", 1), 0);
+    name_trie_free(trie);
+}
+END_TEST
+
+START_TEST(test_name_trie_many)
+{
+    name_trie *trie = name_trie_new();
+    char name[64];
+    int i;
+
+    /* Enough entries to grow the node array several times */
+    for (i = 0; i < 2000; i++) {
+        snprintf(name, sizeof(name), ".host%d.example.com", i);
+        ck_assert_int_eq(name_trie_add(trie, name), 1);
+    }
+    for (i = 0; i < 2000; i++) {
+        snprintf(name, sizeof(name), "mx.host%d.example.com", i);
+        ck_assert_int_eq(name_trie_match(trie, name, 1), 1);
+    }
+    ck_assert_int_eq(name_trie_match(trie, "mx.host2000.example.com", 1), 0);
+    name_trie_free(trie);
+}
+END_TEST
+
+/* Create test suite */
+Suite *name_trie_suite(void)
+{
+    Suite *s = suite_create("Name Trie");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_name_trie_empty);
+    tcase_add_test(tc_core, test_name_trie_suffixes);
+    tcase_add_test(tc_core, test_name_trie_labels);
+    tcase_add_test(tc_core, test_name_trie_many);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
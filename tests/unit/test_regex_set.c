@@ -0,0 +1,174 @@
+/*
+ * test_regex_set.c - Unit tests for the regular expression set matcher
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+#include "regex_set.h"
+
+static regex_set *re_test_set(const char *pattern) {
+    regex_set *set = regex_set_new();
+
+    ck_assert_ptr_nonnull(set);
+    ck_assert_int_eq(regex_set_add(set, pattern, 1), 1);
+    ck_assert_int_eq(regex_set_build(set), 1);
+    return set;
+}
+
+START_TEST(test_regex_set_empty)
+{
+    regex_set *set = regex_set_new();
+
+    ck_assert_int_eq(regex_set_build(set), 1);
+    ck_assert_int_eq(regex_set_match(set, "anything", 1), 0);
+    ck_assert_int_eq(regex_set_match(NULL, "anything", 1), 0);
+    regex_set_free(set);
+    regex_set_free(NULL);
+}
+END_TEST
+
+START_TEST(test_regex_set_syntax)
+{
+    regex_set *set = regex_set_new();
+
+    ck_assert_int_eq(regex_set_add(set, "(a|b", 1), 0);
+    ck_assert_int_eq(regex_set_add(set, "a)", 1), 0);
+    ck_assert_int_eq(regex_set_add(set, "[abc", 1), 0);
+    ck_assert_int_eq(regex_set_add(set, "a{3,2}", 1), 0);
+    ck_assert_int_eq(regex_set_add(set, "*a", 1), 0);
+    ck_assert_int_eq(regex_set_add(set, "a\\", 1), 0);
+    ck_assert_uint_eq(set->tags, 0);
+    /* A rejected pattern leaves the set usable */
+    ck_assert_int_eq(regex_set_add(set, "abc", 2), 1);
+    ck_assert_int_eq(regex_set_build(set), 1);
+    ck_assert_int_eq(regex_set_match(set, "xabcx", 2), 1);
+    ck_assert_int_eq(regex_set_match(set, "(a|b", 2), 0);
+    regex_set_free(set);
+}
+END_TEST
+
+START_TEST(test_regex_set_anchors)
+{
+    regex_set *set = re_test_set("^mail[0-9]+\\.example\\.com$");
+
+    ck_assert_int_eq(regex_set_match(set, "mail1.example.com", 1), 1);
+    ck_assert_int_eq(regex_set_match(set, "mail42.example.com", 1), 1);
+    ck_assert_int_eq(regex_set_match(set, "mail.example.com", 1), 0);
+    ck_assert_int_eq(regex_set_match(set, "xmail1.example.com", 1), 0);
+    ck_assert_int_eq(regex_set_match(set, "mail1.example.com.evil", 1), 0);
+    ck_assert_int_eq(regex_set_match(set, "mail1xexample.com", 1), 0);
+    regex_set_free(set);
+
+    /* Unanchored patterns match anywhere */
+    set = re_test_set("ex.mple");
+    ck_assert_int_eq(regex_set_match(set, "some.example.org", 1), 1);
+    ck_assert_int_eq(regex_set_match(set, "exmple", 1), 0);
+    regex_set_free(set);
+}
+END_TEST
+
+START_TEST(test_regex_set_syntax_features)
+{
+    regex_set *set = re_test_set("^(ab|cd){2,3}[[:digit:]]?x*$");
+
+    ck_assert_int_eq(regex_set_match(set, "abcd", 1), 1);
+    ck_assert_int_eq(regex_set_match(set, "abcdab7xx", 1), 1);
+    ck_assert_int_eq(regex_set_match(set, "ab", 1), 0);
+    ck_assert_int_eq(regex_set_match(set, "abababab", 1), 0);
+    regex_set_free(set);
+
+    set = re_test_set("^[^@]+@[a-z.-]+$");
+    ck_assert_int_eq(regex_set_match(set, "user@mail-relay.example.com", 1), 1);
+    ck_assert_int_eq(regex_set_match(set, "@example.com", 1), 0);
+    ck_assert_int_eq(regex_set_match(set, "user@exa_mple.com", 1), 0);
+    regex_set_free(set);
+
+    set = re_test_set("^\\w+\\s\\S$");
+    ck_assert_int_eq(regex_set_match(set, "a_1 x", 1), 1);
+    ck_assert_int_eq(regex_set_match(set, "a-1 x", 1), 0);
+    regex_set_free(set);
+}
+END_TEST
+
+START_TEST(test_regex_set_case)
+{
+    regex_set *set = re_test_set("^Mail[A-C]\\.Example$");
+
+    ck_assert_int_eq(regex_set_match(set, "mailb.example", 1), 1);
+    ck_assert_int_eq(regex_set_match(set, "MAILB.EXAMPLE", 1), 1);
+    ck_assert_int_eq(regex_set_match(set, "maild.example", 1), 0);
+    regex_set_free(set);
+}
+END_TEST
+
+START_TEST(test_regex_set_tags)
+{
+    regex_set *set = regex_set_new();
+
+    ck_assert_int_eq(regex_set_add(set, "^mx[0-9]*\\.", 1), 1);
+    ck_assert_int_eq(regex_set_add(set, "@partner\\.org$", 2), 1);
+    ck_assert_int_eq(regex_set_add(set, "^postmaster@", 4), 1);
+    ck_assert_int_eq(regex_set_build(set), 1);
+    ck_assert_uint_eq(set->tags, 7);
+
+    ck_assert_int_eq(regex_set_match(set, "mx1.partner.org", 1), 1);
+    ck_assert_int_eq(regex_set_match(set, "mx1.partner.org", 2 | 4), 0);
+    ck_assert_int_eq(regex_set_match(set, "bob@partner.org", 2), 1);
+    ck_assert_int_eq(regex_set_match(set, "bob@partner.org", 1), 0);
+    ck_assert_int_eq(regex_set_match(set, "postmaster@partner.org", 4), 1);
+    ck_assert_int_eq(regex_set_match(set, "postmaster@partner.org", 7), 1);
+    regex_set_free(set);
+}
+END_TEST
+
+START_TEST(test_regex_set_many)
+{
+    regex_set *set = regex_set_new();
+    char buf[64];
+    int i;
+
+    /* Hundreds of patterns still make one automaton */
+    for (i = 0; i < 500; i++) {
+        snprintf(buf, sizeof(buf), "^mx%d\\.host%d\\.(com|net)$", i, i);
+        ck_assert_int_eq(regex_set_add(set, buf, 1), 1);
+    }
+    ck_assert_int_eq(regex_set_build(set), 1);
+    ck_assert_int_eq(regex_set_match(set, "mx0.host0.com", 1), 1);
+    ck_assert_int_eq(regex_set_match(set, "mx499.host499.net", 1), 1);
+    ck_assert_int_eq(regex_set_match(set, "mx499.host498.net", 1), 0);
+    ck_assert_int_eq(regex_set_match(set, "mx500.host500.com", 1), 0);
+    regex_set_free(set);
+}
+END_TEST
+
+START_TEST(test_regex_set_nfa_fallback)
+{
+    regex_set *set = re_test_set("a.{14}b");
+
+    /* The DFA would need 2^15 states, lookups simulate the NFA */
+    ck_assert_ptr_null(set->table);
+    ck_assert_int_eq(regex_set_match(set, "xxa0123456789abcdbyy", 1), 1);
+    ck_assert_int_eq(regex_set_match(set, "xxa0123456789abcbyy", 1), 0);
+    regex_set_free(set);
+}
+END_TEST
+
+/* Create test suite */
+Suite *regex_set_suite(void)
+{
+    Suite *s = suite_create("Regex Set");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_regex_set_empty);
+    tcase_add_test(tc_core, test_regex_set_syntax);
+    tcase_add_test(tc_core, test_regex_set_anchors);
+    tcase_add_test(tc_core, test_regex_set_syntax_features);
+    tcase_add_test(tc_core, test_regex_set_case);
+    tcase_add_test(tc_core, test_regex_set_tags);
+    tcase_add_test(tc_core, test_regex_set_many);
+    tcase_add_test(tc_core, test_regex_set_nfa_fallback);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,65 @@
+/*
+ * test_spf_record.c - Unit tests for the SPF record text checks
+ */
+
+#include <check.h>
+#include "spf_record.h"
+
+START_TEST(test_spf_record_is_spf1)
+{
+    ck_assert_int_eq(spf_record_is_spf1("v=spf1 -all"), 1);
+    ck_assert_int_eq(spf_record_is_spf1("V=SPF1"), 1);
+    ck_assert_int_eq(spf_record_is_spf1("v=spf10 -all"), 0);
+    ck_assert_int_eq(spf_record_is_spf1("google-site-verification=x"), 0);
+}
+END_TEST
+
+START_TEST(test_spf_record_uniform_prefixes)
+{
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 ip4:1.2.0.0/16 -all", 0, 24), 1);
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1  +ip4:1.2.3.0/24  ~all", 0, 24), 1);
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 ip4:1.2.3.0/25 -all", 0, 24), 0);
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 ip6:2001:db8::/48 -all", 1, 64), 1);
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 ip6:2001:db8::/80 -all", 1, 64), 0);
+    /* The other family never matches */
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 ip4:1.2.3.4 ip6:2001:db8::/32 -all", 1, 64), 1);
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 ip6:2001:db8::1 ip4:1.0.0.0/8 -all", 0, 24), 1);
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1", 0, 24), 1);
+}
+END_TEST
+
+START_TEST(test_spf_record_host_mechanisms)
+{
+    /* Without a CIDR length an ip4/ip6 mechanism is a single host */
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 ip4:1.2.3.4 -all", 0, 24), 0);
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 ip4:1.2.3.4 -all", 0, 32), 1);
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 ip6:2001:db8::1 -all", 1, 64), 0);
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 ip4:1.2.3.0/ -all", 0, 24), 0);
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 ip4:1.2.3.0/33 -all", 0, 24), 0);
+}
+END_TEST
+
+START_TEST(test_spf_record_modifiers)
+{
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 redirect=_spf.example.com", 0, 24), 0);
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 ip4:1.0.0.0/8 redirect=_spf.example.com", 0, 24), 0);
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 ip4:1.0.0.0/8 exp=explain.example.com -all", 0, 24), 0);
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 include:_spf.example.com -all", 0, 24), 0);
+    ck_assert_int_eq(spf_record_prefix_uniform("v=spf1 a mx -all", 0, 24), 0);
+}
+END_TEST
+
+/* Create test suite */
+Suite *spf_record_suite(void)
+{
+    Suite *s = suite_create("SPF Record");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_spf_record_is_spf1);
+    tcase_add_test(tc_core, test_spf_record_uniform_prefixes);
+    tcase_add_test(tc_core, test_spf_record_host_mechanisms);
+    tcase_add_test(tc_core, test_spf_record_modifiers);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
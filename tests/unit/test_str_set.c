@@ -0,0 +1,142 @@
+/*
+ * test_str_set.c - Unit tests for the exact string hash set
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+#include "str_set.h"
+
+START_TEST(test_str_set_empty)
+{
+    str_set *set = str_set_new();
+
+    ck_assert_ptr_nonnull(set);
+    ck_assert_int_eq(str_set_contains(set, "example.com", 11), 0);
+    ck_assert_int_eq(str_set_contains(NULL, "example.com", 11), 0);
+    ck_assert_int_eq(str_set_contains_domain(NULL, "example.com"), 0);
+    str_set_free(set);
+    str_set_free(NULL);
+}
+END_TEST
+
+START_TEST(test_str_set_exact)
+{
+    str_set *set = str_set_new();
+
+    ck_assert_int_eq(str_set_add(set, "user@example.com"), 1);
+    ck_assert_int_eq(str_set_add(set, "user@example.com"), 1);
+    ck_assert_uint_eq(set->count, 1);
+    ck_assert_int_eq(str_set_contains(set, "user@example.com", 16), 1);
+    ck_assert_int_eq(str_set_contains(set, "user@example.co", 15), 0);
+    ck_assert_int_eq(str_set_contains(set, "xuser@example.com", 17), 0);
+    /* Only the first len bytes count */
+    ck_assert_int_eq(str_set_contains(set, "user@example.comX", 16), 1);
+    str_set_free(set);
+}
+END_TEST
+
+START_TEST(test_str_set_domains)
+{
+    str_set *set = str_set_new();
+
+    str_set_add(set, "example.com");
+    str_set_add(set, "corp.example.org");
+
+    ck_assert_int_eq(str_set_contains_domain(set, "example.com"), 1);
+    ck_assert_int_eq(str_set_contains_domain(set, "mx.eu.example.com"), 1);
+    ck_assert_int_eq(str_set_contains_domain(set, "badexample.com"), 0);
+    ck_assert_int_eq(str_set_contains_domain(set, "com"), 0);
+    ck_assert_int_eq(str_set_contains_domain(set, "a.corp.example.org"), 1);
+    ck_assert_int_eq(str_set_contains_domain(set, "example.org"), 0);
+    ck_assert_int_eq(str_set_contains_domain(set, ""), 0);
+    str_set_free(set);
+}
+END_TEST
+
+START_TEST(test_str_set_many)
+{
+    str_set *set = str_set_new();
+    char buf[64];
+    int i;
+
+    /* Enough entries to grow the table several times */
+    for (i = 0; i < 10000; i++) {
+        snprintf(buf, sizeof(buf), "user%d@example.com", i);
+        ck_assert_int_eq(str_set_add(set, buf), 1);
+    }
+    ck_assert_uint_eq(set->count, 10000);
+    for (i = 0; i < 10000; i++) {
+        snprintf(buf, sizeof(buf), "user%d@example.com", i);
+        ck_assert_int_eq(str_set_contains(set, buf, strlen(buf)), 1);
+    }
+    ck_assert_int_eq(str_set_contains(set, "user10000@example.com", 21), 0);
+    str_set_free(set);
+}
+END_TEST
+
+START_TEST(test_str_set_values)
+{
+    str_set *set = str_set_new();
+    uint32_t value;
+
+    ck_assert_int_eq(str_set_find_domain(set, "example.com", &value), 0);
+    ck_assert_int_eq(str_set_find_domain(NULL, "example.com", &value), 0);
+    ck_assert_int_eq(str_set_add(set, "plain.example"), 1);
+    ck_assert_ptr_null(set->values);
+
+    /* A later value replaces the earlier, plain entries read 0 */
+    ck_assert_int_eq(str_set_put(set, "example.com", 0x0101), 1);
+    ck_assert_int_eq(str_set_put(set, "example.com", 0x0300), 1);
+    ck_assert_int_eq(str_set_put(set, "eu.example.com", 2), 1);
+    ck_assert_uint_eq(set->count, 3);
+    ck_assert_int_eq(str_set_find_domain(set, "example.com", &value), 1);
+    ck_assert_uint_eq(value, 0x0300);
+    ck_assert_int_eq(str_set_find_domain(set, "mx.eu.example.com", &value), 1);
+    ck_assert_uint_eq(value, 2);
+    ck_assert_int_eq(str_set_find_domain(set, "lists.plain.example", &value), 1);
+    ck_assert_uint_eq(value, 0);
+    ck_assert_int_eq(str_set_find_domain(set, "badexample.com", &value), 0);
+    ck_assert_int_eq(str_set_find_domain(set, "mx.example.com", NULL), 1);
+    str_set_free(set);
+}
+END_TEST
+
+START_TEST(test_str_set_values_grow)
+{
+    str_set *set = str_set_new();
+    uint32_t value;
+    char buf[64];
+    int i;
+
+    /* Values follow their strings as the table grows */
+    for (i = 0; i < 100000; i++) {
+        snprintf(buf, sizeof(buf), "hosted%d.example", i);
+        ck_assert_int_eq(str_set_put(set, buf, (uint32_t)i), 1);
+    }
+    for (i = 0; i < 100000; i += 997) {
+        snprintf(buf, sizeof(buf), "lists.hosted%d.example", i);
+        ck_assert_int_eq(str_set_find_domain(set, buf, &value), 1);
+        ck_assert_uint_eq(value, (uint32_t)i);
+    }
+    ck_assert_int_eq(str_set_find_domain(set, "hosted100000.example", &value), 0);
+    str_set_free(set);
+}
+END_TEST
+
+/* Create test suite */
+Suite *str_set_suite(void)
+{
+    Suite *s = suite_create("String Set");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_str_set_empty);
+    tcase_add_test(tc_core, test_str_set_exact);
+    tcase_add_test(tc_core, test_str_set_domains);
+    tcase_add_test(tc_core, test_str_set_many);
+    tcase_add_test(tc_core, test_str_set_values);
+    tcase_add_test(tc_core, test_str_set_values_grow);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
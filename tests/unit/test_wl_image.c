@@ -0,0 +1,237 @@
+/*
+ * test_wl_image.c - Unit tests for the precompiled whitelist database
+ */
+
+#include <check.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "wl_image.h"
+
+#define WL_TEST_DB	"/tmp/test_wl_image.db"
+
+/* A little of every list, freed by wl_test_free() */
+static void wl_test_lists(wl_lists *lists) {
+    unsigned char ip6[16] = { 0x20, 0x01, 0x0d, 0xb8 };
+
+    memset(lists, 0, sizeof(*lists));
+    ip_index_add(&lists->ips, 0x0a000000, 8);
+    ip_index_add(&lists->ips, 0xc0a80100, 24);
+    ip_index_add6(&lists->ips, ip6, 32);
+    ip_index_build(&lists->ips);
+    lists->ptrs = name_trie_new();
+    name_trie_add(lists->ptrs, ".friendly.tld");
+    lists->from_ac = ac_new();
+    ac_add(lists->from_ac, "@partner.org");
+    ac_build(lists->from_ac);
+    lists->to_domains = str_set_new();
+    str_set_add(lists->to_domains, "example.net");
+}
+
+static void wl_test_free(wl_lists *lists) {
+    ip_index_free(&lists->ips);
+    name_trie_free(lists->ptrs);
+    ac_free(lists->from_ac);
+    str_set_free(lists->to_domains);
+}
+
+START_TEST(test_wl_image_roundtrip)
+{
+    unsigned char ip6[16] = { 0x20, 0x01, 0x0d, 0xb8, 0, 1 };
+    wl_lists lists;
+    wl_image *img;
+
+    wl_test_lists(&lists);
+    ck_assert_int_gt(wl_image_write(WL_TEST_DB, &lists), 0);
+    wl_test_free(&lists);
+
+    img = wl_image_open(WL_TEST_DB);
+    ck_assert_ptr_nonnull(img);
+    ck_assert_int_eq(ip_index_lookup(&img->lists.ips, 0x0a010203), 1);
+    ck_assert_int_eq(ip_index_lookup(&img->lists.ips, 0xc0a80105), 1);
+    ck_assert_int_eq(ip_index_lookup(&img->lists.ips, 0xc0a80205), 0);
+    ck_assert_int_eq(ip_index_lookup6(&img->lists.ips, ip6), 1);
+    ck_assert_int_eq(name_trie_match(img->lists.ptrs, "mx.friendly.tld", 0), 1);
+    ck_assert_int_eq(name_trie_match(img->lists.ptrs, "mx.hostile.tld", 0), 0);
+    ck_assert_int_eq(ac_match(img->lists.from_ac, "someone@partner.org"), 1);
+    ck_assert_int_eq(ac_match(img->lists.from_ac, "someone@other.org"), 0);
+    ck_assert_ptr_null(img->lists.to_ac);
+    ck_assert_ptr_null(img->lists.from_addrs);
+    ck_assert_int_eq(str_set_contains_domain(img->lists.to_domains, "lists.example.net"), 1);
+    ck_assert_int_eq(str_set_contains_domain(img->lists.to_domains, "example.org"), 0);
+    ck_assert_int_eq(wl_image_changed(img, WL_TEST_DB), 0);
+    wl_image_close(img);
+    unlink(WL_TEST_DB);
+}
+END_TEST
+
+START_TEST(test_wl_image_empty)
+{
+    wl_lists lists;
+    wl_image *img;
+
+    memset(&lists, 0, sizeof(lists));
+    ck_assert_int_gt(wl_image_write(WL_TEST_DB, &lists), 0);
+    img = wl_image_open(WL_TEST_DB);
+    ck_assert_ptr_nonnull(img);
+    ck_assert_int_eq(ip_index_lookup(&img->lists.ips, 0x0a000001), 0);
+    ck_assert_ptr_null(img->lists.ptrs);
+    ck_assert_ptr_null(img->lists.from_ac);
+    ck_assert_ptr_null(img->lists.to_domains);
+    wl_image_close(img);
+    wl_image_close(NULL);
+    unlink(WL_TEST_DB);
+}
+END_TEST
+
+START_TEST(test_wl_image_rejects_damage)
+{
+    wl_lists lists;
+    FILE *fp;
+    long size;
+
+    ck_assert_ptr_null(wl_image_open("/tmp/test_wl_image_missing.db"));
+
+    wl_test_lists(&lists);
+    size = wl_image_write(WL_TEST_DB, &lists);
+    wl_test_free(&lists);
+
+    /* Truncated */
+    ck_assert_int_eq(truncate(WL_TEST_DB, size - 8), 0);
+    errno = 0;
+    ck_assert_ptr_null(wl_image_open(WL_TEST_DB));
+    ck_assert_int_eq(errno, EINVAL);
+
+    /* Not a database */
+    fp = fopen(WL_TEST_DB, "w");
+    fprintf(fp, "WhitelistIP 10.0.0.0/8\n");
+    fclose(fp);
+    ck_assert_ptr_null(wl_image_open(WL_TEST_DB));
+    unlink(WL_TEST_DB);
+}
+END_TEST
+
+/* Every word of the file damaged in turn: rejected, or safe to search */
+START_TEST(test_wl_image_checks_entries)
+{
+    static char image[16384], copy[16384];
+    unsigned char ip6[16] = { 0x20, 0x01, 0x0d, 0xb8 };
+    uint32_t word, damage[2];
+    wl_lists lists;
+    wl_image *img;
+    FILE *fp;
+    long size, off;
+    int d, rejected = 0;
+
+    wl_test_lists(&lists);
+    size = wl_image_write(WL_TEST_DB, &lists);
+    wl_test_free(&lists);
+    ck_assert_int_gt(size, 0);
+    ck_assert_int_le(size, (long)sizeof(image));
+    fp = fopen(WL_TEST_DB, "r");
+    ck_assert_int_eq(fread(image, size, 1, fp), 1);
+    fclose(fp);
+
+    for (off = 0; off + 4 <= size; off += 4) {
+        memcpy(&word, image + off, 4);
+        damage[0] = word + 1;
+        damage[1] = 0x7fffffff;
+        for (d = 0; d < 2; d++) {
+            memcpy(copy, image, size);
+            memcpy(copy + off, &damage[d], 4);
+            fp = fopen(WL_TEST_DB, "w");
+            ck_assert_int_eq(fwrite(copy, size, 1, fp), 1);
+            fclose(fp);
+            if (!(img = wl_image_open(WL_TEST_DB))) {
+                rejected++;
+                continue;
+            }
+            ip_index_lookup(&img->lists.ips, 0x0a010203);
+            ip_index_lookup6(&img->lists.ips, ip6);
+            name_trie_match(img->lists.ptrs, "mx.friendly.tld", 0);
+            name_trie_match(img->lists.ptrs, "zz.friendly.tld", 1);
+            if (img->lists.from_ac)
+                ac_match(img->lists.from_ac, "someone@partner.org");
+            str_set_contains_domain(img->lists.to_domains, "lists.example.net");
+            str_set_contains_domain(img->lists.to_domains, "example.org");
+            wl_image_close(img);
+        }
+    }
+    ck_assert_int_gt(rejected, 0);
+    unlink(WL_TEST_DB);
+}
+END_TEST
+
+START_TEST(test_wl_image_replaced)
+{
+    wl_lists lists;
+    wl_image *img;
+
+    wl_test_lists(&lists);
+    wl_image_write(WL_TEST_DB, &lists);
+    img = wl_image_open(WL_TEST_DB);
+    ck_assert_ptr_nonnull(img);
+
+    /* A rewrite renames a new file into place, the mapping stays valid */
+    ip_index_add(&lists.ips, 0xac100000, 12);
+    ip_index_build(&lists.ips);
+    ck_assert_int_gt(wl_image_write(WL_TEST_DB, &lists), 0);
+    wl_test_free(&lists);
+    ck_assert_int_eq(wl_image_changed(img, WL_TEST_DB), 1);
+    ck_assert_int_eq(ip_index_lookup(&img->lists.ips, 0x0a000001), 1);
+    ck_assert_int_eq(ip_index_lookup(&img->lists.ips, 0xac100001), 0);
+    wl_image_close(img);
+
+    img = wl_image_open(WL_TEST_DB);
+    ck_assert_ptr_nonnull(img);
+    ck_assert_int_eq(ip_index_lookup(&img->lists.ips, 0xac100001), 1);
+    wl_image_close(img);
+    unlink(WL_TEST_DB);
+}
+END_TEST
+
+START_TEST(test_wl_image_compact_ac)
+{
+    wl_lists lists;
+    wl_image *img;
+    char buf[32];
+    int i;
+
+    memset(&lists, 0, sizeof(lists));
+    lists.to_ac = ac_new();
+    for (i = 0; i < 400000; i++) {
+        snprintf(buf, sizeof(buf), "@%08d.org", i * 3);
+        ac_add(lists.to_ac, buf);
+    }
+    ck_assert_int_eq(ac_build(lists.to_ac), 1);
+    ck_assert_ptr_null(lists.to_ac->table);
+    ck_assert_int_gt(wl_image_write(WL_TEST_DB, &lists), 0);
+    ac_free(lists.to_ac);
+
+    img = wl_image_open(WL_TEST_DB);
+    ck_assert_ptr_nonnull(img);
+    ck_assert_ptr_null(img->lists.to_ac->table);
+    ck_assert_int_eq(ac_match(img->lists.to_ac, "bob@00000003.org"), 1);
+    ck_assert_int_eq(ac_match(img->lists.to_ac, "bob@00000004.org"), 0);
+    wl_image_close(img);
+    unlink(WL_TEST_DB);
+}
+END_TEST
+
+/* Create test suite */
+Suite *wl_image_suite(void)
+{
+    Suite *s = suite_create("Whitelist Database");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_wl_image_roundtrip);
+    tcase_add_test(tc_core, test_wl_image_empty);
+    tcase_add_test(tc_core, test_wl_image_rejects_damage);
+    tcase_add_test(tc_core, test_wl_image_checks_entries);
+    tcase_add_test(tc_core, test_wl_image_replaced);
+    tcase_add_test(tc_core, test_wl_image_compact_ac);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}